@@ -1,27 +1,85 @@
 #include <Desfire.h>
+#include <DesfireTrace.h>
+#include <DesfireTransport.h>
 
+/**
+ * Transmits a Request for Answer To Select (RATS) without keeping the ATS parameters.
+ *
+ * Deprecated: a session created afterwards keeps the ISO/IEC 14443-4 defaults, a 32 byte FSC
+ * that ChangeKey (41 bytes) and the second AuthenticateAES frame do not fit in. Start the
+ * session with PICC_RequestATS(DesfireSession *, byte *, byte *) instead.
+ */
 MFRC522::StatusCode DESFire::PICC_RequestATS(byte *atsBuffer, byte *atsLength)
+{
+	DesfireSession session;
+
+	return PICC_RequestATS(&session, atsBuffer, atsLength);
+} // End PICC_RequestATS()
+
+/**
+ * Transmits a Request for Answer To Select (RATS) and starts a new session with the PICC.
+ *
+ * The session is reset and takes the frame size (FSCI) and frame waiting time (FWI) from
+ * the ATS, or the ISO/IEC 14443-4 defaults for the parts the PICC leaves out.
+ *
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+MFRC522::StatusCode DESFire::PICC_RequestATS(DesfireSession *session, byte *atsBuffer, byte *atsLength)
 {
 	MFRC522::StatusCode result;
 
+	session->Reset();
+
+	// A new PICC always starts at 106kBd
+	_txMode = 0x00;
+	_rxMode = 0x00;
+
+	// Frame size for proximity card (FSC) indexed by FSCI, the same coding is used for FSDI
+	static const uint16_t frameSizes[] = { 16, 24, 32, 40, 48, 64, 96, 128, 256 };
+
+	// Largest FSDI this reader can accept
+	byte fsdi = 0;
+	while (fsdi < 8 && frameSizes[fsdi + 1] <= DESFIRE_FSD)
+		fsdi++;
+	session->fsd = frameSizes[fsdi];
+
 	// Build command buffer
 	atsBuffer[0] = 0xE0; //PICC_CMD_RATS;
-	atsBuffer[1] = 0x50; // FSD=64, CID=0
+	atsBuffer[1] = fsdi << 4; // FSDI, CID=0
 
-	// Calculate CRC_A
-	result = PCD_CalculateCRC(atsBuffer, 2, &atsBuffer[2]);
-	if (result != STATUS_OK) {
-		return result;
-	}
+	// Activation frame waiting time until the ATS tells the PICC's own
+	_fwt = DESFIRE_DEFAULT_FWT;
 
-	// Transmit the buffer and receive the response, validate CRC_A.
-	result = PCD_TransceiveData(atsBuffer, 4, atsBuffer, atsLength, NULL, 0, true);
+	// Transmit the buffer and receive the response, CRC_A is handled by the MFRC522.
+	result = PCD_DesfireExchangeFrame(atsBuffer, 2, atsBuffer, atsLength);
 	if (result != STATUS_OK) {
 		PICC_HaltA();
-		Serial.println("WTF???");
 		return result;
 	}
 
+	// ISO/IEC 14443-4 default FSCI is 2 (32 bytes) when T0 is absent
+	byte fsci = 2;
+	byte fwi = 4;
+	if (*atsLength > 1 && atsBuffer[0] > 1) {
+		byte t0 = atsBuffer[1];
+		fsci = t0 & 0x0F;
+		if (fsci > 8)
+			fsci = 8; // RFU values are interpreted as 256 bytes
+
+		// TB(1) follows T0 and TA(1) when present, FWI is its upper nibble
+		byte tb = (t0 & 0x10) ? 3 : 2;
+		if ((t0 & 0x20) && tb < *atsLength && tb < atsBuffer[0]) {
+			fwi = atsBuffer[tb] >> 4;
+			if (fwi > 14)
+				fwi = 4; // RFU value, use the default
+		}
+	}
+	session->fsc = frameSizes[fsci];
+
+	// FWT = 256 * 16 / fc * 2^FWI with fc = 13.56MHz = 339 / 25 MHz
+	session->fwt = ((4096UL << fwi) * 25) / 339;
+	_fwt = session->fwt;
+
 	return result;
 } // End PICC_RequestATS()
 
@@ -36,347 +94,1627 @@ MFRC522::StatusCode DESFire::PICC_ProtocolAndParameterSelection(byte cid,	///< T
 ) {
 	MFRC522::StatusCode result;
 
-	byte ppsBuffer[5];
-	byte ppsBufferSize = 5;
+	// Keep DSI and DRI within the bit rate the adaptive RF tuning still trusts
+	if (_rfAdaptive) {
+		if (((pps1 >> 2) & 0x03) > _rf.max_bit_rate)
+			pps1 = (pps1 & ~0x0C) | (_rf.max_bit_rate << 2);
+		if ((pps1 & 0x03) > _rf.max_bit_rate)
+			pps1 = (pps1 & ~0x03) | _rf.max_bit_rate;
+	}
+
+	byte ppsBuffer[3];
+	byte ppsBufferSize = 3;
 	ppsBuffer[0] = 0xD0 | (cid & 0x0F);
 	ppsBuffer[1] = pps0;
 	ppsBuffer[2] = pps1;
 
-	// Calculate CRC_A
-	result = PCD_CalculateCRC(ppsBuffer, 3, &ppsBuffer[3]);
-	if (result != STATUS_OK) {
-		return result;
-	}
-
-	// Transmit the buffer and receive the response, validate CRC_A.
-	result = PCD_TransceiveData(ppsBuffer, 5, ppsBuffer, &ppsBufferSize, NULL, 0, true);
+	// Transmit the buffer and receive the response, CRC_A is handled by the MFRC522.
+	result = PCD_DesfireExchangeFrame(ppsBuffer, 3, ppsBuffer, &ppsBufferSize);
 	if (result == STATUS_OK) {
-		// This is how my MFRC522 is by default.
-		// Reading https://www.nxp.com/documents/data_sheet/MFRC522.pdf it seems CRC generation can only be disabled in this mode.
-		if (pps1 == 0x00) {
-			PCD_WriteRegister(TxModeReg, 0x00);
-			PCD_WriteRegister(RxModeReg, 0x00);
-		}
+		// PPS1 holds DSI (PICC to PCD) in bits 4..3 and DRI (PCD to PICC) in bits 2..1,
+		// which map directly onto the TxSpeed/RxSpeed fields of TxModeReg/RxModeReg.
+		_txMode = (pps1 & 0x03) << 4;
+		_rxMode = ((pps1 >> 2) & 0x03) << 4;
+		PCD_WriteRegister(TxModeReg, _txMode);
+		PCD_WriteRegister(RxModeReg, _rxMode);
 	}
 
 	return result;
 } // End PICC_ProtocolAndParameterSelection()
 
 /**
- * @see MIFARE_BlockExchangeWithData()
- */
-DESFire::StatusCode DESFire::MIFARE_BlockExchange(mifare_desfire_tag *tag, byte cmd, byte *backData, byte *backLen)
-{
-	return MIFARE_BlockExchangeWithData(tag, cmd, NULL, NULL, backData, backLen);
-} // End MIFARE_BlockExchange()
-
-/**
+ * Transceives a single ISO/IEC 14443-4 frame with the PICC.
  *
- * Frame Format for DESFire APDUs
- * ==============================
+ * The whole frame is written to (and read back from) the FIFO in one SPI transaction and
+ * CRC_A is appended and checked by the MFRC522 itself (TxModeReg/RxModeReg CRCEn), so there
+ * is no PCD_CalculateCRC() round trip through the coprocessor. backData never contains the
+ * CRC_A bytes. The registers are restored afterwards so MFRC522 commands keep working.
  *
- * The frame format for DESFire APDUs is based on only the ISO 14443-4 specifications for block formats.
- * This is the format used by the example firmware, and seen in Figure 3.
- *  - PCB  Protocol Control Byte, this byte is used to transfer format information about each PDU block.
- *  - CID  Card Identifier field, this byte is used to identify specific tags. It contains a 4 bit CID value as well
- *          as information on the signal strength between the reader and the tag.
- *  - NAD  Node Address field, the example firmware does not support the use of NAD.
- *  - DESFire Command Code  This is discussed in the next section.
- *  - Data Bytes  This field contains all of the Data Bytes for the command
+ * Frames larger than the 64 byte FIFO are streamed: while transmitting the FIFO is refilled
+ * each time it drops to DESFIRE_FIFO_WATER_LEVEL bytes (LoAlert) and while receiving it is
+ * drained each time it has less than DESFIRE_FIFO_WATER_LEVEL bytes free (HiAlert).
  *
- *  |-----|-----|-----|---------|------|----------|
- *  | PCB | CID | NAD | Command | Data | Checksum |
- *  |-----|-----|-----|---------|------|----------|
+ * The PICC may take its frame waiting time (FWT, from the ATS) plus deltaFWT to answer, the
+ * timer of the MFRC522 is set to that for the frame and back to the PCD_Init() 25ms afterwards.
  *
- * Documentation: http://read.pudn.com/downloads64/ebook/225463/M305_DESFireISO14443.pdf
- *                http://www.ti.com.cn/cn/lit/an/sloa213/sloa213.pdf
+ * Work left by PCD_DesfireRunOverlap() runs as soon as the frame is started when the frame and
+ * the answer announced with the work (_overlapBackLen) both fit in the FIFO: the MFRC522
+ * transmits, waits for the PICC and receives on its own meanwhile. backLen is the room of the
+ * caller's buffer, not the answer, and cannot tell. An answer longer than announced overflows
+ * the FIFO and fails the frame with STATUS_ERROR.
+ *
+ * @return STATUS_OK on success, STATUS_??? otherwise.
  */
-DESFire::StatusCode DESFire::MIFARE_BlockExchangeWithData(mifare_desfire_tag *tag, byte cmd, byte *sendData, byte *sendLen, byte *backData, byte *backLen)
-{
-	StatusCode result;
-
-	byte buffer[64];
-	byte bufferSize = 64;
-	byte sendSize = 3;
-
-	buffer[0] = tag->pcb;
-	buffer[1] = tag->cid;
-	buffer[2] = cmd;
+MFRC522::StatusCode DESFire::PCD_DesfireTransceive(byte *sendData,		///< Pointer to the data to transfer to the FIFO, without CRC_A.
+                                                   byte sendLen,		///< Number of bytes to transfer to the FIFO.
+                                                   byte *backData,		///< NULL or pointer to buffer if data should be read back after executing the command.
+                                                   byte *backLen		///< In: Max number of bytes to write to *backData. Out: The number of bytes returned.
+) {
+	MFRC522::StatusCode result = STATUS_OK;
+	byte backSize = (backData && backLen) ? *backLen : 0;
+	byte sent = (sendLen > MFRC522::FIFO_SIZE) ? MFRC522::FIFO_SIZE : sendLen;
+	byte received = 0;
+	byte n;
+
+	// Enable hardware CRC_A at the negotiated bit rate
+	PCD_WriteRegister(TxModeReg, _txMode | 0x80);
+	PCD_WriteRegister(RxModeReg, _rxMode | 0x80);
+
+	// TAuto starts the timer at the end of the transmission: 25us ticks, 125us ones past 1.6s
+	uint32_t timeout = _fwt + DESFIRE_DELTA_FWT;
+	uint32_t ticks = timeout / 25 + 1;
+	if (ticks > 0xFFFF) {
+		ticks = timeout / 125 + 1;
+		if (ticks > 0xFFFF)
+			ticks = 0xFFFF;
+		PCD_WriteRegister(TModeReg, 0x83);				// TAuto, TPrescaler = 0x34F: 13.56MHz / 1695 = 8kHz
+		PCD_WriteRegister(TPrescalerReg, 0x4F);
+	}
+	PCD_WriteRegister(TReloadRegH, ticks >> 8);
+	PCD_WriteRegister(TReloadRegL, ticks & 0xFF);
+
+	PCD_WriteRegister(CommandReg, PCD_Idle);			// Stop any active command.
+	PCD_WriteRegister(ComIrqReg, 0x7F);					// Clear all seven interrupt request bits
+	PCD_WriteRegister(FIFOLevelReg, 0x80);				// FlushBuffer = 1, FIFO initialization
+	if (sendLen > MFRC522::FIFO_SIZE || backSize > MFRC522::FIFO_SIZE) {
+		PCD_WriteRegister(WaterLevelReg, DESFIRE_FIFO_WATER_LEVEL);
+	}
+	PCD_WriteRegister(FIFODataReg, sent, sendData);		// Write the (first part of the) frame in one burst
+	PCD_WriteRegister(CommandReg, PCD_Transceive);		// Execute the command
+	PCD_WriteRegister(BitFramingReg, 0x80);				// StartSend=1, full bytes, no alignment
+
+	// Nothing to stream, the CPU is free until the answer is in the FIFO
+	if (sent == sendLen && _overlap != NULL && _overlapBackLen <= MFRC522::FIFO_SIZE)
+		PCD_DesfireRunOverlap(true);
+
+	// Wait for RxIRq or IdleIRq, the timer raises TimerIRq after the FWT. As in PCD_Init() the
+	// software deadline allows 11ms more, plus the time on air at 106kBd (about 11 bytes per ms).
+	unsigned long deadline = millis() + timeout / 1000 + 11 + ((sendLen + backSize) / 11);
+	bool completed = false;
+	do {
+		if (sent < sendLen) {
+			// Status1Reg LoAlert: FIFO holds DESFIRE_FIFO_WATER_LEVEL bytes or less
+			if (PCD_ReadRegister(Status1Reg) & 0x01) {
+				n = sendLen - sent;
+				if (n > MFRC522::FIFO_SIZE - DESFIRE_FIFO_WATER_LEVEL)
+					n = MFRC522::FIFO_SIZE - DESFIRE_FIFO_WATER_LEVEL;
+				PCD_WriteRegister(FIFODataReg, n, sendData + sent);
+				sent += n;
+			}
+			continue;
+		}
 
-	// Append data if available
-	if (sendData != NULL && sendLen != NULL) {
-		if (*sendLen > 0) {
-			memcpy(&buffer[3], sendData, *sendLen);
-			sendSize = sendSize + *sendLen;
+		n = PCD_ReadRegister(ComIrqReg);
+		if (n & 0x30) {					// RxIRq or IdleIRq
+			completed = true;
+			break;
+		}
+		if (n & 0x01) {					// Timer interrupt - nothing received
+			break;
 		}
-	}
 
-	// Update the PCB
-	if (tag->pcb == 0x0A)
-		tag->pcb = 0x0B;
-	else
-		tag->pcb = 0x0A;
+		// Once transmission is done (TxIRq) drain the FIFO whenever HiAlert is raised.
+		if ((n & 0x40) && backSize > MFRC522::FIFO_SIZE && (PCD_ReadRegister(Status1Reg) & 0x02)) {
+			n = PCD_ReadRegister(FIFOLevelReg) & 0x7F;
+			if (n > backSize - received) {
+				result = STATUS_NO_ROOM;
+				break;
+			}
+			PCD_ReadRegister(FIFODataReg, n, backData + received, 0);
+			received += n;
+		}
+		yield();
+	} while (static_cast<long>(millis() - deadline) < 0);
 
-	// Calculate CRC_A
-	result.mfrc522 = PCD_CalculateCRC(buffer, sendSize, &buffer[sendSize]);
-	if (result.mfrc522 != STATUS_OK) {
-		return result;
+	if (result != STATUS_OK) {
+		// Already failed while streaming
 	}
-
-	result.mfrc522 = PCD_TransceiveData(buffer, sendSize + 2, buffer, &bufferSize);
-	if (result.mfrc522 != STATUS_OK) {
-		return result;
+	else if (!completed) {
+		result = STATUS_TIMEOUT;
+	}
+	else {
+		// Stop now if any errors except collisions were detected.
+		// ErrorReg[7..0] bits are: WrErr TempErr reserved BufferOvfl CollErr CRCErr ParityErr ProtocolErr
+		byte errorRegValue = PCD_ReadRegister(ErrorReg);
+		if (errorRegValue & 0x13) {		// BufferOvfl ParityErr ProtocolErr
+			result = STATUS_ERROR;
+		}
+		else if (errorRegValue & 0x08) {	// CollErr
+			result = STATUS_COLLISION;
+		}
+		else if (errorRegValue & 0x04) {	// CRCErr
+			result = STATUS_CRC_WRONG;
+		}
+		else if (backData && backLen) {
+			n = PCD_ReadRegister(FIFOLevelReg) & 0x7F;
+			if (n > backSize - received) {
+				result = STATUS_NO_ROOM;
+			}
+			else {
+				PCD_ReadRegister(FIFODataReg, n, backData + received, 0);	// Read the (rest of the) frame in one burst
+				*backLen = received + n;
+			}
+		}
 	}
 
-	// Set the DESFire status code
-	result.desfire = (DesfireStatusCode)(buffer[2]);
+	PCD_WriteRegister(CommandReg, PCD_Idle);
+	PCD_WriteRegister(TxModeReg, _txMode);
+	PCD_WriteRegister(RxModeReg, _rxMode);
 
-	// Copy data to backData and backLen
-	if (backData != NULL && backLen != NULL) {
-		memcpy(backData, &buffer[3], bufferSize - 5);
-		*backLen = bufferSize - 5;
+	// The 25ms timer of PCD_Init()
+	if (timeout / 25 + 1 > 0xFFFF) {
+		PCD_WriteRegister(TModeReg, 0x80);
+		PCD_WriteRegister(TPrescalerReg, 0xA9);
 	}
+	PCD_WriteRegister(TReloadRegH, 0x03);
+	PCD_WriteRegister(TReloadRegL, 0xE8);
 
 	return result;
-} // End MIFARE_BlockExchangeWithData()
+} // End PCD_DesfireTransceive()
 
-DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetVersion(mifare_desfire_tag *tag, MIFARE_DESFIRE_Version_t *versionInfo)
+/**
+ * Exchanges a frame through the transport or PCD_DesfireTransceive(), logging both directions
+ * to the trace.
+ *
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+MFRC522::StatusCode DESFire::PCD_DesfireExchangeFrame(byte *sendData, byte sendLen, byte *backData, byte *backLen)
 {
-	StatusCode result;
-	byte versionBuffer[64];
-	byte versionBufferSize = 64;
+	MFRC522::StatusCode result;
 
-	result = MIFARE_BlockExchange(tag, 0x60, versionBuffer, &versionBufferSize);
-	if (result.mfrc522 == STATUS_OK) {
-		byte hardwareVersion[2];
-		byte storageSize;
+	if (_trace != NULL)
+		_trace->Record(false, STATUS_OK, sendData, sendLen);
 
-		versionInfo->hardware.vendor_id = versionBuffer[0];
-		versionInfo->hardware.type = versionBuffer[1];
-		versionInfo->hardware.subtype = versionBuffer[2];
-		versionInfo->hardware.version_major = versionBuffer[3];
-		versionInfo->hardware.version_minor = versionBuffer[4];
-		versionInfo->hardware.storage_size = versionBuffer[5];
-		versionInfo->hardware.protocol = versionBuffer[6];
+	if (_transport != NULL)
+		result = _transport->Transceive(sendData, sendLen, backData, backLen);
+	else
+		result = PCD_DesfireTransceive(sendData, sendLen, backData, backLen);
 
-		if (result.desfire == MF_ADDITIONAL_FRAME) {
-			result = MIFARE_BlockExchange(tag, 0xAF, versionBuffer, &versionBufferSize);
-			if (result.mfrc522 == STATUS_OK) {
-				versionInfo->software.vendor_id = versionBuffer[0];
-				versionInfo->software.type = versionBuffer[1];
-				versionInfo->software.subtype = versionBuffer[2];
-				versionInfo->software.version_major = versionBuffer[3];
-				versionInfo->software.version_minor = versionBuffer[4];
-				versionInfo->software.storage_size = versionBuffer[5];
-				versionInfo->software.protocol = versionBuffer[6];
-			} else {
-				Serial.print("Failed to send AF: ");
-				Serial.println(GetStatusCodeName(result));
-			}
+	// Work the frame could not overlap (transport, streamed frame, overlap disabled)
+	PCD_DesfireRunOverlap(false);
 
-			if (result.desfire == MF_ADDITIONAL_FRAME) {
-				byte nad = 0x60;
-				result = MIFARE_BlockExchange(tag, 0xAF, versionBuffer, &versionBufferSize);
-				if (result.mfrc522 == STATUS_OK) {
-					memcpy(versionInfo->uid, &versionBuffer[0], 7);
-					memcpy(versionInfo->batch_number, &versionBuffer[7], 5);
-					versionInfo->production_week = versionBuffer[12];
-					versionInfo->production_year = versionBuffer[13];
-				} else {
-					Serial.print("Failed to send AF: ");
-					Serial.println(GetStatusCodeName(result));
-				}
-			}
+	if (_rfAdaptive)
+		PCD_DesfireTuneRF(result);
 
-			if (result.desfire == MF_ADDITIONAL_FRAME) {
-				Serial.println("GetVersion(): More data???");
-			}
-		}
-	}
-	else {
-		Serial.println("Version(): Failure.");
+	if (_trace != NULL) {
+		if (result == STATUS_OK && backData != NULL && backLen != NULL)
+			_trace->Record(true, result, backData, *backLen);
+		else
+			_trace->Record(true, result, NULL, 0);
 	}
 
 	return result;
-} // End MIFARE_DESFIRE_GetVersion
+} // End PCD_DesfireExchangeFrame()
 
-DESFire::StatusCode DESFire::MIFARE_DESFIRE_SelectApplication(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid)
+/**
+ * Runs the work left in _overlap for the frame being exchanged, once. Crypto that does not
+ * depend on the answer (key schedules, random numbers, the expected answer) is left there
+ * before a frame is sent, so it is done while the MFRC522 and the PICC are busy instead of
+ * before or after them. With PCD_SetCryptoOverlap(false) it runs once the frame is back.
+ */
+void DESFire::PCD_DesfireRunOverlap(bool onAir)
 {
-	StatusCode result;
-
-	byte buffer[64];
-	byte bufferSize = MIFARE_AID_SIZE;
-	
-	for (byte i = 0; i < MIFARE_AID_SIZE; i++) {
-		buffer[i] = aid->data[i];
-	}
-	
-	result = MIFARE_BlockExchangeWithData(tag, 0x5A, buffer, &bufferSize, buffer, &bufferSize);
-	if (IsStatusCodeOK(result)) {
-		// keep track of the application
-		memcpy(tag->selected_application, aid->data, MIFARE_AID_SIZE);
-	}
+	if (_overlap == NULL || (onAir && !_overlapEnabled))
+		return;
 
-	return result;
-}
+	void (*work)(void *context) = _overlap;
+	_overlap = NULL;
+	work(_overlapContext);
+} // End PCD_DesfireRunOverlap()
 
-DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetFileIDs(mifare_desfire_tag *tag, byte *files, byte *filesCount)
+/**
+ * Fills buffer with the random numbers of the authentication (RndA), from random() by default:
+ * seed it with randomSeed() from a floating analog pin or better. Boards with a hardware
+ * random generator should override this.
+ */
+void DESFire::PCD_DesfireRandom(byte *buffer, byte length)
 {
-	StatusCode result;
-	
-	byte bufferSize = MIFARE_MAX_FILE_COUNT + 5;
-	byte buffer[bufferSize];
+	for (byte i = 0; i < length; i++)
+		buffer[i] = random(256);
+} // End PCD_DesfireRandom()
 
-	result = MIFARE_BlockExchange(tag, 0x6F, buffer, &bufferSize);
-	if (IsStatusCodeOK(result)) {
-		*filesCount = bufferSize;
-		memcpy(files, &buffer, *filesCount);
+/**
+ * Enables or disables the adaptive RF tuning, the current receiver gain and modulation width
+ * of the MFRC522 are taken as starting point. Call after PCD_Init().
+ */
+void DESFire::PCD_SetAdaptiveRF(bool enabled)
+{
+	_rfAdaptive = enabled;
+	if (enabled) {
+		_rf.rx_gain = PCD_GetAntennaGain();
+		_rf.mod_width = PCD_ReadRegister(ModWidthReg);
+		_rf.adjustments = 0;
+		_rfErrorRate = 0;
+		_rfFrames = 0;
+		_rfTimeouts = 0;
+		_rfCorrupted = 0;
+		_rfCleanWindows = 0;
 	}
+} // End PCD_SetAdaptiveRF()
 
-	return result;
-} // End MIFARE_DESFIRE_GetFileIDs
-
-DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetFileSettings(mifare_desfire_tag *tag, byte *file, mifare_desfire_file_settings_t *fileSettings)
+/**
+ * Restores RF parameters saved from PCD_GetRFParameters(), e.g. kept in EEPROM for a reader
+ * mounted in a difficult spot, and writes them to the MFRC522.
+ */
+void DESFire::PCD_SetRFParameters(mifare_desfire_rf_parameters_t *parameters)
 {
-	StatusCode result;
+	_rf = *parameters;
+	_rfErrorRate = (uint16_t)parameters->error_rate << 8;
+	if (_rf.max_bit_rate > 3)
+		_rf.max_bit_rate = 3;
 
-	byte buffer[21];
-	byte bufferSize = 21;
-	byte sendLen = 1;
+	PCD_SetAntennaGain(_rf.rx_gain);
+	PCD_WriteRegister(ModWidthReg, _rf.mod_width);
+} // End PCD_SetRFParameters()
 
-	buffer[0] = *file;
+/**
+ * Feeds the result of one frame to the adaptive RF tuning.
+ *
+ * The error rate is smoothed over about 16 frames and checked once every DESFIRE_RF_WINDOW
+ * frames. Above DESFIRE_RF_HIGH_ERROR_RATE one parameter is changed per window:
+ *  - corrupted answers (CRC, parity, collision) first lower the highest bit rate allowed in
+ *    PPS below the one negotiated. That takes effect from the next activation, the bit rate of
+ *    a PICC is fixed once selected, and is skipped when the session already runs at 106kBd or
+ *    under a lowered limit: the gain or modulation width is changed right away instead;
+ *  - missing answers first raise the receiver gain (RFCfgReg RxGain) one step;
+ *  - once neither helps the modulation width (ModWidthReg) is moved around its default.
+ * The bit rate is raised one step again after 16 windows below DESFIRE_RF_LOW_ERROR_RATE.
+ */
+void DESFire::PCD_DesfireTuneRF(MFRC522::StatusCode status)
+{
+	// Modulation widths tried in turn, the MFRC522 default (0x26) first
+	static const byte modWidths[] = { 0x26, 0x20, 0x2C, 0x1A, 0x32 };
 
-	result = MIFARE_BlockExchangeWithData(tag, 0xF5, buffer, &sendLen, buffer, &bufferSize);
-	if (IsStatusCodeOK(result)) {
-		fileSettings->file_type = buffer[0];
-		fileSettings->communication_settings = buffer[1];
-		fileSettings->access_rights = ((uint16_t)(buffer[2]) << 8) | (buffer[3]);
+	bool timeout = (status == STATUS_TIMEOUT);
+	bool corrupted = (status == STATUS_CRC_WRONG || status == STATUS_COLLISION || status == STATUS_ERROR);
 
-		switch (buffer[0]) {
-			case MDFT_STANDARD_DATA_FILE:
-			case MDFT_BACKUP_DATA_FILE:
-				fileSettings->settings.standard_file.file_size = ((uint32_t)(buffer[4])) | ((uint32_t)(buffer[5]) << 8) | ((uint32_t)(buffer[6])  << 16);
-				break;
+	if (timeout)
+		_rfTimeouts++;
+	if (corrupted)
+		_rfCorrupted++;
+	_rfErrorRate = (uint16_t)((int32_t)_rfErrorRate + (((timeout || corrupted) ? 0xFFFFL : 0L) - _rfErrorRate) / 16);
 
-			case MDFT_VALUE_FILE_WITH_BACKUP:
-				fileSettings->settings.value_file.lower_limit = ((uint32_t)(buffer[4])) | ((uint32_t)(buffer[5]) << 8) | ((uint32_t)(buffer[6]) << 16) | ((uint32_t)(buffer[7]) << 24);
-				fileSettings->settings.value_file.upper_limit = ((uint32_t)(buffer[8])) | ((uint32_t)(buffer[9]) << 8) | ((uint32_t)(buffer[10]) << 16) | ((uint32_t)(buffer[11]) << 24);
-				fileSettings->settings.value_file.limited_credit_value = ((uint32_t)(buffer[12])) | ((uint32_t)(buffer[13]) << 8) | ((uint32_t)(buffer[14]) << 16) | ((uint32_t)(buffer[15]) << 24);
-				fileSettings->settings.value_file.limited_credit_enabled = buffer[16];
-				break;
+	if (++_rfFrames < DESFIRE_RF_WINDOW)
+		return;
 
-			case MDFT_LINEAR_RECORD_FILE_WITH_BACKUP:
-			case MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP:
-				fileSettings->settings.record_file.record_size = ((uint32_t)(buffer[4])) | ((uint32_t)(buffer[5]) << 8) | ((uint32_t)(buffer[6]) << 16);
-				fileSettings->settings.record_file.max_number_of_records = ((uint32_t)(buffer[7])) | ((uint32_t)(buffer[8]) << 8) | ((uint32_t)(buffer[9]) << 16);
-				fileSettings->settings.record_file.current_number_of_records = ((uint32_t)(buffer[10])) | ((uint32_t)(buffer[11]) << 8) | ((uint32_t)(buffer[12]) << 16);
-				break;
+	byte errorRate = _rfErrorRate >> 8;
+	bool gainLeft = (_rf.rx_gain < RxGain_max);
+	// Bit rate of the session, the faster direction (TxSpeed/RxSpeed, 0 = 106kBd)
+	byte bitRate = (_txMode >> 4) & 0x03;
+	if (((_rxMode >> 4) & 0x03) > bitRate)
+		bitRate = (_rxMode >> 4) & 0x03;
+	if (errorRate > DESFIRE_RF_HIGH_ERROR_RATE) {
+		_rfCleanWindows = 0;
+		if (bitRate > 0 && _rf.max_bit_rate >= bitRate && (_rfCorrupted >= _rfTimeouts || !gainLeft)) {
+			_rf.max_bit_rate = bitRate - 1;
+		}
+		else if (gainLeft) {
+			// 18dB and 23dB are repeated at 0x20 and 0x30, skip them
+			_rf.rx_gain = (_rf.rx_gain < RxGain_23dB) ? RxGain_23dB : (_rf.rx_gain < RxGain_33dB) ? RxGain_33dB : _rf.rx_gain + 0x10;
+			PCD_SetAntennaGain(_rf.rx_gain);
+		}
+		else {
+			byte next = 0;
+			for (byte i = 0; i < sizeof(modWidths); i++) {
+				if (modWidths[i] == _rf.mod_width)
+					next = (i + 1) % sizeof(modWidths);
+			}
+			_rf.mod_width = modWidths[next];
+			PCD_WriteRegister(ModWidthReg, _rf.mod_width);
+		}
+		_rf.adjustments++;
 
-			default:
-				//return FAIL;
-				result.mfrc522 = STATUS_ERROR;
-				return result;
+		// Give the new setting a fresh window
+		_rfErrorRate = (uint16_t)DESFIRE_RF_HIGH_ERROR_RATE << 8;
+	}
+	else if (errorRate < DESFIRE_RF_LOW_ERROR_RATE && _rf.max_bit_rate < 3) {
+		if (++_rfCleanWindows >= 16) {
+			_rfCleanWindows = 0;
+			_rf.max_bit_rate++;
+			_rf.adjustments++;
 		}
 	}
 
-	return result;
-} // End MIFARE_DESFIRE_GetFileSettings
+	_rfFrames = 0;
+	_rfTimeouts = 0;
+	_rfCorrupted = 0;
+} // End PCD_DesfireTuneRF()
 
-DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetKeySettings(mifare_desfire_tag *tag, byte *settings, byte *maxKeys)
+/**
+ * Starts a transaction deadline: from now on commands that are not expected to finish within
+ * budget microseconds are not sent, see MIFARE_BlockExchangeWithData(). Multi-command
+ * operations then stop cleanly between two commands, and optional steps (census key versions,
+ * DF names and file settings, dump key versions and file contents) are skipped when they do
+ * not fit. 0 clears the deadline.
+ *
+ * The duration of a frame of each command is learned from the last commands with the same code
+ * (native command or ISO INS), set it with PCD_SetCommandCost() for commands that were never
+ * timed. Commands answering more than one frame, ReadData, ReadRecords and ISO READ BINARY, are
+ * expected to take as many frames as the bytes they may return fill.
+ */
+void DESFire::PCD_SetDeadline(uint32_t budget)
 {
-	StatusCode result;
-
-	byte buffer[7];
-	byte bufferSize = 7;
+	_deadline = (budget != 0);
+	_deadlineExceeded = false;
+	_deadlineStart = micros();
+	_deadlineBudget = budget;
+} // End PCD_SetDeadline()
 
-	result = MIFARE_BlockExchange(tag, 0x45, buffer, &bufferSize);
-	if (IsStatusCodeOK(result)) {
-		*settings = buffer[0];
-		*maxKeys = buffer[1];
-	}
+/**
+ * @return Microseconds left before the deadline, 0xFFFFFFFF without deadline.
+ */
+uint32_t DESFire::PCD_GetRemainingBudget()
+{
+	if (!_deadline)
+		return 0xFFFFFFFF;
 
-	return result;
-} // End MIFARE_DESFIRE_GetKeySettings()
+	uint32_t elapsed = micros() - _deadlineStart;
+	return (elapsed < _deadlineBudget) ? _deadlineBudget - elapsed : 0;
+} // End PCD_GetRemainingBudget()
 
-DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetKeyVersion(mifare_desfire_tag *tag, byte key, byte *version)
+/**
+ * @param reserve Microseconds kept for the commands that must follow.
+ * @return true if count commands cmd are expected to finish before the deadline.
+ */
+bool DESFire::PCD_HasBudget(byte cmd, byte count, uint32_t reserve)
 {
-	StatusCode result;
+	if (!_deadline || count == 0)
+		return true;
 
-	byte buffer[6];
-	byte bufferSize = 6;
-	byte sendLen = 1;
+	uint32_t remaining = PCD_GetRemainingBudget();
+	if (remaining <= reserve)
+		return false;
 
-	buffer[0] = key;
+	return PCD_GetCommandCost(cmd) <= (remaining - reserve) / count;
+} // End PCD_HasBudget()
 
-	result = MIFARE_BlockExchangeWithData(tag, 0x64, buffer, &sendLen, buffer, &bufferSize);
-	if (IsStatusCodeOK(result)) {
-		*version = buffer[0];
+/**
+ * @return The expected duration in microseconds of cmd exchanging frames frames.
+ */
+uint32_t DESFire::PCD_GetCommandCost(byte cmd, uint16_t frames)
+{
+	for (byte i = 0; i < _costCount; i++) {
+		if (_costCommands[i] == cmd)
+			return _costs[i] * frames;
 	}
 
-	return result;
-}
+	return (uint32_t)DESFIRE_DEFAULT_COMMAND_COST * frames;
+} // End PCD_GetCommandCost()
 
-DESFire::StatusCode DESFire::MIFARE_DESFIRE_ReadData(mifare_desfire_tag *tag, byte fid, uint32_t offset, uint32_t length, byte *backData, size_t *backLen)
+/**
+ * Sets the expected duration of one frame of cmd, later commands keep refining it.
+ */
+void DESFire::PCD_SetCommandCost(byte cmd, uint32_t cost)
 {
-	StatusCode result;
+	byte i = 0;
+	while (i < _costCount && _costCommands[i] != cmd)
+		i++;
 
-	byte buffer[64];
-	byte bufferSize = 64;
-	byte sendLen = 7;
-	size_t outSize = 0;
+	if (i == _costCount) {
+		if (_costCount < DESFIRE_COST_SLOTS) {
+			_costCount++;
+		}
+		else {
+			i = _costNext;
+			_costNext = (_costNext + 1) % DESFIRE_COST_SLOTS;
+		}
+		_costCommands[i] = cmd;
+	}
+	_costs[i] = cost;
+} // End PCD_SetCommandCost()
 
-	// file ID
-	buffer[0] = fid;
-	// offset
-	buffer[1] = (offset & 0x00000F);
-	buffer[2] = (offset & 0x00FF00) >> 8;
-	buffer[3] = (offset & 0xFF0000) >> 16;
-	// length
-	buffer[4] = (length & 0x0000FF);
-	buffer[5] = (length & 0x00FF00) >> 8;
-	buffer[6] = (length & 0xFF0000) >> 16;
-	
-	result = MIFARE_BlockExchangeWithData(tag, 0xBD, buffer, &sendLen, buffer, &bufferSize);
-	if (result.mfrc522 == STATUS_OK) {
-		do {
-			// Copy the data
-			memcpy(backData + outSize, buffer, bufferSize);
-			outSize += bufferSize;
-			*backLen = outSize;
-
-			if (result.desfire == MF_ADDITIONAL_FRAME) {
-				result = MIFARE_BlockExchange(tag, 0xAF, buffer, &bufferSize);
-			}
-		}  while (result.mfrc522 == STATUS_OK && result.desfire == MF_ADDITIONAL_FRAME);
+/**
+ * Folds the duration of a command of frames frames into its expected cost per frame. A slower
+ * command raises the cost at once, a faster one lowers it a quarter of the way: a command that
+ * just overran its estimate is not trusted to fit in it again.
+ */
+void DESFire::PCD_DesfireLearnCost(byte cmd, uint32_t elapsed, uint32_t frames)
+{
+	if (frames > 1)
+		elapsed /= frames;
+
+	for (byte i = 0; i < _costCount; i++) {
+		if (_costCommands[i] == cmd) {
+			if (elapsed >= _costs[i])
+				_costs[i] = elapsed;
+			else
+				_costs[i] -= (_costs[i] - elapsed) >> 2;
+			return;
+		}
 	}
 
-	return result;
-}
+	PCD_SetCommandCost(cmd, elapsed);
+} // End PCD_DesfireLearnCost()
 
-DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetValue(mifare_desfire_tag *tag, byte fid, int32_t *value)
+/**
+ * Expects the next command to answer up to length bytes, frameData bytes per frame. Other
+ * commands are expected to take a single frame.
+ */
+void DESFire::PCD_DesfireExpectAnswer(size_t length, byte frameData)
 {
-	StatusCode result;
+	size_t frames = (length + frameData - 1) / frameData;
 
-	byte buffer[MFRC522::FIFO_SIZE];
-	byte bufferSize = MFRC522::FIFO_SIZE;
-	byte sendLen = 1;
-	size_t outSize = 0;
+	_commandFrames = (frames > 0xFFFF) ? 0xFFFF : ((frames > 1) ? frames : 1);
+} // End PCD_DesfireExpectAnswer()
 
-	buffer[0] = fid;
+/**
+ * Starts timing cmd, unless it is not expected to finish before the deadline.
+ *
+ * @return false if cmd must not be sent, see PCD_SetDeadline().
+ */
+bool DESFire::PCD_DesfireStartCommand(byte cmd)
+{
+	uint16_t frames = _commandFrames;
 
-	result = MIFARE_BlockExchangeWithData(tag, 0x6C, buffer, &sendLen, buffer, &bufferSize);
-	if (IsStatusCodeOK(result)) {
-		*value = ((uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24));
+	_commandFrames = 1;
+	if (_deadline && PCD_GetCommandCost(cmd, frames) > PCD_GetRemainingBudget()) {
+		_deadlineExceeded = true;
+		return false;
 	}
 
-	return result;
-} // End MIFARE_DESFIRE_GetValue()
+	_command = cmd;
+	_commandStarted = micros();
+	_commandExchanges = _exchangeCount;
+	return true;
+} // End PCD_DesfireStartCommand()
 
-DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetApplicationIds(mifare_desfire_tag *tag, mifare_desfire_aid_t *aids, byte *applicationCount)
+/**
+ * Learns the cost of the command being timed once its last frame has been answered.
+ */
+void DESFire::PCD_DesfireEndCommand(StatusCode result)
 {
-	StatusCode result;
-	
-	// MIFARE_MAX_APPLICATION_COUNT * MIFARE_AID_SIZE + PCB (1 byte) + CID (1 byte) + Checksum (2 bytes)
+	// Time the whole command, failed exchanges would only teach the timeout
+	if (result.mfrc522 != STATUS_OK) {
+		_command = 0x00;
+	}
+	else if (result.desfire != MF_ADDITIONAL_FRAME && _command != 0x00) {
+		PCD_DesfireLearnCost(_command, micros() - _commandStarted, _exchangeCount - _commandExchanges);
+		_command = 0x00;
+	}
+} // End PCD_DesfireEndCommand()
+
+/**
+ * @see MIFARE_BlockExchangeWithData()
+ */
+DESFire::StatusCode DESFire::MIFARE_BlockExchange(mifare_desfire_tag *tag, byte cmd, byte *backData, byte *backLen)
+{
+	return MIFARE_BlockExchangeWithData(tag, cmd, NULL, NULL, backData, backLen);
+} // End MIFARE_BlockExchange()
+
+/**
+ *
+ * Frame Format for DESFire APDUs
+ * ==============================
+ *
+ * The frame format for DESFire APDUs is based on only the ISO 14443-4 specifications for block formats.
+ * This is the format used by the example firmware, and seen in Figure 3.
+ *  - PCB  Protocol Control Byte, this byte is used to transfer format information about each PDU block.
+ *  - CID  Card Identifier field, this byte is used to identify specific tags. It contains a 4 bit CID value as well
+ *          as information on the signal strength between the reader and the tag.
+ *  - NAD  Node Address field, the example firmware does not support the use of NAD.
+ *  - DESFire Command Code  This is discussed in the next section.
+ *  - Data Bytes  This field contains all of the Data Bytes for the command
+ *
+ *  |-----|-----|-----|---------|------|----------|
+ *  | PCB | CID | NAD | Command | Data | Checksum |
+ *  |-----|-----|-----|---------|------|----------|
+ *
+ * Documentation: http://read.pudn.com/downloads64/ebook/225463/M305_DESFireISO14443.pdf
+ *                http://www.ti.com.cn/cn/lit/an/sloa213/sloa213.pdf
+ *
+ * With a deadline set, a command is only sent when its expected duration fits in the remaining
+ * budget, STATUS_TIMEOUT is returned otherwise. Additional frames (0xAF) of a command that was
+ * started are always sent, so the PICC is never left in the middle of a command.
+ *
+ * Once MIFARE_DESFIRE_AuthenticateAES() started a session, commands go through
+ * MIFARE_BlockExchangeMACed().
+ */
+DESFire::StatusCode DESFire::MIFARE_BlockExchangeWithData(mifare_desfire_tag *tag, byte cmd, byte *sendData, byte *sendLen, byte *backData, byte *backLen)
+{
+	StatusCode result;
+
+	if (cmd != 0xAF && !PCD_DesfireStartCommand(cmd)) {
+		result.mfrc522 = STATUS_TIMEOUT;
+		result.desfire = MF_OPERATION_OK;
+		return result;
+	}
+
+	// Any authentication attempt drops the current one on the PICC, SelectApplication carries no
+	// CMAC and ends the session
+	if (cmd == 0xAA || cmd == 0x1A || cmd == 0x0A)
+		tag->ResetAuthentication();
+	if (tag->session_key_length == 16 && cmd != 0x5A)
+		result = MIFARE_BlockExchangeMACed(tag, cmd, sendData, sendLen, backData, backLen);
+	else if (_wrapped)
+		result = MIFARE_BlockExchangeWrapped(tag, cmd, sendData, sendLen, backData, backLen);
+	else
+		result = MIFARE_BlockExchangeNative(tag, cmd, sendData, sendLen, backData, backLen);
+
+	PCD_DesfireEndCommand(result);
+
+	return result;
+} // End MIFARE_BlockExchangeWithData()
+
+/**
+ * Exchanges a frame of an AES session in plain communication, secured with the CMAC of DESFire
+ * EV1: every command is MACed into tag->iv without sending the MAC, and the PICC appends the
+ * first 8 bytes of the CMAC over its answer and status to the last frame of a successful answer.
+ * That CMAC is verified and stripped, an answer that does not match returns MF_INTEGRITY_ERROR
+ * and drops the authentication. Error statuses carry no CMAC.
+ *
+ * The CMAC may start in a full frame before the last one, so the last 8 bytes of a full frame
+ * are handed out with the next one. Frames before the last are not verified yet when returned.
+ *
+ * ChangeKey and ChangeKeySettings are not MACed: their cryptogram, enciphered by the caller in
+ * CBC from tag->iv, leaves its last block in the IV. After ChangeKey of the authenticated key
+ * the PICC ends the session and sends no CMAC.
+ */
+DESFire::StatusCode DESFire::MIFARE_BlockExchangeMACed(mifare_desfire_tag *tag, byte cmd, byte *sendData, byte *sendLen, byte *backData, byte *backLen)
+{
+	StatusCode result;
+	DesfireAES cipher;
+
+	// The held back end of the previous frame, then this frame's data
+	byte answer[DESFIRE_MAC_SIZE + DESFIRE_FSD - 2];
+	byte answerSize = DESFIRE_FSD - 2;
+	byte length = (sendData != NULL && sendLen != NULL) ? *sendLen : 0;
+	byte held = tag->mac_tail_length;
+
+	cipher.SetKey(tag->session_key);
+	if (cmd != 0xAF) {
+		held = 0;
+		tag->mac_block_length = 0;
+		if (cmd == 0xC4 || cmd == 0x54) {
+			if (length >= 16)
+				memcpy(tag->iv, sendData + length - 16, 16);
+		}
+		else {
+			cipher.CMACUpdate(&cmd, 1, tag->iv, tag->mac_block, &tag->mac_block_length);
+			cipher.CMACUpdate(sendData, length, tag->iv, tag->mac_block, &tag->mac_block_length);
+			cipher.CMACFinal(tag->iv, tag->mac_block, tag->mac_block_length);
+			tag->mac_block_length = 0;
+		}
+	}
+	memcpy(answer, tag->mac_tail, held);
+	tag->mac_tail_length = 0;
+
+	if (_wrapped)
+		result = MIFARE_BlockExchangeWrapped(tag, cmd, sendData, sendLen, answer + held, &answerSize);
+	else
+		result = MIFARE_BlockExchangeNative(tag, cmd, sendData, sendLen, answer + held, &answerSize);
+	if (result.mfrc522 != STATUS_OK)
+		return result;
+
+	byte size = held + answerSize;
+	if (result.desfire == MF_ADDITIONAL_FRAME) {
+		if (answerSize == DESFIRE_NATIVE_FRAME_DATA) {
+			size -= DESFIRE_MAC_SIZE;
+			memcpy(tag->mac_tail, answer + size, DESFIRE_MAC_SIZE);
+			tag->mac_tail_length = DESFIRE_MAC_SIZE;
+		}
+		cipher.CMACUpdate(answer, size, tag->iv, tag->mac_block, &tag->mac_block_length);
+	}
+	else if (result.desfire == MF_OPERATION_OK && cmd == 0xC4 && length > 0 && (sendData[0] & 0x0F) == tag->authenticated_key) {
+		tag->ResetAuthentication();
+	}
+	else if (result.desfire == MF_OPERATION_OK) {
+		byte status = MF_OPERATION_OK;
+		byte difference = 0xFF;
+
+		if (size >= DESFIRE_MAC_SIZE) {
+			size -= DESFIRE_MAC_SIZE;
+			cipher.CMACUpdate(answer, size, tag->iv, tag->mac_block, &tag->mac_block_length);
+			cipher.CMACUpdate(&status, 1, tag->iv, tag->mac_block, &tag->mac_block_length);
+			cipher.CMACFinal(tag->iv, tag->mac_block, tag->mac_block_length);
+			tag->mac_block_length = 0;
+
+			difference = 0;
+			for (byte i = 0; i < DESFIRE_MAC_SIZE; i++)
+				difference |= answer[size + i] ^ tag->iv[i];
+		}
+		if (difference != 0) {
+			tag->ResetAuthentication();
+			result.desfire = MF_INTEGRITY_ERROR;
+			return result;
+		}
+	}
+
+	if (backData != NULL && backLen != NULL) {
+		if (size > *backLen) {
+			result.mfrc522 = STATUS_NO_ROOM;
+			return result;
+		}
+		memcpy(backData, answer, size);
+		*backLen = size;
+	}
+
+	return result;
+} // End MIFARE_BlockExchangeMACed()
+
+/**
+ * Exchanges a native command in a single I-block, see MIFARE_BlockExchangeWithData().
+ */
+DESFire::StatusCode DESFire::MIFARE_BlockExchangeNative(mifare_desfire_tag *tag, byte cmd, byte *sendData, byte *sendLen, byte *backData, byte *backLen)
+{
+	StatusCode result;
+
+	// Largest frame the PICC may send back, without CRC_A
+	byte buffer[DESFIRE_FSD - 2];
+	byte bufferSize = DESFIRE_FSD - 2;
+	byte sendSize = PCD_DesfireFrameHeader(tag, buffer);
+
+	buffer[sendSize++] = cmd;
+
+	// Append data if available
+	if (sendData != NULL && sendLen != NULL) {
+		if (*sendLen > 0) {
+			// Header and command plus the two CRC_A bytes appended by the MFRC522
+			if (sendSize + *sendLen + 2 > PCD_DesfireSendLimit(tag)) {
+				result.mfrc522 = STATUS_NO_ROOM;
+				return result;
+			}
+			memcpy(&buffer[sendSize], sendData, *sendLen);
+			sendSize = sendSize + *sendLen;
+		}
+	}
+
+	// Update the PCB
+	tag->pcb ^= 0x01;
+
+	_fwt = tag->fwt;
+	result.mfrc522 = PCD_DesfireExchangeFrame(buffer, sendSize, buffer, &bufferSize);
+	_exchangeCount++;
+	if (result.mfrc522 != STATUS_OK) {
+		return result;
+	}
+
+	// Header and status are mandatory, CRC_A has already been stripped
+	byte header = PCD_DesfireFrameHeaderSize(buffer[0]);
+	if (bufferSize < header + 1) {
+		result.mfrc522 = STATUS_ERROR;
+		return result;
+	}
+
+	// Set the DESFire status code
+	result.desfire = (DesfireStatusCode)(buffer[header]);
+	MIFARE_DESFIRE_TrackStatus(tag, result.desfire);
+
+	// Copy data to backData and backLen
+	header++;
+	if (backData != NULL && backLen != NULL) {
+		if ((bufferSize - header) > *backLen) {
+			result.mfrc522 = STATUS_NO_ROOM;
+			return result;
+		}
+		memcpy(backData, &buffer[header], bufferSize - header);
+		*backLen = bufferSize - header;
+	}
+
+	return result;
+} // End MIFARE_BlockExchangeNative()
+
+/**
+ * Exchanges a native DESFire command wrapped in an ISO/IEC 7816-4 APDU.
+ *
+ *  |---------|-----|----|----|----|------|----|
+ *  | CLA(90) | INS | P1 | P2 | Lc | Data | Le |
+ *  |---------|-----|----|----|----|------|----|
+ *
+ * INS holds the native command code, P1 and P2 are always 0x00 and Lc/Data are omitted
+ * when there is no data. The PICC answers with the response data followed by SW1 = 0x91
+ * and SW2 = the native DESFire status code.
+ */
+DESFire::StatusCode DESFire::MIFARE_BlockExchangeWrapped(mifare_desfire_tag *tag, byte cmd, byte *sendData, byte *sendLen, byte *backData, byte *backLen)
+{
+	StatusCode result;
+
+	byte apdu[DESFIRE_FSD - 4];
+	byte apduSize = 4;
+	uint16_t backSize = (backData != NULL && backLen != NULL) ? *backLen : 0;
+	uint16_t statusWord;
+
+	apdu[0] = 0x90;
+	apdu[1] = cmd;
+	apdu[2] = 0x00;
+	apdu[3] = 0x00;
+
+	if (sendData != NULL && sendLen != NULL && *sendLen > 0) {
+		// CLA, INS, P1, P2, Lc, Le plus the PCB, CID and CRC_A of the frame
+		if (*sendLen + 10 > PCD_DesfireSendLimit(tag)) {
+			result.mfrc522 = STATUS_NO_ROOM;
+			return result;
+		}
+		apdu[apduSize++] = *sendLen;
+		memcpy(&apdu[apduSize], sendData, *sendLen);
+		apduSize += *sendLen;
+	}
+	apdu[apduSize++] = 0x00;
+
+	result = MIFARE_BlockExchangeAPDU(tag, apdu, apduSize, backData, &backSize, &statusWord);
+	if (result.mfrc522 == STATUS_OK && backData != NULL && backLen != NULL) {
+		*backLen = backSize;
+	}
+
+	return result;
+} // End MIFARE_BlockExchangeWrapped()
+
+/**
+ * Sends an APDU in a single I-block and receives the response, acknowledging chained
+ * I-blocks with R(ACK) blocks until the whole response has been received.
+ *
+ * The response data is copied to backData without the status word, which is returned in
+ * *statusWord and mapped onto the DESFire status code of the result.
+ */
+DESFire::StatusCode DESFire::MIFARE_BlockExchangeAPDU(mifare_desfire_tag *tag, byte *apdu, byte apduLen, byte *backData, uint16_t *backLen, uint16_t *statusWord)
+{
+	StatusCode result;
+
+	byte buffer[DESFIRE_FSD - 2];
+	byte bufferSize = DESFIRE_FSD - 2;
+	uint16_t capacity = (backData != NULL && backLen != NULL) ? *backLen : 0;
+	uint16_t outSize = 0;
+	byte sw[2];
+	byte swSize = 0;
+
+	result.desfire = MF_OPERATION_OK;
+
+	byte header = PCD_DesfireFrameHeader(tag, buffer);
+
+	// Header and the two CRC_A bytes appended by the MFRC522
+	if (header + apduLen + 2 > PCD_DesfireSendLimit(tag)) {
+		result.mfrc522 = STATUS_NO_ROOM;
+		return result;
+	}
+
+	memcpy(&buffer[header], apdu, apduLen);
+
+	// Update the PCB
+	tag->pcb ^= 0x01;
+
+	_fwt = tag->fwt;
+	result.mfrc522 = PCD_DesfireExchangeFrame(buffer, header + apduLen, buffer, &bufferSize);
+	_exchangeCount++;
+
+	while (true) {
+		if (result.mfrc522 != STATUS_OK) {
+			return result;
+		}
+		header = PCD_DesfireFrameHeaderSize(buffer[0]);
+		if (bufferSize < header) {
+			result.mfrc522 = STATUS_ERROR;
+			return result;
+		}
+
+		// Append the information field, holding back the last two bytes as the status word
+		for (byte i = header; i < bufferSize; i++) {
+			if (swSize < 2) {
+				sw[swSize++] = buffer[i];
+				continue;
+			}
+			if (outSize >= capacity) {
+				result.mfrc522 = STATUS_NO_ROOM;
+				return result;
+			}
+			backData[outSize++] = sw[0];
+			sw[0] = sw[1];
+			sw[1] = buffer[i];
+		}
+
+		// Chaining bit clear, this was the last block
+		if ((buffer[0] & 0x10) == 0x00)
+			break;
+
+		// R(ACK) asks for the next block of the chain, with the CID when the I-blocks carry one
+		buffer[0] = 0xA2 | (tag->pcb & 0x09);
+		header = 1;
+		if (tag->pcb & 0x08)
+			buffer[header++] = tag->cid;
+		tag->pcb ^= 0x01;
+
+		bufferSize = DESFIRE_FSD - 2;
+		result.mfrc522 = PCD_DesfireExchangeFrame(buffer, header, buffer, &bufferSize);
+		_exchangeCount++;
+	}
+
+	if (swSize < 2) {
+		result.mfrc522 = STATUS_ERROR;
+		return result;
+	}
+
+	*statusWord = ((uint16_t)sw[0] << 8) | sw[1];
+	if (backLen != NULL)
+		*backLen = outSize;
+	result.desfire = GetDesfireStatusCode(*statusWord);
+	MIFARE_DESFIRE_TrackStatus(tag, result.desfire);
+
+	return result;
+} // End MIFARE_BlockExchangeAPDU()
+
+/**
+ * Sends an ISO/IEC 7816-4 command APDU under the transaction deadline, timed by its INS like a
+ * native command, see MIFARE_BlockExchangeAPDU().
+ */
+DESFire::StatusCode DESFire::MIFARE_BlockExchangeISO(mifare_desfire_tag *tag, byte *apdu, byte apduLen, byte *backData, uint16_t *backLen, uint16_t *statusWord)
+{
+	StatusCode result;
+
+	// The answer is chained over as many frames as it takes, status word included
+	if (backData != NULL && backLen != NULL)
+		PCD_DesfireExpectAnswer(*backLen + 2, DESFIRE_FSD - DESFIRE_FRAME_OVERHEAD);
+
+	if (!PCD_DesfireStartCommand(apdu[1])) {
+		result.mfrc522 = STATUS_TIMEOUT;
+		result.desfire = MF_OPERATION_OK;
+		return result;
+	}
+
+	result = MIFARE_BlockExchangeAPDU(tag, apdu, apduLen, backData, backLen, statusWord);
+	PCD_DesfireEndCommand(result);
+
+	return result;
+} // End MIFARE_BlockExchangeISO()
+
+/**
+ * Writes the PCB, CID and NAD of the next I-block of the session, as announced by its PCB.
+ *
+ * @return The number of header bytes written.
+ */
+byte DESFire::PCD_DesfireFrameHeader(mifare_desfire_tag *tag, byte *buffer)
+{
+	byte size = 0;
+
+	buffer[size++] = tag->pcb;
+	if (tag->pcb & 0x08)
+		buffer[size++] = tag->cid;
+	if (tag->pcb & 0x04)
+		buffer[size++] = tag->nad;
+
+	return size;
+} // End PCD_DesfireFrameHeader()
+
+/**
+ * @return The size of the PCB, CID and NAD of a block received from the PICC.
+ */
+byte DESFire::PCD_DesfireFrameHeaderSize(byte pcb)
+{
+	byte size = 1;
+	if (pcb & 0x08)
+		size++;
+	// Only I-blocks (bits 7..6 = 00) can carry a NAD
+	if ((pcb & 0xC0) == 0x00 && (pcb & 0x04))
+		size++;
+
+	return size;
+} // End PCD_DesfireFrameHeaderSize()
+
+/**
+ * Follows the authentication state of the PICC: any error status drops the authentication,
+ * every other command counts towards the command counter of the session key.
+ */
+void DESFire::MIFARE_DESFIRE_TrackStatus(mifare_desfire_tag *tag, DesfireStatusCode status)
+{
+	if (tag->authenticated_key == DESFIRE_NOT_AUTHENTICATED)
+		return;
+
+	if (status == MF_OPERATION_OK || status == MF_ADDITIONAL_FRAME || status == MF_NO_CHANGES)
+		tag->command_counter++;
+	else
+		tag->ResetAuthentication();
+} // End MIFARE_DESFIRE_TrackStatus()
+
+/**
+ * Maps an ISO/IEC 7816-4 status word onto the closest DESFire status code.
+ */
+DESFire::DesfireStatusCode DESFire::GetDesfireStatusCode(uint16_t statusWord)
+{
+	// Wrapped native commands carry the DESFire status in SW2
+	if ((statusWord >> 8) == 0x91)
+		return (DesfireStatusCode)(statusWord & 0xFF);
+
+	switch (statusWord) {
+		case 0x9000:	return MF_OPERATION_OK;
+		case 0x6282:	return MF_BOUNDARY_ERROR;			/* End of file reached before reading Le bytes */
+		case 0x6581:	return MF_EEPROM_ERROR;				/* Memory failure */
+		case 0x6700:	return MF_LENGTH_ERROR;				/* Wrong length */
+		case 0x6982:	return MF_AUTHENTICATION_ERROR;		/* Security status not satisfied */
+		case 0x6985:	return MF_PERMISSION_ERROR;			/* Conditions of use not satisfied */
+		case 0x6A82:	return MF_FILE_NOT_FOUND;			/* File or application not found */
+		case 0x6A84:	return MF_OUT_OF_EEPROM_ERROR;		/* Not enough memory space */
+		case 0x6A86:	return MF_PARAMETER_ERROR;			/* Incorrect P1 or P2 */
+		case 0x6B00:	return MF_BOUNDARY_ERROR;			/* Wrong parameters (offset outside the file) */
+		case 0x6D00:	return MF_ILLEGAL_COMMAND_CODE;		/* Instruction not supported */
+		case 0x6E00:	return MF_ILLEGAL_COMMAND_CODE;		/* Class not supported */
+		default:		return MF_PARAMETER_ERROR;
+	}
+} // End GetDesfireStatusCode()
+
+/**
+ * Selects an application by its ISO DF name (ISO SELECT FILE, P1 = 0x04, no FCI returned).
+ */
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_ISOSelectDFName(mifare_desfire_tag *tag, byte *name, byte nameLength)
+{
+	StatusCode result;
+
+	byte apdu[5 + 16];
+	uint16_t statusWord;
+
+	if (nameLength == 0 || nameLength > 16) {
+		result.mfrc522 = STATUS_INVALID;
+		return result;
+	}
+
+	apdu[0] = 0x00;
+	apdu[1] = 0xA4;
+	apdu[2] = 0x04;
+	apdu[3] = 0x0C;
+	apdu[4] = nameLength;
+	memcpy(&apdu[5], name, nameLength);
+
+	result = MIFARE_BlockExchangeISO(tag, apdu, 5 + nameLength, NULL, NULL, &statusWord);
+	if (IsStatusCodeOK(result)) {
+		// The AID behind the DF name is unknown, make sure the next native select is not skipped,
+		// the PICC dropped any authentication
+		memset(tag->selected_application, 0xFF, MIFARE_AID_SIZE);
+		tag->ResetAuthentication();
+	}
+
+	return result;
+} // End MIFARE_DESFIRE_ISOSelectDFName()
+
+/**
+ * Reads length bytes from a transparent file with ISO READ BINARY.
+ *
+ * sfi selects the file by its ISO short file ID (1 to 31) or, when 0x00, reads the current EF.
+ * The APDU offset is 15 bits, so offset + length must not exceed 32768. An SFI READ BINARY
+ * only carries an 8 bit offset: above 255 a one byte read at offset 0 makes the file the
+ * current EF first, which costs one more exchange. Each APDU asks for up to
+ * DESFIRE_ISO_MAX_LE bytes and the PICC returns them as chained blocks of up to FSD bytes:
+ * built with a DESFIRE_FSD over 64, fewer exchanges than the 59 byte frames of ReadData.
+ *
+ * @return STATUS_INVALID for a length of 0 or a range the APDU cannot address.
+ */
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_ISOReadBinary(mifare_desfire_tag *tag, byte sfi, uint16_t offset, uint16_t length, byte *backData, size_t *backLen)
+{
+	StatusCode result;
+
+	byte apdu[7];
+	byte apduSize;
+	uint16_t statusWord;
+	size_t outSize = 0;
+
+	*backLen = 0;
+	result.desfire = MF_OPERATION_OK;
+
+	if (length == 0 || (uint32_t)offset + length > 0x8000) {
+		result.mfrc522 = STATUS_INVALID;
+		return result;
+	}
+
+	if (sfi != 0x00 && offset > 0xFF) {
+		byte first;
+		uint16_t firstSize = 1;
+
+		apdu[0] = 0x00;
+		apdu[1] = 0xB0;
+		apdu[2] = 0x80 | (sfi & 0x1F);
+		apdu[3] = 0x00;
+		apdu[4] = 0x01;
+		result = MIFARE_BlockExchangeISO(tag, apdu, 5, &first, &firstSize, &statusWord);
+		if (!IsStatusCodeOK(result))
+			return result;
+		sfi = 0x00;
+	}
+
+	result.mfrc522 = STATUS_OK;
+
+	do {
+		uint16_t chunk = length - outSize;
+		uint16_t chunkSize;
+
+		if (chunk > DESFIRE_ISO_MAX_LE)
+			chunk = DESFIRE_ISO_MAX_LE;
+		chunkSize = chunk;
+
+		apdu[0] = 0x00;
+		apdu[1] = 0xB0;
+		if (sfi != 0x00) {
+			apdu[2] = 0x80 | (sfi & 0x1F);
+			apdu[3] = offset;
+			sfi = 0x00; // The file becomes the current EF for the next chunks
+		} else {
+			apdu[2] = offset >> 8;
+			apdu[3] = offset & 0xFF;
+		}
+
+		if (chunk <= 256) {
+			apdu[4] = chunk & 0xFF; // 0x00 means 256
+			apduSize = 5;
+		} else {
+			// Extended length Le
+			apdu[4] = 0x00;
+			apdu[5] = chunk >> 8;
+			apdu[6] = chunk & 0xFF;
+			apduSize = 7;
+		}
+
+		result = MIFARE_BlockExchangeISO(tag, apdu, apduSize, backData + outSize, &chunkSize, &statusWord);
+		if (result.mfrc522 != STATUS_OK)
+			break;
+
+		outSize += chunkSize;
+		offset += chunkSize;
+
+		// A short answer means the end of the file has been reached
+		if (result.desfire != MF_OPERATION_OK || chunkSize < chunk)
+			break;
+	} while (outSize < length);
+
+	*backLen = outSize;
+
+	return result;
+} // End MIFARE_DESFIRE_ISOReadBinary()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetVersion(mifare_desfire_tag *tag, MIFARE_DESFIRE_Version_t *versionInfo)
+{
+	StatusCode result;
+	byte versionBuffer[64];
+	byte versionBufferSize = 64;
+
+	// Hardware, software, then UID and production data: a failed frame or an unexpected
+	// fourth one ends here and its status is returned
+	result = MIFARE_BlockExchange(tag, 0x60, versionBuffer, &versionBufferSize);
+	if (result.mfrc522 == STATUS_OK) {
+		versionInfo->hardware.vendor_id = versionBuffer[0];
+		versionInfo->hardware.type = versionBuffer[1];
+		versionInfo->hardware.subtype = versionBuffer[2];
+		versionInfo->hardware.version_major = versionBuffer[3];
+		versionInfo->hardware.version_minor = versionBuffer[4];
+		versionInfo->hardware.storage_size = versionBuffer[5];
+		versionInfo->hardware.protocol = versionBuffer[6];
+
+		if (result.desfire == MF_ADDITIONAL_FRAME) {
+			versionBufferSize = 64;
+			result = MIFARE_BlockExchange(tag, 0xAF, versionBuffer, &versionBufferSize);
+			if (result.mfrc522 == STATUS_OK) {
+				versionInfo->software.vendor_id = versionBuffer[0];
+				versionInfo->software.type = versionBuffer[1];
+				versionInfo->software.subtype = versionBuffer[2];
+				versionInfo->software.version_major = versionBuffer[3];
+				versionInfo->software.version_minor = versionBuffer[4];
+				versionInfo->software.storage_size = versionBuffer[5];
+				versionInfo->software.protocol = versionBuffer[6];
+			}
+
+			if (result.mfrc522 == STATUS_OK && result.desfire == MF_ADDITIONAL_FRAME) {
+				versionBufferSize = 64;
+				result = MIFARE_BlockExchange(tag, 0xAF, versionBuffer, &versionBufferSize);
+				if (result.mfrc522 == STATUS_OK) {
+					memcpy(versionInfo->uid, &versionBuffer[0], 7);
+					memcpy(versionInfo->batch_number, &versionBuffer[7], 5);
+					versionInfo->production_week = versionBuffer[12];
+					versionInfo->production_year = versionBuffer[13];
+				}
+			}
+		}
+	}
+
+	return result;
+} // End MIFARE_DESFIRE_GetVersion
+
+/**
+ * Selects an application, or the PICC level for AID 000000.
+ *
+ * Nothing is sent when the session already has the application selected, selecting it again
+ * would only cost a round trip and drop the authentication.
+ */
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_SelectApplication(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid)
+{
+	StatusCode result;
+
+	if (tag->IsSelected(aid->data)) {
+		result.mfrc522 = STATUS_OK;
+		result.desfire = MF_OPERATION_OK;
+		return result;
+	}
+
+	result = MIFARE_DESFIRE_Exchange<DesfireSelectApplicationCommand>(tag, NULL, NULL, aid->data);
+	if (IsStatusCodeOK(result)) {
+		// keep track of the application, the PICC dropped any authentication
+		memcpy(tag->selected_application, aid->data, MIFARE_AID_SIZE);
+		tag->ResetAuthentication();
+	}
+
+	return result;
+}
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetFileIDs(mifare_desfire_tag *tag, byte *files, byte *filesCount)
+{
+	StatusCode result;
+	
+	byte bufferSize = MIFARE_MAX_FILE_COUNT + 5;
+	byte buffer[bufferSize];
+
+	result = MIFARE_BlockExchange(tag, 0x6F, buffer, &bufferSize);
+	if (IsStatusCodeOK(result)) {
+		// files holds MIFARE_MAX_FILE_COUNT IDs
+		if (bufferSize > MIFARE_MAX_FILE_COUNT) {
+			result.mfrc522 = STATUS_NO_ROOM;
+			return result;
+		}
+		*filesCount = bufferSize;
+		memcpy(files, buffer, *filesCount);
+	}
+
+	return result;
+} // End MIFARE_DESFIRE_GetFileIDs
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetFileSettings(mifare_desfire_tag *tag, byte *file, mifare_desfire_file_settings_t *fileSettings)
+{
+	typedef DesfireGetFileSettingsCommand::response Header;
+	StatusCode result;
+
+	// Largest settings known here with room to spare (21 bytes), later cards append fields that are ignored
+	byte buffer[Header::size + DesfireValueFileSettings::size + 4];
+	byte bufferSize = sizeof(buffer);
+	const byte *settings = buffer + Header::size;
+
+	result = MIFARE_DESFIRE_Exchange<DesfireGetFileSettingsCommand>(tag, buffer, &bufferSize, *file);
+	if (IsStatusCodeOK(result)) {
+		fileSettings->file_type = Header::get<0>(buffer);
+		fileSettings->communication_settings = Header::get<1>(buffer);
+		fileSettings->access_rights = Header::get<2>(buffer);
+		bufferSize -= Header::size;
+
+		switch (fileSettings->file_type) {
+			case MDFT_STANDARD_DATA_FILE:
+			case MDFT_BACKUP_DATA_FILE:
+				if (bufferSize < DesfireDataFileSettings::size)
+					break;
+				fileSettings->settings.standard_file.file_size = DesfireDataFileSettings::get<0>(settings);
+				return result;
+
+			case MDFT_VALUE_FILE_WITH_BACKUP:
+				if (bufferSize < DesfireValueFileSettings::size)
+					break;
+				fileSettings->settings.value_file.lower_limit = DesfireValueFileSettings::get<0>(settings);
+				fileSettings->settings.value_file.upper_limit = DesfireValueFileSettings::get<1>(settings);
+				fileSettings->settings.value_file.limited_credit_value = DesfireValueFileSettings::get<2>(settings);
+				fileSettings->settings.value_file.limited_credit_enabled = DesfireValueFileSettings::get<3>(settings);
+				return result;
+
+			case MDFT_LINEAR_RECORD_FILE_WITH_BACKUP:
+			case MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP:
+				if (bufferSize < DesfireRecordFileSettings::size)
+					break;
+				fileSettings->settings.record_file.record_size = DesfireRecordFileSettings::get<0>(settings);
+				fileSettings->settings.record_file.max_number_of_records = DesfireRecordFileSettings::get<1>(settings);
+				fileSettings->settings.record_file.current_number_of_records = DesfireRecordFileSettings::get<2>(settings);
+				return result;
+		}
+
+		// Unknown file type or truncated response
+		result.mfrc522 = STATUS_ERROR;
+	}
+
+	return result;
+} // End MIFARE_DESFIRE_GetFileSettings
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_CreateStdDataFile(mifare_desfire_tag *tag, byte fid, byte communication, uint16_t accessRights, uint32_t fileSize)
+{
+	return MIFARE_DESFIRE_Exchange<DesfireCreateStdDataFileCommand>(tag, NULL, NULL, fid, communication, accessRights, fileSize);
+} // End MIFARE_DESFIRE_CreateStdDataFile()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_CreateBackupDataFile(mifare_desfire_tag *tag, byte fid, byte communication, uint16_t accessRights, uint32_t fileSize)
+{
+	return MIFARE_DESFIRE_Exchange<DesfireCreateBackupDataFileCommand>(tag, NULL, NULL, fid, communication, accessRights, fileSize);
+} // End MIFARE_DESFIRE_CreateBackupDataFile()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_CreateValueFile(mifare_desfire_tag *tag, byte fid, byte communication, uint16_t accessRights, int32_t lowerLimit, int32_t upperLimit, int32_t value, byte limitedCreditEnabled)
+{
+	return MIFARE_DESFIRE_Exchange<DesfireCreateValueFileCommand>(tag, NULL, NULL, fid, communication, accessRights, lowerLimit, upperLimit, value, limitedCreditEnabled);
+} // End MIFARE_DESFIRE_CreateValueFile()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_CreateLinearRecordFile(mifare_desfire_tag *tag, byte fid, byte communication, uint16_t accessRights, uint32_t recordSize, uint32_t maxRecords)
+{
+	return MIFARE_DESFIRE_Exchange<DesfireCreateLinearRecordFileCommand>(tag, NULL, NULL, fid, communication, accessRights, recordSize, maxRecords);
+} // End MIFARE_DESFIRE_CreateLinearRecordFile()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_CreateCyclicRecordFile(mifare_desfire_tag *tag, byte fid, byte communication, uint16_t accessRights, uint32_t recordSize, uint32_t maxRecords)
+{
+	return MIFARE_DESFIRE_Exchange<DesfireCreateCyclicRecordFileCommand>(tag, NULL, NULL, fid, communication, accessRights, recordSize, maxRecords);
+} // End MIFARE_DESFIRE_CreateCyclicRecordFile()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetKeySettings(mifare_desfire_tag *tag, byte *settings, byte *maxKeys)
+{
+	typedef DesfireGetKeySettingsCommand::response Response;
+	StatusCode result;
+
+	byte buffer[Response::size];
+	byte bufferSize = Response::size;
+
+	result = MIFARE_DESFIRE_Exchange<DesfireGetKeySettingsCommand>(tag, buffer, &bufferSize);
+	if (IsStatusCodeOK(result)) {
+		*settings = Response::get<0>(buffer);
+		*maxKeys = Response::get<1>(buffer);
+	}
+
+	return result;
+} // End MIFARE_DESFIRE_GetKeySettings()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetKeyVersion(mifare_desfire_tag *tag, byte key, byte *version)
+{
+	typedef DesfireGetKeyVersionCommand::response Response;
+	StatusCode result;
+
+	byte buffer[Response::size];
+	byte bufferSize = Response::size;
+
+	result = MIFARE_DESFIRE_Exchange<DesfireGetKeyVersionCommand>(tag, buffer, &bufferSize, key);
+	if (IsStatusCodeOK(result)) {
+		*version = Response::get<0>(buffer);
+	}
+
+	return result;
+}
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetFreeMemory(mifare_desfire_tag *tag, uint32_t *freeMemory)
+{
+	typedef DesfireGetFreeMemoryCommand::response Response;
+	StatusCode result;
+
+	byte buffer[Response::size];
+	byte bufferSize = Response::size;
+
+	result = MIFARE_DESFIRE_Exchange<DesfireGetFreeMemoryCommand>(tag, buffer, &bufferSize);
+	if (IsStatusCodeOK(result)) {
+		*freeMemory = Response::get<0>(buffer);
+	}
+
+	return result;
+} // End MIFARE_DESFIRE_GetFreeMemory()
+
+/**
+ * Returns the DF names of all the applications of the PICC that have one.
+ * The PICC answers with one application per frame: AID, ISO file ID and DF name (1 to 16 bytes).
+ *
+ * @param nameCount In: Max number of names in *names. Out: The number of names returned.
+ */
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetDFNames(mifare_desfire_tag *tag, mifare_desfire_df_name_t *names, byte *nameCount)
+{
+	typedef DesfireGetDFNamesCommand::response Header;
+	StatusCode result;
+
+	byte buffer[Header::size + 16];
+	byte bufferSize = sizeof(buffer);
+	byte maxNames = *nameCount;
+
+	*nameCount = 0;
+	// Not MIFARE_DESFIRE_Exchange(), a PICC without DF names answers an empty frame
+	result = MIFARE_BlockExchange(tag, DesfireGetDFNamesCommand::opcode, buffer, &bufferSize);
+	while (result.mfrc522 == STATUS_OK && (result.desfire == MF_OPERATION_OK || result.desfire == MF_ADDITIONAL_FRAME)) {
+		// The last frame may be empty
+		if (bufferSize >= Header::size) {
+			if (*nameCount >= maxNames) {
+				result.mfrc522 = STATUS_NO_ROOM;
+				return result;
+			}
+
+			mifare_desfire_df_name_t *name = &(names[*nameCount]);
+			memcpy(name->aid.data, Header::get<0>(buffer), MIFARE_AID_SIZE);
+			name->iso_fid = Header::get<1>(buffer);
+			name->name_length = bufferSize - Header::size;
+			memcpy(name->name, buffer + Header::size, name->name_length);
+			(*nameCount)++;
+		}
+
+		if (result.desfire != MF_ADDITIONAL_FRAME)
+			break;
+
+		bufferSize = sizeof(buffer);
+		result = MIFARE_BlockExchange(tag, 0xAF, buffer, &bufferSize);
+	}
+
+	return result;
+} // End MIFARE_DESFIRE_GetDFNames()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_CreateApplication(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid, byte settings, byte keyCount)
+{
+	return MIFARE_DESFIRE_Exchange<DesfireCreateApplicationCommand>(tag, NULL, NULL, aid->data, settings, keyCount);
+} // End MIFARE_DESFIRE_CreateApplication()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_DeleteApplication(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid)
+{
+	StatusCode result;
+
+	result = MIFARE_DESFIRE_Exchange<DesfireDeleteApplicationCommand>(tag, NULL, NULL, aid->data);
+	if (IsStatusCodeOK(result) && memcmp(tag->selected_application, aid->data, MIFARE_AID_SIZE) == 0) {
+		// Deleting the selected application leaves the PICC level selected
+		memset(tag->selected_application, 0, MIFARE_AID_SIZE);
+	}
+
+	return result;
+} // End MIFARE_DESFIRE_DeleteApplication()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_FormatPICC(mifare_desfire_tag *tag)
+{
+	return MIFARE_DESFIRE_Exchange<DesfireFormatPICCCommand>(tag, NULL, NULL);
+} // End MIFARE_DESFIRE_FormatPICC()
+
+/**
+ * Changes the key settings of the selected application.
+ *
+ * The new settings must be sent enciphered with the current session key, the caller supplies the
+ * cryptogram (8 bytes for DES/3DES, 16 bytes for AES). With AES it is enciphered in CBC from
+ * tag->iv, see MIFARE_BlockExchangeMACed().
+ */
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_ChangeKeySettings(mifare_desfire_tag *tag, byte *cryptogram, byte cryptogramLength)
+{
+	return MIFARE_BlockExchangeWithData(tag, 0x54, cryptogram, &cryptogramLength);
+} // End MIFARE_DESFIRE_ChangeKeySettings()
+
+/**
+ * Changes a key of the selected application.
+ *
+ * The new key must be sent enciphered with the current session key, the caller supplies the
+ * cryptogram (24 to 40 bytes depending on the key type). With AES it is enciphered in CBC from
+ * tag->iv, see MIFARE_BlockExchangeMACed().
+ */
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_ChangeKey(mifare_desfire_tag *tag, byte key, byte *cryptogram, byte cryptogramLength)
+{
+	StatusCode result;
+
+	byte buffer[41];
+	byte bufferSize = cryptogramLength + 1;
+
+	if (cryptogramLength > sizeof(buffer) - 1) {
+		result.mfrc522 = STATUS_INVALID;
+		return result;
+	}
+
+	buffer[0] = key;
+	memcpy(buffer + 1, cryptogram, cryptogramLength);
+
+	return MIFARE_BlockExchangeWithData(tag, 0xC4, buffer, &bufferSize);
+} // End MIFARE_DESFIRE_ChangeKey()
+
+// Reader side of an AES authentication, shared with the work run while frames are on air
+struct DESFire::AuthenticationState {
+	DESFire *reader;
+	const byte *keyData;
+	DesfireAES cipher;				// Keyed with keyData
+	DesfireAES *sessionCipher;
+	byte rndA[16];
+	byte rndB[16];
+	byte iv[16];					// Last block sent, the PICC chains its answer to it
+	byte expected[16];				// E(RndA rotated left by one byte) the PICC has to answer
+	byte sessionKey[16];
+};
+
+/**
+ * Work of the first frame: key schedule of keyData and RndA.
+ */
+void DESFire::MIFARE_DESFIRE_AuthenticatePrepare(void *context)
+{
+	AuthenticationState *state = (AuthenticationState *)context;
+
+	state->cipher.SetKey(state->keyData);
+	state->reader->PCD_DesfireRandom(state->rndA, 16);
+} // End MIFARE_DESFIRE_AuthenticatePrepare()
+
+/**
+ * Work of the second frame: the answer expected from the PICC and the session key with its
+ * schedule, everything needed once the answer is back but a compare.
+ */
+void DESFire::MIFARE_DESFIRE_AuthenticateExpect(void *context)
+{
+	AuthenticationState *state = (AuthenticationState *)context;
+
+	for (byte i = 0; i < 16; i++)
+		state->expected[i] = state->rndA[(i + 1) & 0x0F] ^ state->iv[i];
+	state->cipher.EncryptBlock(state->expected);
+
+	// RndA 0..3, RndB 0..3, RndA 12..15, RndB 12..15
+	memcpy(state->sessionKey, state->rndA, 4);
+	memcpy(state->sessionKey + 4, state->rndB, 4);
+	memcpy(state->sessionKey + 8, state->rndA + 12, 4);
+	memcpy(state->sessionKey + 12, state->rndB + 12, 4);
+	if (state->sessionCipher != NULL)
+		state->sessionCipher->SetKey(state->sessionKey);
+} // End MIFARE_DESFIRE_AuthenticateExpect()
+
+/**
+ * Authenticates with an AES key of the selected application (or the PICC master key) and
+ * starts a session: tag gets the session key, a zero IV and the key number.
+ *
+ *  Reader                                   PICC
+ *  AA key                           ->
+ *                                   <-      AF E(RndB)
+ *  AF E(RndA + RndB rotated)        ->
+ *                                   <-      00 E(RndA rotated)
+ *
+ * The CPU work is split around the frames so it runs while they are on air: the key schedule
+ * and RndA during the first frame, the expected answer and the session key schedule during
+ * the second. Only deciphering RndB and enciphering the reader's answer are left between
+ * frames, and a compare after the last one. sessionCipher, when given, is left keyed with the
+ * session key for the MAC and encipherment of the session; it is only valid on success.
+ *
+ * The commands that follow are MACed, their answers verified, see MIFARE_BlockExchangeMACed().
+ *
+ * @param keyData The 16 bytes of the AES key.
+ * @return MF_AUTHENTICATION_ERROR with STATUS_OK when the PICC does not prove it has the key.
+ */
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_AuthenticateAES(mifare_desfire_tag *tag, byte key, const byte *keyData, DesfireAES *sessionCipher)
+{
+	StatusCode result;
+	AuthenticationState state;
+
+	byte buffer[32];
+	byte bufferSize = sizeof(buffer);
+	byte sendSize = 1;
+
+	state.reader = this;
+	state.keyData = keyData;
+	state.sessionCipher = sessionCipher;
+
+	buffer[0] = key;
+	_overlap = MIFARE_DESFIRE_AuthenticatePrepare;
+	_overlapContext = &state;
+	_overlapBackLen = DESFIRE_AUTH_ANSWER_SIZE;
+	result = MIFARE_BlockExchangeWithData(tag, 0xAA, buffer, &sendSize, buffer, &bufferSize);
+	_overlap = NULL;
+	if (result.mfrc522 != STATUS_OK || (result.desfire != MF_ADDITIONAL_FRAME && result.desfire != MF_OPERATION_OK))
+		return result;
+	if (result.desfire != MF_ADDITIONAL_FRAME || bufferSize != 16) {
+		result.mfrc522 = STATUS_ERROR;
+		return result;
+	}
+
+	// RndB, the IV chains from E(RndB) on
+	memset(state.iv, 0, sizeof(state.iv));
+	memcpy(state.rndB, buffer, 16);
+	state.cipher.DecryptCBC(state.rndB, 16, state.iv);
+
+	memcpy(buffer, state.rndA, 16);
+	memcpy(buffer + 16, state.rndB + 1, 15);
+	buffer[31] = state.rndB[0];
+	state.cipher.EncryptCBC(buffer, 32, state.iv);
+
+	sendSize = 32;
+	bufferSize = sizeof(buffer);
+	_overlap = MIFARE_DESFIRE_AuthenticateExpect;
+	_overlapContext = &state;
+	_overlapBackLen = DESFIRE_AUTH_ANSWER_SIZE;
+	result = MIFARE_BlockExchangeWithData(tag, 0xAF, buffer, &sendSize, buffer, &bufferSize);
+	_overlap = NULL;
+	if (!IsStatusCodeOK(result))
+		return result;
+	if (bufferSize != 16) {
+		result.mfrc522 = STATUS_ERROR;
+		return result;
+	}
+
+	byte difference = 0;
+	for (byte i = 0; i < 16; i++)
+		difference |= buffer[i] ^ state.expected[i];
+	if (difference != 0) {
+		result.desfire = MF_AUTHENTICATION_ERROR;
+		return result;
+	}
+
+	memcpy(tag->session_key, state.sessionKey, 16);
+	tag->session_key_length = 16;
+	tag->authenticated_key = key;
+
+	return result;
+} // End MIFARE_DESFIRE_AuthenticateAES()
+
+/**
+ * Sends a ReadData style command (FileNo, Offset, Length) and collects the data of all its frames.
+ *
+ * @param backLen In: Max number of bytes in *backData. Out: The number of bytes read.
+ * @return STATUS_NO_ROOM when the PICC sends more data than fits, the bytes that fit are kept.
+ */
+template <typename Command>
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_ReadChained(mifare_desfire_tag *tag, byte fid, uint32_t offset, uint32_t length, byte *backData, size_t *backLen)
+{
+	StatusCode result;
+
+	byte buffer[DESFIRE_FSD - DESFIRE_FRAME_OVERHEAD];
+	byte bufferSize = DESFIRE_FSD - DESFIRE_FRAME_OVERHEAD;
+	size_t capacity = *backLen;
+	size_t outSize = 0;
+
+	result = MIFARE_DESFIRE_Exchange<Command>(tag, buffer, &bufferSize, fid, offset, length);
+	while (result.mfrc522 == STATUS_OK) {
+		// Copy the data, the last frame (MF_OPERATION_OK) carries data too
+		if (bufferSize > capacity - outSize) {
+			memcpy(backData + outSize, buffer, capacity - outSize);
+			outSize = capacity;
+			result.mfrc522 = STATUS_NO_ROOM;
+			break;
+		}
+		memcpy(backData + outSize, buffer, bufferSize);
+		outSize += bufferSize;
+
+		if (result.desfire != MF_ADDITIONAL_FRAME)
+			break;
+
+		bufferSize = DESFIRE_FSD - DESFIRE_FRAME_OVERHEAD;
+		result = MIFARE_BlockExchange(tag, 0xAF, buffer, &bufferSize);
+	}
+	*backLen = outSize;
+
+	return result;
+} // End MIFARE_DESFIRE_ReadChained()
+
+/**
+ * Reads length bytes of a data file from offset, length 0 reads up to the end of the file.
+ *
+ * @param backLen In: Max number of bytes in *backData. Out: The number of bytes read.
+ */
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_ReadData(mifare_desfire_tag *tag, byte fid, uint32_t offset, uint32_t length, byte *backData, size_t *backLen)
+{
+	// The deadline expects the bytes asked for, or as many as fit when reading to the end
+	PCD_DesfireExpectAnswer((length != 0 && length < *backLen) ? length : *backLen, DESFIRE_NATIVE_FRAME_DATA);
+	return MIFARE_DESFIRE_ReadChained<DesfireReadDataCommand>(tag, fid, offset, length, backData, backLen);
+} // End MIFARE_DESFIRE_ReadData()
+
+/**
+ * Reads count records of a linear or cyclic record file, ending offset records before the
+ * newest one. Records are returned oldest first, as the PICC stores them: offset 0 and count 2
+ * return the record before the newest, then the newest. Count 0 reads all records from the
+ * oldest one on.
+ *
+ * @param backLen In: Max number of bytes in *backData. Out: The number of bytes read.
+ */
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_ReadRecords(mifare_desfire_tag *tag, byte fid, uint32_t offset, uint32_t count, byte *backData, size_t *backLen)
+{
+	// The record size is unknown here, the deadline expects as many bytes as fit
+	PCD_DesfireExpectAnswer(*backLen, DESFIRE_NATIVE_FRAME_DATA);
+	return MIFARE_DESFIRE_ReadChained<DesfireReadRecordsCommand>(tag, fid, offset, count, backData, backLen);
+} // End MIFARE_DESFIRE_ReadRecords()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetValue(mifare_desfire_tag *tag, byte fid, int32_t *value)
+{
+	typedef DesfireGetValueCommand::response Response;
+	StatusCode result;
+
+	byte buffer[Response::size];
+	byte bufferSize = Response::size;
+
+	result = MIFARE_DESFIRE_Exchange<DesfireGetValueCommand>(tag, buffer, &bufferSize, fid);
+	if (IsStatusCodeOK(result)) {
+		*value = Response::get<0>(buffer);
+	}
+
+	return result;
+} // End MIFARE_DESFIRE_GetValue()
+
+DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetApplicationIds(mifare_desfire_tag *tag, mifare_desfire_aid_t *aids, byte *applicationCount)
+{
+	StatusCode result;
+	
+	// MIFARE_MAX_APPLICATION_COUNT * MIFARE_AID_SIZE + PCB (1 byte) + CID (1 byte) + Checksum (2 bytes)
 	// I also add an extra byte in case NAD is needed
 	byte bufferSize = (MIFARE_MAX_APPLICATION_COUNT * MIFARE_AID_SIZE) + 5;
 	byte buffer[bufferSize]; 
@@ -395,6 +1733,10 @@ DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetApplicationIds(mifare_desfire_tag
 		return result;
 	}
 
+	if (bufferSize > sizeof(aidBuffer)) {
+		result.mfrc522 = STATUS_NO_ROOM;
+		return result;
+	}
 	memcpy(aidBuffer, buffer, bufferSize);
 	aidBufferSize = bufferSize;
 
@@ -412,6 +1754,7 @@ DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetApplicationIds(mifare_desfire_tag
 
 		// Append the new data
 		memcpy(aidBuffer + aidBufferSize, buffer, bufferSize);
+		aidBufferSize += bufferSize;
 	}
 	
 
@@ -435,6 +1778,109 @@ DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetApplicationIds(mifare_desfire_tag
 	return result;
 } // End MIFARE_DESFIRE_GetApplicationIds()
 
+#ifndef DESFIRE_NO_NAMES
+/* --------------------------------------
+* Name Tables
+* --------------------------------------
+* The names of a table are packed back to back in a single PROGMEM string, the n-th entry of
+* the codes table is named by the n-th string and the string after the last one names all
+* other codes. This costs one byte per name on top of the text, instead of a compare and a
+* return per case.
+*/
+static const byte desfireStatusCodes[] PROGMEM = {
+	DESFire::MF_OPERATION_OK, DESFire::MF_NO_CHANGES, DESFire::MF_OUT_OF_EEPROM_ERROR, DESFire::MF_ILLEGAL_COMMAND_CODE,
+	DESFire::MF_INTEGRITY_ERROR, DESFire::MF_NO_SUCH_KEY, DESFire::MF_LENGTH_ERROR, DESFire::MF_PERMISSION_ERROR,
+	DESFire::MF_PARAMETER_ERROR, DESFire::MF_APPLICATION_NOT_FOUND, DESFire::MF_APPL_INTEGRITY_ERROR, DESFire::MF_AUTHENTICATION_ERROR,
+	DESFire::MF_ADDITIONAL_FRAME, DESFire::MF_BOUNDARY_ERROR, DESFire::MF_PICC_INTEGRITY_ERROR, DESFire::MF_COMMAND_ABORTED,
+	DESFire::MF_PICC_DISABLED_ERROR, DESFire::MF_COUNT_ERROR, DESFire::MF_DUPLICATE_ERROR, DESFire::MF_EEPROM_ERROR,
+	DESFire::MF_FILE_NOT_FOUND, DESFire::MF_FILE_INTEGRITY_ERROR
+};
+static const char desfireStatusNames[] PROGMEM =
+	"Successful operation.\0"
+	"No changes done to backup files.\0"
+	"Insufficient NV-Mem. to complete cmd.\0"
+	"Command code not supported.\0"
+	"CRC or MAC does not match data.\0"
+	"Invalid key number specified.\0"
+	"Length of command string invalid.\0"
+	"Curr conf/status doesnt allow cmd.\0"
+	"Value of the parameter(s) invalid.\0"
+	"Requested AID not present on PICC.\0"
+	"Unrecoverable err within app.\0"
+	"Current authentication status doesn't allow requested command.\0"
+	"Additional data frame to be sent.\0"
+	"Attempt to read/write beyond limits.\0"
+	"Unrecoverable error within PICC.\0"
+	"Previous command not fully completed.\0"
+	"PICC disabled by unrecoverable error.\0"
+	"Cant create more apps, already @ 28.\0"
+	"Cant create dup. file/app.\0"
+	"Couldnt complete NV-write operation.\0"
+	"Specified file number doesnt exist.\0"
+	"Unrecoverable error within file.\0"
+	"Unknown error";
+
+static const byte desfireFileTypes[] PROGMEM = {
+	DESFire::MDFT_STANDARD_DATA_FILE, DESFire::MDFT_BACKUP_DATA_FILE, DESFire::MDFT_VALUE_FILE_WITH_BACKUP,
+	DESFire::MDFT_LINEAR_RECORD_FILE_WITH_BACKUP, DESFire::MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP
+};
+static const char desfireFileTypeNames[] PROGMEM =
+	"Standard data file.\0"
+	"Backup data file.\0"
+	"Value file with backup.\0"
+	"Linear record file with backup.\0"
+	"Cyclic record file with backup.\0"
+	"Unknown file type.";
+
+static const byte desfireCommunicationModes[] PROGMEM = {
+	DESFire::MDCM_PLAIN, DESFire::MDCM_MACED, DESFire::MDCM_ENCIPHERED
+};
+static const char desfireCommunicationModeNames[] PROGMEM =
+	"Plain Communication.\0"
+	"Plain Comm secured by DES/3DES MACing.\0"
+	"Fully DES/3DES enciphered comm.\0"
+	"Unknown communication mode.";
+
+// Hardware major version
+static const byte desfireCardTypes[] PROGMEM = { 0x00, 0x01, 0x12, 0x33 };
+static const char desfireCardTypeNames[] PROGMEM =
+	"MIFARE DESFire (MF3ICD40)\0"
+	"MIFARE DESFire EV1\0"
+	"MIFARE DESFire EV2\0"
+	"MIFARE DESFire EV3\0"
+	"Unknown";
+
+/**
+ * Looks a code up in a packed name table.
+ *
+ * @return The name of code, or the name following the last one if code is not in codes.
+ */
+const __FlashStringHelper *DESFire::GetPackedName(const byte *codes, byte codeCount, const char *names, byte code)
+{
+	const char *name = names;
+
+	for (byte i = 0; i < codeCount && pgm_read_byte(codes + i) != code; i++)
+		name += strlen_P(name) + 1;
+
+	return reinterpret_cast<const __FlashStringHelper *>(name);
+} // End GetPackedName()
+#endif
+
+/**
+ * Returns a __FlashStringHelper pointer to a DESFire status code name, empty when compiled
+ * with DESFIRE_NO_NAMES.
+ *
+ * @return const __FlashStringHelper *
+ */
+const __FlashStringHelper *DESFire::GetDesfireStatusCodeName(DesfireStatusCode code)
+{
+#ifdef DESFIRE_NO_NAMES
+	return F("");
+#else
+	return GetPackedName(desfireStatusCodes, sizeof(desfireStatusCodes), desfireStatusNames, code);
+#endif
+} // End GetDesfireStatusCodeName()
+
 /**
  * Returns a __FlashStringHelper pointer to a status code name.
  *
@@ -442,59 +1888,44 @@ DESFire::StatusCode DESFire::MIFARE_DESFIRE_GetApplicationIds(mifare_desfire_tag
  */
 const __FlashStringHelper *DESFire::GetStatusCodeName(StatusCode code)
 {
+#ifndef DESFIRE_NO_NAMES
 	if (code.mfrc522 != MFRC522::STATUS_OK) {
 		return MFRC522::GetStatusCodeName(code.mfrc522);
 	}
+#endif
 
-	switch (code.desfire) {
-		case MF_OPERATION_OK:			return F("Successful operation.");
-		case MF_NO_CHANGES:				return F("No changes done to backup files.");
-		case MF_OUT_OF_EEPROM_ERROR:	return F("Insufficient NV-Mem. to complete cmd.");
-		case MF_ILLEGAL_COMMAND_CODE:	return F("Command code not supported.");
-		case MF_INTEGRITY_ERROR:		return F("CRC or MAC does not match data.");
-		case MF_NO_SUCH_KEY:			return F("Invalid key number specified.");
-		case MF_LENGTH_ERROR:			return F("Length of command string invalid.");
-		case MF_PERMISSION_ERROR:		return F("Curr conf/status doesnt allow cmd.");
-		case MF_PARAMETER_ERROR:		return F("Value of the parameter(s) invalid.");
-		case MF_APPLICATION_NOT_FOUND:	return F("Requested AID not present on PICC.");
-		case MF_APPL_INTEGRITY_ERROR:	return F("Unrecoverable err within app.");
-		case MF_AUTHENTICATION_ERROR:	return F("Current authentication status doesn't allow requested command.");
-		case MF_ADDITIONAL_FRAME:		return F("Additional data frame to be sent.");
-		case MF_BOUNDARY_ERROR:			return F("Attempt to read/write beyond limits.");
-		case MF_PICC_INTEGRITY_ERROR:	return F("Unrecoverable error within PICC.");
-		case MF_COMMAND_ABORTED:		return F("Previous command not fully completed.");
-		case MF_PICC_DISABLED_ERROR:	return F("PICC disabled by unrecoverable error.");
-		case MF_COUNT_ERROR:			return F("Cant create more apps, already @ 28.");
-		case MF_DUPLICATE_ERROR:		return F("Cant create dup. file/app.");
-		case MF_EEPROM_ERROR:			return F("Couldnt complete NV-write operation.");
-		case MF_FILE_NOT_FOUND:			return F("Specified file number doesnt exist.");
-		case MF_FILE_INTEGRITY_ERROR:	return F("Unrecoverable error within file.");
-		default:						return F("Unknown error");
-	}
+	return GetDesfireStatusCodeName(code.desfire);
 } // End GetStatusCodeName()
 
 const __FlashStringHelper *DESFire::GetFileTypeName(mifare_desfire_file_types fileType)
 {
-	switch (fileType) {
-		case MDFT_STANDARD_DATA_FILE:				return F("Standard data file.");
-		case MDFT_BACKUP_DATA_FILE:					return F("Backup data file.");
-		case MDFT_VALUE_FILE_WITH_BACKUP:			return F("Value file with backup.");
-		case MDFT_LINEAR_RECORD_FILE_WITH_BACKUP:	return F("Linear record file with backup.");
-		case MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP:	return F("Cyclic record file with backup.");
-		default:									return F("Unknown file type.");
-	}
+#ifdef DESFIRE_NO_NAMES
+	return F("");
+#else
+	return GetPackedName(desfireFileTypes, sizeof(desfireFileTypes), desfireFileTypeNames, fileType);
+#endif
 } // End GetFileTypeName()
 
 const __FlashStringHelper *DESFire::GetCommunicationModeName(mifare_desfire_communication_modes communicationMode)
 {
-	switch (communicationMode) {
-		case MDCM_PLAIN:		return(F("Plain Communication."));
-		case MDCM_MACED:        return(F("Plain Comm secured by DES/3DES MACing."));
-		case MDCM_ENCIPHERED:   return(F("Fully DES/3DES enciphered comm."));
-		default:				return F("Unknown communication mode.");
-	}
+#ifdef DESFIRE_NO_NAMES
+	return F("");
+#else
+	return GetPackedName(desfireCommunicationModes, sizeof(desfireCommunicationModes), desfireCommunicationModeNames, communicationMode);
+#endif
 } // End GetCommunicationModeName()
 
+/**
+ * Returns the personalization throughput of a compiled layout in cards per minute.
+ */
+uint32_t DESFire::GetCardsPerMinute(mifare_desfire_compiled_layout_t *layout)
+{
+	if (layout->elapsed == 0)
+		return 0;
+
+	return (uint32_t)((uint64_t)layout->cards * 60000000ULL / layout->elapsed);
+} // End GetCardsPerMinute()
+
 bool DESFire::IsStatusCodeOK(StatusCode code)
 {
 	if (code.mfrc522 != STATUS_OK)
@@ -505,23 +1936,128 @@ bool DESFire::IsStatusCodeOK(StatusCode code)
 	return true;
 } // End IsStatusCodeOK();
 
+/* --------------------------------------
+* Dump Formatting
+* --------------------------------------
+* Shared by the dump functions, values are printed in one column after the field labels.
+*/
+#define DESFIRE_DUMP_VALUE_COLUMN 21	/* column of the ':' after a label */
+#define DESFIRE_DUMP_WIDTH        60	/* column where the rules end */
+
+void DESFire::DumpHex(byte value)
+{
+	if (value < 0x10)
+		Serial.print('0');
+	Serial.print(value, HEX);
+} // End DumpHex()
+
+void DESFire::DumpSpaces(byte count)
+{
+	while (count-- > 0)
+		Serial.print(' ');
+} // End DumpSpaces()
+
+/**
+ * Prints " XX" for each byte of data.
+ */
+void DESFire::DumpBytes(const byte *data, size_t length)
+{
+	for (size_t i = 0; i < length; i++) {
+		Serial.print(' ');
+		DumpHex(data[i]);
+	}
+} // End DumpBytes()
+
+/**
+ * Prints a "-- title ---" header followed by a rule.
+ */
+void DESFire::DumpTitle(const __FlashStringHelper *title)
+{
+	Serial.print(F("-- "));
+	Serial.print(title);
+	Serial.print(' ');
+	for (byte column = 4 + strlen_P((const char *)title); column <= DESFIRE_DUMP_WIDTH; column++)
+		Serial.print('-');
+	Serial.println();
+	DumpRule(0);
+} // End DumpTitle()
+
+void DESFire::DumpRule(byte indent)
+{
+	DumpSpaces(indent);
+	for (byte column = indent; column < DESFIRE_DUMP_WIDTH + (indent == 0); column++)
+		Serial.print('-');
+	Serial.println();
+} // End DumpRule()
+
+/**
+ * Prints the label of a field, indented and padded up to the value column, and the ':'.
+ */
+void DESFire::DumpLabel(byte indent, const __FlashStringHelper *label)
+{
+	byte length = indent + strlen_P((const char *)label);
+
+	DumpSpaces(indent);
+	Serial.print(label);
+	DumpSpaces((length < DESFIRE_DUMP_VALUE_COLUMN) ? DESFIRE_DUMP_VALUE_COLUMN - length : 0);
+	Serial.print(':');
+} // End DumpLabel()
+
+/**
+ * Prints a "label : 0xXX (name)" line, the name is left out when NULL or empty.
+ */
+void DESFire::DumpHexField(byte indent, const __FlashStringHelper *label, byte value, const __FlashStringHelper *name)
+{
+	DumpLabel(indent, label);
+	Serial.print(F(" 0x"));
+	DumpHex(value);
+	if (name != NULL && pgm_read_byte((const char *)name) != 0) {
+		Serial.print(F(" ("));
+		Serial.print(name);
+		Serial.print(')');
+	}
+	Serial.println();
+} // End DumpHexField()
+
+/**
+ * Prints the "Key 0xKK :" label of a key version line.
+ */
+void DESFire::DumpKeyLabel(byte key)
+{
+	Serial.print(F("      Key 0x"));
+	DumpHex(key);
+	DumpSpaces(DESFIRE_DUMP_VALUE_COLUMN - 14);
+	Serial.print(':');
+} // End DumpKeyLabel()
+
+/**
+ * Prints the name of a status code, or its codes when compiled with DESFIRE_NO_NAMES.
+ */
+void DESFire::DumpStatus(StatusCode code)
+{
+#ifdef DESFIRE_NO_NAMES
+	Serial.print(F("Status 0x"));
+	DumpHex(code.mfrc522);
+	Serial.print(F("/0x"));
+	DumpHex(code.desfire);
+	Serial.println();
+#else
+	Serial.println(GetStatusCodeName(code));
+#endif
+} // End DumpStatus()
+
 void DESFire::PICC_DumpMifareDesfireMasterKey(mifare_desfire_tag *tag)
 {
 	StatusCode response;
-	mifare_desfire_aid_t aid;
+	mifare_desfire_aid_t aid = { { 0x00, 0x00, 0x00 } };
 
-	aid.data[0] = 0x00;
-	aid.data[1] = 0x00;
-	aid.data[2] = 0x00;
-
-	Serial.println(F("-- Desfire Master Key ---------------------------------------"));
-	Serial.println(F("-------------------------------------------------------------"));
+	DumpTitle(F("Desfire Master Key"));
 	// Select the current application.
 	response = MIFARE_DESFIRE_SelectApplication(tag, &aid);
 	if (!IsStatusCodeOK(response)) {
 		Serial.println(F("Error: Failed to select application."));
-		Serial.println(GetStatusCodeName(response));
-		Serial.println(F("-------------------------------------------------------------"));
+		DumpStatus(response);
+		DumpRule(0);
 		return;
 	}
 
@@ -532,276 +2068,164 @@ void DESFire::PICC_DumpMifareDesfireMasterKey(mifare_desfire_tag *tag)
 
 	response = MIFARE_DESFIRE_GetKeySettings(tag, &keySettings, &keyCount);
 	if (IsStatusCodeOK(response)) {
-		Serial.print(F("  Key settings       : 0x"));
-		if (keySettings < 0x10)
-			Serial.print(F("0"));
-		Serial.println(keySettings, HEX);
-
-		Serial.print(F("  Max num keys       : "));
+		// The lower nibble holds the number of keys, the upper one their type
+		keyCount &= 0x0F;
+		DumpHexField(2, F("Key settings"), keySettings);
+		DumpLabel(2, F("Max num keys"));
+		Serial.print(' ');
 		Serial.println(keyCount);
 
 		// Output key versions
-		if (keyCount > 0) {
-			Serial.println(F("  ----------------------------------------------------------"));
-			Serial.println(F("  Key Versions"));
-
-			// Get key versions (No output will be outputed later)
-			for (byte ixKey = 0; ixKey < keyCount; ixKey++) {
-				response = MIFARE_DESFIRE_GetKeyVersion(tag, ixKey, &keyVersion);
-				Serial.print(F("      Key 0x"));
-				if (ixKey < 0x10)
-					Serial.print(F("0"));
-				Serial.print(ixKey, HEX);
-				Serial.print(F("       : "));
-				
-				if (IsStatusCodeOK(response)) {
-					Serial.print(F("0x"));
-					if (keyVersion < 0x10)
-						Serial.print(F("0"));
-					Serial.println(keyVersion, HEX);
-				} else {
-					Serial.println(GetStatusCodeName(response));
-				}
-			}
-		}
-	}
-	else {
-		Serial.println(F("  Error: Failed to get application key settings."));
-		// Just to be sure..
-		keyCount = 0;
-	}
-
-	Serial.println(F("-------------------------------------------------------------"));
-} // End PICC_DumpMifareDesfireMasterKey()
-
-void DESFire::PICC_DumpMifareDesfireVersion(mifare_desfire_tag *tag, MIFARE_DESFIRE_Version_t *versionInfo)
-{
-	Serial.println(F("-- Desfire Information --------------------------------------"));
-	Serial.println(F("-------------------------------------------------------------"));
-	switch (versionInfo->hardware.version_major) {
-	case 0x00:
-		Serial.println(F("  Card type          : MIFARE DESFire (MF3ICD40)"));
-		switch (versionInfo->hardware.storage_size) {
-		case 0x16:
-			Serial.print(F(" 2K"));
-			break;
-		case 0x18:
-			Serial.print(F(" 4K"));
-			break;
-		case 0x1A:
-			Serial.print(F(" 8K"));
-			break;
-		}
-		Serial.println();
-		break;
-	case 0x01:
-		Serial.print(F("  Card type          : MIFARE DESFire EV1"));
-		switch (versionInfo->hardware.storage_size) {
-		case 0x16:
-			Serial.print(F(" 2K"));
-			break;
-		case 0x18:
-			Serial.print(F(" 4K"));
-			break;
-		case 0x1A:
-			Serial.print(F(" 8K"));
-			break;
+		if (keyCount > 0 && !PCD_HasBudget(DesfireGetKeyVersionCommand::opcode, keyCount)) {
+			DumpRule(2);
+			Serial.println(F("  Key Versions skipped (deadline)"));
 		}
-		Serial.println();
-		break;
-	case 0x12:
-		Serial.print(F("  Card type          : MIFARE DESFire EV2"));
-		switch (versionInfo->hardware.storage_size) {
-		case 0x16:
-			Serial.print(F(" 2K"));
-			break;
-		case 0x18:
-			Serial.print(F(" 4K"));
-			break;
-		case 0x1A:
-			Serial.print(F(" 8K"));
-			break;
+		else if (keyCount > 0) {
+			DumpRule(2);
+			Serial.println(F("  Key Versions"));
+
+			for (byte ixKey = 0; ixKey < keyCount; ixKey++) {
+				response = MIFARE_DESFIRE_GetKeyVersion(tag, ixKey, &keyVersion);
+				DumpKeyLabel(ixKey);
+				if (IsStatusCodeOK(response)) {
+					Serial.print(F(" 0x"));
+					DumpHex(keyVersion);
+					Serial.println();
+				} else {
+					Serial.print(' ');
+					DumpStatus(response);
+				}
+			}
 		}
-		Serial.println();
-		break;
 	}
-
-	// UID
-	Serial.print(F("  UID                :"));
-	for (byte i = 0; i < 7; i++) {
-		if (versionInfo->uid[i] < 0x10)
-			Serial.print(F(" 0"));
-		else
-			Serial.print(F(" "));
-		Serial.print(versionInfo->uid[i], HEX);
+	else {
+		Serial.println(F("  Error: Failed to get application key settings."));
 	}
+
+	DumpRule(0);
+} // End PICC_DumpMifareDesfireMasterKey()
+
+/**
+ * Prints the hardware or software part of the version, part points to its vendor_id.
+ */
+void DESFire::PICC_DumpMifareDesfireVersionPart(const __FlashStringHelper *title, const uint8_t *part)
+{
+	// vendor_id, type, subtype, version_major, version_minor, storage_size, protocol
+	DumpRule(2);
+	Serial.print(F("  "));
+	Serial.println(title);
+
+	DumpLabel(6, F("Vendor ID"));
+	Serial.print(F(" 0x"));
+	DumpHex(part[0]);
+	if (part[0] == 0x04)
+		Serial.print(F(" (NXP)"));
 	Serial.println();
 
-	// Batch
-	Serial.print(F("  Batch number       :"));
-	for (byte i = 0; i < 5; i++) {
-		if (versionInfo->batch_number[i] < 0x10)
-			Serial.print(F(" 0"));
-		else
-			Serial.print(F(" "));
-		Serial.print(versionInfo->batch_number[i], HEX);
+	DumpHexField(6, F("Type"), part[1]);
+	DumpHexField(6, F("Subtype"), part[2]);
+
+	DumpLabel(6, F("Version"));
+	Serial.print(' ');
+	Serial.print(part[3]);
+	Serial.print('.');
+	Serial.println(part[4]);
+
+	// Storage size 2^n bytes is coded as n << 1, bit 0 set means between 2^n and 2^(n+1)
+	DumpLabel(6, F("Storage size"));
+	Serial.print(F(" 0x"));
+	DumpHex(part[5]);
+	if ((part[5] & 0x01) == 0x00 && part[5] <= 0x3E) {
+		Serial.print(F(" ("));
+		Serial.print(1UL << (part[5] >> 1));
+		Serial.print(F(" bytes)"));
 	}
 	Serial.println();
 
-	Serial.print(F("  Production week    : 0x"));
-	if (versionInfo->production_week < 0x10)
-		Serial.print(F("0"));
-	Serial.println(versionInfo->production_week, HEX);
-
-	Serial.print(F("  Production year    : 0x"));
-	if (versionInfo->production_year < 0x10)
-		Serial.print(F("0"));
-	Serial.println(versionInfo->production_year, HEX);
-
-	Serial.println(F("  ----------------------------------------------------------"));
-	Serial.println(F("  Hardware Information"));
-	Serial.print(F("      Vendor ID      : 0x"));
-	if (versionInfo->hardware.vendor_id < 0x10)
-		Serial.print(F("0"));
-	Serial.print(versionInfo->hardware.vendor_id, HEX);
-	if (versionInfo->hardware.vendor_id == 0x04)
-		Serial.print(F(" (NXP)"));
-	Serial.println();
+	DumpHexField(6, F("Protocol"), part[6]);
+} // End PICC_DumpMifareDesfireVersionPart()
 
-	Serial.print(F("      Type           : 0x"));
-	if (versionInfo->hardware.type < 0x10)
-		Serial.print(F("0"));
-	Serial.println(versionInfo->hardware.type, HEX);
-
-	Serial.print(F("      Subtype        : 0x"));
-	if (versionInfo->hardware.subtype < 0x10)
-		Serial.print(F("0"));
-	Serial.println(versionInfo->hardware.subtype, HEX);
-
-	Serial.print(F("      Version        : "));
-	Serial.print(versionInfo->hardware.version_major);
-	Serial.print(F("."));
-	Serial.println(versionInfo->hardware.version_minor);
-
-	Serial.print(F("      Storage size   : 0x"));
-	if (versionInfo->hardware.storage_size < 0x10)
-		Serial.print(F("0"));
-	Serial.print(versionInfo->hardware.storage_size, HEX);
-	switch (versionInfo->hardware.storage_size) {
-	case 0x16:
-		Serial.print(F(" (2048 bytes)"));
-		break;
-	case 0x18:
-		Serial.print(F(" (4096 bytes)"));
-		break;
-	case 0x1A:
-		Serial.print(F(" (8192 bytes)"));
-		break;
+void DESFire::PICC_DumpMifareDesfireVersion(mifare_desfire_tag *tag, MIFARE_DESFIRE_Version_t *versionInfo)
+{
+	DumpTitle(F("Desfire Information"));
+
+	DumpLabel(2, F("Card type"));
+	Serial.print(' ');
+#ifdef DESFIRE_NO_NAMES
+	Serial.print(F("0x"));
+	DumpHex(versionInfo->hardware.version_major);
+#else
+	Serial.print(GetPackedName(desfireCardTypes, sizeof(desfireCardTypes), desfireCardTypeNames, versionInfo->hardware.version_major));
+#endif
+	// 2K, 4K and 8K cards
+	if ((versionInfo->hardware.storage_size & 0x01) == 0x00 && versionInfo->hardware.storage_size >= 0x14 && versionInfo->hardware.storage_size <= 0x1E) {
+		Serial.print(' ');
+		Serial.print(1 << ((versionInfo->hardware.storage_size >> 1) - 10));
+		Serial.print('K');
 	}
 	Serial.println();
 
-	Serial.print(F("      Protocol       : 0x"));
-	if (versionInfo->hardware.protocol < 0x10)
-		Serial.print(F("0"));
-	Serial.println(versionInfo->hardware.protocol, HEX);
-
-	Serial.println(F("  ----------------------------------------------------------"));
-	Serial.println(F("  Software Information"));
-	Serial.print(F("      Vendor ID      : 0x"));
-	if (versionInfo->software.vendor_id < 0x10)
-		Serial.print(F("0"));
-	Serial.print(versionInfo->software.vendor_id, HEX);
-	if (versionInfo->software.vendor_id == 0x04)
-		Serial.print(F(" (NXP)"));
+	DumpLabel(2, F("UID"));
+	DumpBytes(versionInfo->uid, 7);
 	Serial.println();
 
-	Serial.print(F("      Type           : 0x"));
-	if (versionInfo->software.type < 0x10)
-		Serial.print(F("0"));
-	Serial.println(versionInfo->software.type, HEX);
-
-	Serial.print(F("      Subtype        : 0x"));
-	if (versionInfo->software.subtype < 0x10)
-		Serial.print(F("0"));
-	Serial.println(versionInfo->software.subtype, HEX);
-
-	Serial.print(F("      Version        : "));
-	Serial.print(versionInfo->software.version_major);
-	Serial.print(F("."));
-	Serial.println(versionInfo->software.version_minor);
-
-	Serial.print(F("      Storage size   : 0x"));
-	if (versionInfo->software.storage_size < 0x10)
-		Serial.print(F("0"));
-	Serial.print(versionInfo->software.storage_size, HEX);
-	switch (versionInfo->software.storage_size) {
-	case 0x16:
-		Serial.print(F(" (2048 bytes)"));
-		break;
-	case 0x18:
-		Serial.print(F(" (4096 bytes)"));
-		break;
-	case 0x1A:
-		Serial.print(F(" (8192 bytes)"));
-		break;
-	}
+	DumpLabel(2, F("Batch number"));
+	DumpBytes(versionInfo->batch_number, 5);
 	Serial.println();
 
-	Serial.print(F("      Protocol       : 0x"));
-	if (versionInfo->software.protocol < 0x10)
-		Serial.print(F("0"));
-	Serial.println(versionInfo->software.protocol, HEX);
+	DumpHexField(2, F("Production week"), versionInfo->production_week);
+	DumpHexField(2, F("Production year"), versionInfo->production_year);
 
-	Serial.println(F("-------------------------------------------------------------"));
-}
+	PICC_DumpMifareDesfireVersionPart(F("Hardware Information"), &(versionInfo->hardware.vendor_id));
+	PICC_DumpMifareDesfireVersionPart(F("Software Information"), &(versionInfo->software.vendor_id));
+
+	DumpRule(0);
+} // End PICC_DumpMifareDesfireVersion()
 
 void DESFire::PICC_DumpMifareDesfireApplication(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid)
 {
 	StatusCode response;
 
-	Serial.println(F("-- Desfire Application --------------------------------------"));
-	Serial.println(F("-------------------------------------------------------------"));
-	Serial.print(F("  AID                :"));
-	for (byte i = 0; i < 3; i++) {
-		if (aid->data[i] < 0x10)
-			Serial.print(F(" 0"));
-		else
-			Serial.print(F(" "));
-		Serial.print(aid->data[i], HEX);
-	}
+	DumpTitle(F("Desfire Application"));
+	DumpLabel(2, F("AID"));
+	DumpBytes(aid->data, MIFARE_AID_SIZE);
 	Serial.println();
 
 	// Select the current application.
 	response = MIFARE_DESFIRE_SelectApplication(tag, aid);
 	if (!IsStatusCodeOK(response)) {
 		Serial.println(F("Error: Failed to select application."));
-		Serial.println(GetStatusCodeName(response));
-		Serial.println(F("-------------------------------------------------------------"));
+		DumpStatus(response);
+		DumpRule(0);
 		return;
 	}
 
 	// Get Key settings
 	byte keySettings;
 	byte keyCount = 0;
-	byte keyVersion[16];
+	byte keyVersion[14];
 
 	response = MIFARE_DESFIRE_GetKeySettings(tag, &keySettings, &keyCount);
 	if (IsStatusCodeOK(response)) {
-		Serial.print(F("  Key settings       : 0x"));
-		if (keySettings < 0x10)
-			Serial.print(F("0"));
-		Serial.println(keySettings, HEX);
-
-		Serial.print(F("  Max num keys       : "));
+		// The lower nibble holds the number of keys (up to 14), the upper one their type
+		keyCount &= 0x0F;
+		DumpHexField(2, F("Key settings"), keySettings);
+		DumpLabel(2, F("Max num keys"));
+		Serial.print(' ');
 		Serial.println(keyCount);
 
 		// Get key versions (No output will be outputed later)
+		if (keyCount > sizeof(keyVersion))
+			keyCount = sizeof(keyVersion);
+		if (!PCD_HasBudget(DesfireGetKeyVersionCommand::opcode, keyCount)) {
+			Serial.println(F("  Key Versions skipped (deadline)"));
+			keyCount = 0;
+		}
 		for (byte ixKey = 0; ixKey < keyCount; ixKey++) {
 			response = MIFARE_DESFIRE_GetKeyVersion(tag, ixKey, &(keyVersion[ixKey]));
 			if (!IsStatusCodeOK(response))
 				keyVersion[ixKey] = 0x00;
 		}
-		
 	} else {
 		Serial.println(F("  Error: Failed to get application key settings."));
 		// Just to be sure..
@@ -815,157 +2239,731 @@ void DESFire::PICC_DumpMifareDesfireApplication(mifare_desfire_tag *tag, mifare_
 	if (!IsStatusCodeOK(response)) {
 		Serial.println(F("  Error: Failed to get application file IDs."));
 		Serial.print(F("  "));
-		Serial.println(GetStatusCodeName(response));
-		Serial.println(F("-------------------------------------------------------------"));
+		DumpStatus(response);
+		DumpRule(0);
 		return;
 	}
 
 	// Number of files
-	Serial.print(F("  Num. Files         : "));
+	DumpLabel(2, F("Num. Files"));
+	Serial.print(' ');
 	Serial.println(filesCount);
 
 	// Output key versions
 	if (keyCount > 0) {
-		Serial.println(F("  ----------------------------------------------------------"));
+		DumpRule(2);
 		Serial.println(F("  Key Versions"));
 		for (byte ixKey = 0; ixKey < keyCount; ixKey++) {
-			Serial.print(F("      Key 0x"));
-			if (ixKey < 0x10)
-				Serial.print(F("0"));
-			Serial.print(ixKey, HEX);
-			Serial.print(F("       : 0x"));
-			if (keyVersion[ixKey] < 0x10)
-				Serial.print(F("0"));
-			Serial.println(keyVersion[ixKey], HEX);
+			DumpKeyLabel(ixKey);
+			Serial.print(F(" 0x"));
+			DumpHex(keyVersion[ixKey]);
+			Serial.println();
 		}
 	}
-	
+
 	for (byte i = 0; i < filesCount; i++) {
-		Serial.println(F("  ----------------------------------------------------------"));
+		DumpRule(2);
 		Serial.println(F("  File Information"));
-		Serial.print(F("      File ID        : 0x"));
-		if (files[i] < 0x10)
-			Serial.print(F("0"));
-		Serial.println(files[i], HEX);
+		DumpHexField(6, F("File ID"), files[i]);
 
 		// Get file settings
 		mifare_desfire_file_settings_t fileSettings;
 
 		response = MIFARE_DESFIRE_GetFileSettings(tag, &(files[i]), &fileSettings);
-		if (IsStatusCodeOK(response)) {
-			Serial.print(F("      File Type      : 0x"));
-			if (fileSettings.file_type < 0x10)
-				Serial.print(F("0"));
-			Serial.print(fileSettings.file_type, HEX);
-			Serial.print(F(" ("));
-			Serial.print(GetFileTypeName((mifare_desfire_file_types)fileSettings.file_type));
-			Serial.println(F(")"));
-
-			Serial.print(F("      Communication  : 0x"));
-			if (fileSettings.communication_settings < 0x10)
-				Serial.print(F("0"));
-			Serial.print(fileSettings.communication_settings, HEX);
-			Serial.print(F(" ("));
-			Serial.print(GetCommunicationModeName((mifare_desfire_communication_modes)fileSettings.communication_settings));
-			Serial.println(F(")"));
-
-			Serial.print(F("      Access rights  : 0x"));
-			Serial.println(fileSettings.access_rights, HEX);
-
-			switch (fileSettings.file_type) {
+		if (!IsStatusCodeOK(response)) {
+			Serial.println(F("      Error: Failed to get file settings."));
+			Serial.print(F("      "));
+			DumpStatus(response);
+			continue;
+		}
+
+		DumpHexField(6, F("File Type"), fileSettings.file_type, GetFileTypeName((mifare_desfire_file_types)fileSettings.file_type));
+		DumpHexField(6, F("Communication"), fileSettings.communication_settings, GetCommunicationModeName((mifare_desfire_communication_modes)fileSettings.communication_settings));
+
+		DumpLabel(6, F("Access rights"));
+		Serial.print(F(" 0x"));
+		DumpHex(fileSettings.access_rights >> 8);
+		DumpHex(fileSettings.access_rights & 0xFF);
+		Serial.println();
+
+		switch (fileSettings.file_type) {
+			case MDFT_STANDARD_DATA_FILE:
+			case MDFT_BACKUP_DATA_FILE:
+				DumpLabel(6, F("File Size"));
+				Serial.print(' ');
+				Serial.print(fileSettings.settings.standard_file.file_size);
+				Serial.println(F(" bytes"));
+				break;
+			case MDFT_VALUE_FILE_WITH_BACKUP:
+				DumpLabel(6, F("Lower Limit"));
+				Serial.print(' ');
+				Serial.println(fileSettings.settings.value_file.lower_limit);
+				DumpLabel(6, F("Upper Limit"));
+				Serial.print(' ');
+				Serial.println(fileSettings.settings.value_file.upper_limit);
+				DumpLabel(6, F("Limited credit"));
+				Serial.print(' ');
+				Serial.println(fileSettings.settings.value_file.limited_credit_value);
+				DumpHexField(6, F("Limited credit"), fileSettings.settings.value_file.limited_credit_enabled,
+				             (fileSettings.settings.value_file.limited_credit_enabled == 0x00) ? F("Disabled") : F("Enabled"));
+				break;
+			case MDFT_LINEAR_RECORD_FILE_WITH_BACKUP:
+			case MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP:
+				DumpLabel(6, F("Record size"));
+				Serial.print(' ');
+				Serial.println(fileSettings.settings.record_file.record_size);
+				DumpLabel(6, F("max num records"));
+				Serial.print(' ');
+				Serial.println(fileSettings.settings.record_file.max_number_of_records);
+				DumpLabel(6, F("num records"));
+				Serial.print(' ');
+				Serial.println(fileSettings.settings.record_file.current_number_of_records);
+				break;
+		}
+
+		switch (fileSettings.file_type) {
+			case MDFT_STANDARD_DATA_FILE:
+			case MDFT_BACKUP_DATA_FILE:
+			{
+				if (!PCD_HasBudget(DesfireReadDataCommand::opcode)) {
+					DumpRule(6);
+					Serial.println(F("      Data skipped (deadline)"));
+					break;
+				}
+
+				// Get file data
+				byte fileContent[fileSettings.settings.standard_file.file_size];
+				size_t fileContentLength = sizeof(fileContent);
+				response = MIFARE_DESFIRE_ReadData(tag, files[i], 0, fileSettings.settings.standard_file.file_size, fileContent, &fileContentLength);
+				if (response.mfrc522 == STATUS_OK) {
+					DumpRule(6);
+					Serial.println(F("      Data"));
+
+					if (response.desfire == MF_OPERATION_OK || response.desfire == MF_ADDITIONAL_FRAME) {
+						for (size_t row = 0; row < fileContentLength; row += 16) {
+							DumpSpaces(11);
+							DumpBytes(fileContent + row, (fileContentLength - row < 16) ? fileContentLength - row : 16);
+							Serial.println();
+						}
+					}
+					else {
+						DumpSpaces(11);
+						DumpStatus(response);
+					}
+				}
+			}
+			break;
+			case MDFT_VALUE_FILE_WITH_BACKUP:
+			{
+				// Get value
+				int32_t fileValue;
+				response = MIFARE_DESFIRE_GetValue(tag, files[i], &fileValue);
+				DumpLabel(6, F("Value"));
+				Serial.print(' ');
+				if (IsStatusCodeOK(response)) {
+					Serial.println(fileValue);
+				} else {
+					DumpStatus(response);
+				}
+			}
+			break;
+		}
+	}
+
+	DumpRule(0);
+} // End PICC_DumpMifareDesfireApplication()
+
+/**
+ * Walks the whole PICC structure and stores it in *census.
+ *
+ * The walk only issues the commands needed for the requested flags: one GetVersion, the PICC
+ * key settings, GetFreeMemory (EV1 and later) and GetApplicationIDs, then per application one
+ * SelectApplication, GetKeySettings and GetFileIDs. GetFileSettings, GetKeyVersion and
+ * GetDFNames are only issued when selected by flags. Nothing is printed.
+ *
+ * With a deadline set (see PCD_SetDeadline()) the optional steps that would not fit are
+ * dropped and recorded in census->skipped, the walk itself stops with STATUS_TIMEOUT.
+ *
+ * census->applications and census->capacity must be set by the caller: one slot per application
+ * to keep, up to MIFARE_MAX_APPLICATION_COUNT. Applications beyond capacity are not stored and
+ * STATUS_NO_ROOM is returned once the stored ones have been walked. GetCardUID is not used
+ * because it requires an authenticated session; the UID is taken from GetVersion.
+ */
+DESFire::StatusCode DESFire::PICC_MifareDesfireCensus(mifare_desfire_tag *tag, mifare_desfire_census_t *census, byte flags)
+{
+	uint32_t exchanges = _exchangeCount;
+	mifare_desfire_application_census_t *applications = census->applications;
+	byte capacity = census->capacity;
+
+	memset(census, 0, sizeof(mifare_desfire_census_t));
+	memset(applications, 0, capacity * sizeof(mifare_desfire_application_census_t));
+	census->applications = applications;
+	census->capacity = capacity;
+	StatusCode response = PICC_MifareDesfireCensusWalk(tag, census, flags);
+	census->exchanges = _exchangeCount - exchanges;
+
+	return response;
+} // End PICC_MifareDesfireCensus()
+
+/**
+ * @see PICC_MifareDesfireCensus()
+ */
+DESFire::StatusCode DESFire::PICC_MifareDesfireCensusWalk(mifare_desfire_tag *tag, mifare_desfire_census_t *census, byte flags)
+{
+	StatusCode response;
+	mifare_desfire_aid_t aids[MIFARE_MAX_APPLICATION_COUNT];
+	byte applicationCount = 0;
+	bool truncated = false;
+
+	response = MIFARE_DESFIRE_GetVersion(tag, &(census->version));
+	if (!IsStatusCodeOK(response))
+		return response;
+
+	// The PICC level is selected after activation, the session skips the select in that case.
+	mifare_desfire_aid_t piccAid = { { 0x00, 0x00, 0x00 } };
+	response = MIFARE_DESFIRE_SelectApplication(tag, &piccAid);
+	if (!IsStatusCodeOK(response))
+		return response;
+
+	response = MIFARE_DESFIRE_GetKeySettings(tag, &(census->master_key_settings), &(census->master_max_keys));
+	if (!IsStatusCodeOK(response))
+		return response;
+
+	// GetFreeMemory was introduced with EV1
+	if (census->version.hardware.version_major > 0x00) {
+		response = MIFARE_DESFIRE_GetFreeMemory(tag, &(census->free_memory));
+		if (!IsStatusCodeOK(response))
+			return response;
+	}
+
+	response = MIFARE_DESFIRE_GetApplicationIds(tag, aids, &applicationCount);
+	if (!IsStatusCodeOK(response))
+		return response;
+
+	if (applicationCount > census->capacity) {
+		applicationCount = census->capacity;
+		truncated = true;
+	}
+	census->application_count = applicationCount;
+
+	for (byte i = 0; i < applicationCount; i++) {
+		census->applications[i].aid = aids[i];
+	}
+
+	// Optional steps are skipped when they would not leave enough time to walk every application
+	uint32_t reserve = 0;
+	if (_deadline) {
+		reserve = PCD_GetCommandCost(DesfireSelectApplicationCommand::opcode) + PCD_GetCommandCost(DesfireGetKeySettingsCommand::opcode) + PCD_GetCommandCost(0x6F);
+		reserve *= applicationCount;
+	}
+
+	if ((flags & MDCF_DF_NAMES) && !PCD_HasBudget(DesfireGetDFNamesCommand::opcode, 1, reserve)) {
+		flags &= ~MDCF_DF_NAMES;
+		census->skipped |= MDCF_DF_NAMES;
+	}
+
+	// One frame per named application, still on the PICC level
+	if ((flags & MDCF_DF_NAMES) && census->version.hardware.version_major > 0x00) {
+		mifare_desfire_df_name_t names[MIFARE_MAX_APPLICATION_COUNT];
+		byte nameCount = MIFARE_MAX_APPLICATION_COUNT;
+		response = MIFARE_DESFIRE_GetDFNames(tag, names, &nameCount);
+		if (!IsStatusCodeOK(response))
+			return response;
+
+		for (byte n = 0; n < nameCount; n++) {
+			for (byte i = 0; i < applicationCount; i++) {
+				mifare_desfire_application_census_t *application = &(census->applications[i]);
+				if (memcmp(application->aid.data, names[n].aid.data, MIFARE_AID_SIZE) == 0) {
+					application->iso_fid = names[n].iso_fid;
+					application->df_name_length = names[n].name_length;
+					memcpy(application->df_name, names[n].name, names[n].name_length);
+					break;
+				}
+			}
+		}
+	}
+
+	for (byte i = 0; i < applicationCount; i++) {
+		mifare_desfire_application_census_t *application = &(census->applications[i]);
+
+		// This application is on its way, only the following ones stay reserved
+		if (_deadline)
+			reserve = reserve / (applicationCount - i) * (applicationCount - i - 1);
+
+		response = MIFARE_DESFIRE_SelectApplication(tag, &(application->aid));
+		if (!IsStatusCodeOK(response))
+			return response;
+
+		response = MIFARE_DESFIRE_GetKeySettings(tag, &(application->key_settings), &(application->max_keys));
+		if (!IsStatusCodeOK(response))
+			return response;
+
+		if (flags & MDCF_KEY_VERSIONS) {
+			// The lower nibble holds the number of keys (up to 14)
+			byte keyCount = application->max_keys & 0x0F;
+			if (keyCount > sizeof(application->key_versions))
+				keyCount = sizeof(application->key_versions);
+			if (!PCD_HasBudget(DesfireGetKeyVersionCommand::opcode, keyCount, reserve + PCD_GetCommandCost(0x6F))) {
+				census->skipped |= MDCF_KEY_VERSIONS;
+				keyCount = 0;
+			}
+			for (byte key = 0; key < keyCount; key++) {
+				response = MIFARE_DESFIRE_GetKeyVersion(tag, key, &(application->key_versions[key]));
+				if (!IsStatusCodeOK(response))
+					return response;
+			}
+		}
+
+		response = MIFARE_DESFIRE_GetFileIDs(tag, application->files, &(application->file_count));
+		if (!IsStatusCodeOK(response))
+			return response;
+
+		if ((flags & MDCF_FILE_SETTINGS) && !PCD_HasBudget(DesfireGetFileSettingsCommand::opcode, application->file_count, reserve)) {
+			flags &= ~MDCF_FILE_SETTINGS;
+			census->skipped |= MDCF_FILE_SETTINGS;
+		}
+		if (flags & MDCF_FILE_SETTINGS) {
+			for (byte f = 0; f < application->file_count; f++) {
+				response = MIFARE_DESFIRE_GetFileSettings(tag, &(application->files[f]), &(application->file_settings[f]));
+				if (!IsStatusCodeOK(response))
+					return response;
+			}
+		}
+	}
+
+	if (truncated)
+		response.mfrc522 = STATUS_NO_ROOM;
+
+	return response;
+} // End PICC_MifareDesfireCensusWalk()
+
+/**
+ * Compiles a card layout into the frames needed to personalize a card.
+ *
+ * Steps are ordered to keep selects to a minimum: every application is created while the PICC
+ * level is selected and then each application is selected once to create all its files.
+ * layout->frames and layout->capacity must be set by the caller, the layout can then be
+ * replayed on any number of cards with PICC_MifareDesfirePersonalize().
+ *
+ * @return STATUS_OK on success, STATUS_NO_ROOM if the frames do not fit, STATUS_INVALID for unknown file types
+ *         or files of an application missing from applications.
+ */
+MFRC522::StatusCode DESFire::PICC_MifareDesfireCompileLayout(mifare_desfire_application_layout_t *applications, byte applicationCount, mifare_desfire_file_layout_t *files, uint16_t fileCount, mifare_desfire_compiled_layout_t *layout)
+{
+	layout->size = 0;
+	layout->steps = 0;
+	layout->cards = 0;
+	layout->elapsed = 0;
+
+	// Files are compiled application by application, one whose application is not declared would be left out
+	for (uint16_t f = 0; f < fileCount; f++) {
+		byte i = 0;
+		while (i < applicationCount && memcmp(files[f].aid.data, applications[i].aid.data, MIFARE_AID_SIZE) != 0)
+			i++;
+		if (i == applicationCount)
+			return STATUS_INVALID;
+	}
+
+	for (byte i = 0; i < applicationCount; i++) {
+		if (!PICC_MifareDesfireLayoutStep<DesfireCreateApplicationCommand>(layout, applications[i].aid.data, applications[i].key_settings, applications[i].key_count))
+			return STATUS_NO_ROOM;
+	}
+
+	for (byte i = 0; i < applicationCount; i++) {
+		bool selected = false;
+
+		for (uint16_t f = 0; f < fileCount; f++) {
+			mifare_desfire_file_layout_t *file = &(files[f]);
+			mifare_desfire_file_settings_t *settings = &(file->settings);
+			bool added;
+
+			if (memcmp(file->aid.data, applications[i].aid.data, MIFARE_AID_SIZE) != 0)
+				continue;
+
+			if (!selected) {
+				if (!PICC_MifareDesfireLayoutStep<DesfireSelectApplicationCommand>(layout, applications[i].aid.data))
+					return STATUS_NO_ROOM;
+				selected = true;
+			}
+
+			switch (settings->file_type) {
 				case MDFT_STANDARD_DATA_FILE:
+					added = PICC_MifareDesfireLayoutStep<DesfireCreateStdDataFileCommand>(layout, file->file_no, settings->communication_settings, settings->access_rights,
+						settings->settings.standard_file.file_size);
+					break;
 				case MDFT_BACKUP_DATA_FILE:
-					Serial.print(F("      File Size      : "));
-					Serial.print(fileSettings.settings.standard_file.file_size);
-					Serial.println(F(" bytes"));
+					added = PICC_MifareDesfireLayoutStep<DesfireCreateBackupDataFileCommand>(layout, file->file_no, settings->communication_settings, settings->access_rights,
+						settings->settings.standard_file.file_size);
 					break;
 				case MDFT_VALUE_FILE_WITH_BACKUP:
-					Serial.print(F("      Lower Limit    : "));
-					Serial.println(fileSettings.settings.value_file.lower_limit);
-					Serial.print(F("      Upper Limit    : "));
-					Serial.println(fileSettings.settings.value_file.upper_limit);
-					Serial.print(F("      Limited credit : "));
-					Serial.println(fileSettings.settings.value_file.limited_credit_value);
-					Serial.print(F("      Limited credit : "));
-					
-					if (fileSettings.settings.value_file.limited_credit_enabled == 0x00)
-						Serial.print(F("Disabled ("));
-					else
-						Serial.print(F("Enabled (0x"));
-					if (fileSettings.settings.value_file.limited_credit_enabled < 0x10)
-						Serial.print(F("0"));
-					Serial.print(fileSettings.settings.value_file.limited_credit_enabled, HEX);
-					Serial.println(F(")"));
-	
+					added = PICC_MifareDesfireLayoutStep<DesfireCreateValueFileCommand>(layout, file->file_no, settings->communication_settings, settings->access_rights,
+						settings->settings.value_file.lower_limit, settings->settings.value_file.upper_limit,
+						settings->settings.value_file.limited_credit_value, settings->settings.value_file.limited_credit_enabled);
 					break;
-
 				case MDFT_LINEAR_RECORD_FILE_WITH_BACKUP:
+					added = PICC_MifareDesfireLayoutStep<DesfireCreateLinearRecordFileCommand>(layout, file->file_no, settings->communication_settings, settings->access_rights,
+						settings->settings.record_file.record_size, settings->settings.record_file.max_number_of_records);
+					break;
 				case MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP:
-					Serial.print(F("      Record size    : "));
-					Serial.println(fileSettings.settings.record_file.record_size);
-					Serial.print(F("      max num records: "));
-					Serial.println(fileSettings.settings.record_file.max_number_of_records);
-					Serial.print(F("      num records    : "));
-					Serial.println(fileSettings.settings.record_file.current_number_of_records);
+					added = PICC_MifareDesfireLayoutStep<DesfireCreateCyclicRecordFileCommand>(layout, file->file_no, settings->communication_settings, settings->access_rights,
+						settings->settings.record_file.record_size, settings->settings.record_file.max_number_of_records);
 					break;
+				default:
+					return STATUS_INVALID;
 			}
 
-			switch (fileSettings.file_type) {
-				case MDFT_STANDARD_DATA_FILE:
-				case MDFT_BACKUP_DATA_FILE:
-				{
-					// Get file data
-					byte fileContent[fileSettings.settings.standard_file.file_size];
-					size_t fileContentLength = fileSettings.settings.standard_file.file_size;
-					response = MIFARE_DESFIRE_ReadData(tag, files[i], 0, fileSettings.settings.standard_file.file_size, fileContent, &fileContentLength);
-					if (response.mfrc522 == STATUS_OK) {
-						Serial.println(F("      ------------------------------------------------------"));
-						Serial.println(F("      Data"));
-
-						if (response.desfire == MF_OPERATION_OK || response.desfire == MF_ADDITIONAL_FRAME) {
-							for (unsigned int iByte = 0; iByte < fileContentLength; iByte++) {
-								if ((iByte % 16) == 0) {
-									if (iByte != 0)
-										Serial.println();
-									Serial.print(F("           "));
-								}
-								if (fileContent[iByte] < 0x10)
-									Serial.print(F(" 0"));
-								else
-									Serial.print(F(" "));
-								Serial.print(fileContent[iByte], HEX);
-							}
-							Serial.println();
-						}
-						else {
-							Serial.print(F("           "));
-							Serial.println(GetStatusCodeName(response));
-						}
-					}
+			if (!added)
+				return STATUS_NO_ROOM;
+		}
+	}
+
+	return STATUS_OK;
+} // End PICC_MifareDesfireCompileLayout()
+
+/**
+ * Personalizes the PICC in the field by replaying a compiled layout, one frame per step.
+ *
+ * The PICC level must allow creating applications (free create or an authenticated PICC
+ * master key). Replay stops at the first failing step, its index is stored in *failedStep.
+ * Successful runs are added to the throughput counters of the layout.
+ */
+DESFire::StatusCode DESFire::PICC_MifareDesfirePersonalize(mifare_desfire_tag *tag, mifare_desfire_compiled_layout_t *layout, uint16_t *failedStep)
+{
+	StatusCode response;
+	mifare_desfire_aid_t aid = { { 0x00, 0x00, 0x00 } };
+	unsigned long started = micros();
+
+	response.mfrc522 = STATUS_OK;
+	response.desfire = MF_OPERATION_OK;
+
+	// Applications are created from the PICC level
+	response = MIFARE_DESFIRE_SelectApplication(tag, &aid);
+	if (!IsStatusCodeOK(response)) {
+		if (failedStep != NULL)
+			*failedStep = 0;
+		return response;
+	}
+
+	uint16_t offset = 0;
+	for (uint16_t step = 0; step < layout->steps; step++) {
+		byte *frame = layout->frames + offset;
+		byte length = frame[1];
+
+		if (frame[0] == DesfireSelectApplicationCommand::opcode) {
+			memcpy(aid.data, frame + 2, MIFARE_AID_SIZE);
+			response = MIFARE_DESFIRE_SelectApplication(tag, &aid);
+		} else {
+			response = MIFARE_BlockExchangeWithData(tag, frame[0], frame + 2, &length);
+		}
+
+		if (!IsStatusCodeOK(response)) {
+			if (failedStep != NULL)
+				*failedStep = step;
+			return response;
+		}
+
+		offset += 2 + frame[1];
+	}
+
+	layout->cards++;
+	layout->elapsed += (uint32_t)(micros() - started);
+
+	return response;
+} // End PICC_MifareDesfirePersonalize()
+
+/**
+ * 32-bit FNV-1a hash used for file and record fingerprints, chain calls by passing the
+ * previous result as hash.
+ */
+uint32_t DESFire::GetFingerprintHash(const byte *data, size_t length, uint32_t hash)
+{
+	for (size_t i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 0x01000193;
+	}
+
+	return hash;
+} // End GetFingerprintHash()
+
+/**
+ * Hashes the file settings that only change when the file is recreated or reconfigured,
+ * leaving out the current number of records and the limited credit value.
+ */
+uint32_t DESFire::GetFileSettingsHash(mifare_desfire_file_settings_t *settings)
+{
+	byte buffer[4 + DesfireRecordFileSettings::size + 1];
+	byte size = 4;
+
+	buffer[0] = settings->file_type;
+	buffer[1] = settings->communication_settings;
+	DesfireU16::encode(buffer + 2, settings->access_rights);
+
+	switch (settings->file_type) {
+		case MDFT_STANDARD_DATA_FILE:
+		case MDFT_BACKUP_DATA_FILE:
+			DesfireU24::encode(buffer + size, settings->settings.standard_file.file_size);
+			size += DesfireU24::size;
+			break;
+		case MDFT_VALUE_FILE_WITH_BACKUP:
+			DesfireS32::encode(buffer + size, settings->settings.value_file.lower_limit);
+			size += DesfireS32::size;
+			DesfireS32::encode(buffer + size, settings->settings.value_file.upper_limit);
+			size += DesfireS32::size;
+			buffer[size++] = settings->settings.value_file.limited_credit_enabled;
+			break;
+		case MDFT_LINEAR_RECORD_FILE_WITH_BACKUP:
+		case MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP:
+			DesfireU24::encode(buffer + size, settings->settings.record_file.record_size);
+			size += DesfireU24::size;
+			DesfireU24::encode(buffer + size, settings->settings.record_file.max_number_of_records);
+			size += DesfireU24::size;
+			break;
+	}
+
+	return GetFingerprintHash(buffer, size);
+} // End GetFileSettingsHash()
+
+/**
+ * Synchronizes one application of the PICC in the field against its previous fingerprint.
+ *
+ * File IDs and settings are always read, file contents only where something may have changed:
+ *  - value files: GetValue only (4 bytes).
+ *  - record files: the new records only, found from the current number of records and the
+ *    hash of the newest record known so far. A full cyclic file is walked from the newest
+ *    record until that record is found again, so this costs one record per new record plus one.
+ *  - data files: read in full when added, when their settings changed or when their bit is
+ *    set in volatileFiles; data files are assumed to only change at issuance otherwise.
+ *
+ * New data (file contents, new records oldest first) is stored in buffer and referenced by the
+ * changes in *diff. *fingerprint is updated to the state of the PICC. A fingerprint of another
+ * UID (or a zeroed one) makes this a full read, so PICCs with random UIDs are always read in
+ * full. Files that cannot be read without authentication are reported as MDSC_DENIED.
+ *
+ * @return STATUS_OK on success, STATUS_NO_ROOM if the new data does not fit in buffer.
+ */
+DESFire::StatusCode DESFire::PICC_MifareDesfireSync(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid, mifare_desfire_fingerprint_t *fingerprint, mifare_desfire_sync_diff_t *diff, byte *buffer, size_t bufferSize, uint32_t volatileFiles)
+{
+	StatusCode response;
+	uint32_t exchanges = _exchangeCount;
+	mifare_desfire_fingerprint_t previous = *fingerprint;
+	byte files[MIFARE_MAX_FILE_COUNT];
+	byte fileCount = 0;
+	size_t used = 0;
+
+	memset(diff, 0, sizeof(mifare_desfire_sync_diff_t));
+
+	// Another card or application, nothing is known about it
+	if (uid.size != MIFARE_UID_BYTES || memcmp(previous.uid, uid.uidByte, MIFARE_UID_BYTES) != 0 ||
+	    memcmp(previous.aid.data, aid->data, MIFARE_AID_SIZE) != 0) {
+		previous.file_count = 0;
+	}
+
+	response = MIFARE_DESFIRE_SelectApplication(tag, aid);
+	if (IsStatusCodeOK(response))
+		response = MIFARE_DESFIRE_GetFileIDs(tag, files, &fileCount);
+	if (!IsStatusCodeOK(response)) {
+		diff->exchanges = _exchangeCount - exchanges;
+		return response;
+	}
+
+	memset(fingerprint, 0, sizeof(mifare_desfire_fingerprint_t));
+	memcpy(fingerprint->uid, uid.uidByte, (uid.size < MIFARE_UID_BYTES) ? uid.size : MIFARE_UID_BYTES);
+	fingerprint->aid = *aid;
+
+	// Files that are gone
+	for (byte i = 0; i < previous.file_count; i++) {
+		if (memchr(files, previous.files[i].file_no, fileCount) == NULL) {
+			diff->changes[diff->change_count].file_no = previous.files[i].file_no;
+			diff->changes[diff->change_count].changes = MDSC_REMOVED;
+			diff->change_count++;
+		}
+	}
+
+	for (byte i = 0; i < fileCount && IsStatusCodeOK(response); i++) {
+		mifare_desfire_file_settings_t settings;
+		mifare_desfire_file_fingerprint_t *current = &(fingerprint->files[i]);
+		mifare_desfire_file_change_t *change = &(diff->changes[diff->change_count]);
+		const mifare_desfire_file_fingerprint_t *known = NULL;
+
+		for (byte j = 0; j < previous.file_count; j++) {
+			if (previous.files[j].file_no == files[i])
+				known = &(previous.files[j]);
+		}
+
+		response = MIFARE_DESFIRE_GetFileSettings(tag, &files[i], &settings);
+		if (!IsStatusCodeOK(response))
+			break;
+
+		current->file_no = files[i];
+		current->settings_hash = GetFileSettingsHash(&settings);
+		fingerprint->file_count++;
+
+		change->file_no = files[i];
+		if (known == NULL)
+			change->changes = MDSC_ADDED;
+		else if (known->settings_hash != current->settings_hash)
+			change->changes = MDSC_SETTINGS;
+
+		switch (settings.file_type) {
+			case MDFT_STANDARD_DATA_FILE:
+			case MDFT_BACKUP_DATA_FILE:
+			{
+				uint32_t fileSize = settings.settings.standard_file.file_size;
+				size_t length = 0;
+
+				if (change->changes == 0 && (volatileFiles & (1UL << (files[i] & 0x1F))) == 0) {
+					current->state = known->state;
+					break;
+				}
+				if (fileSize > bufferSize - used) {
+					response.mfrc522 = STATUS_NO_ROOM;
+					break;
+				}
+				length = bufferSize - used;
+				response = MIFARE_DESFIRE_ReadData(tag, files[i], 0, fileSize, buffer + used, &length);
+				if (!IsStatusCodeOK(response))
+					break;
+
+				diff->bytes_read += length;
+				current->state = GetFingerprintHash(buffer + used, length);
+				if (change->changes != 0 || current->state != known->state) {
+					change->changes |= MDSC_CONTENT;
+					change->data_offset = used;
+					change->data_length = length;
+					used += length;
 				}
 				break;
-				case MDFT_VALUE_FILE_WITH_BACKUP:
-				{
-					// Get value
-					int32_t fileValue;
-					response = MIFARE_DESFIRE_GetValue(tag, files[i], &fileValue);
-					Serial.print(F("      Value          : "));
-					if (IsStatusCodeOK(response)) {
-						Serial.println(fileValue);
-					} else {
-						Serial.println(GetStatusCodeName(response));
-					}
+			}
+			case MDFT_VALUE_FILE_WITH_BACKUP:
+			{
+				int32_t value;
+
+				response = MIFARE_DESFIRE_GetValue(tag, files[i], &value);
+				if (!IsStatusCodeOK(response))
+					break;
+
+				diff->bytes_read += DesfireS32::size;
+				current->state = (uint32_t)value;
+				if (change->changes != 0 || current->state != known->state) {
+					change->changes |= MDSC_VALUE;
+					change->value = value;
 				}
 				break;
 			}
+			case MDFT_LINEAR_RECORD_FILE_WITH_BACKUP:
+			case MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP:
+				response = PICC_MifareDesfireSyncRecords(tag, files[i], settings.settings.record_file.record_size, settings.settings.record_file.current_number_of_records,
+				                                         (change->changes == 0) ? known : NULL, current, change, buffer + used, bufferSize - used, &(diff->bytes_read));
+				if (IsStatusCodeOK(response)) {
+					change->data_offset += used;
+					used += change->data_length;
+				}
+				break;
+		}
 
-		} else {
-			Serial.println(F("      Error: Failed to get file settings."));
-			Serial.print(F("      "));
-			Serial.println(GetStatusCodeName(response));
+		// Protected files are reported but do not stop the sync
+		if (response.mfrc522 == STATUS_OK && (response.desfire == MF_AUTHENTICATION_ERROR || response.desfire == MF_PERMISSION_ERROR)) {
+			if (known != NULL)
+				*current = *known;
+			change->changes |= MDSC_DENIED;
+			response.desfire = MF_OPERATION_OK;
+		}
+
+		if (change->changes != 0)
+			diff->change_count++;
+	}
+
+	diff->exchanges = _exchangeCount - exchanges;
+
+	return response;
+} // End PICC_MifareDesfireSync()
+
+/**
+ * @see PICC_MifareDesfireSync()
+ *
+ * previous is NULL when the file is new or changed, the records then are all read.
+ * change->data_offset is relative to buffer.
+ */
+DESFire::StatusCode DESFire::PICC_MifareDesfireSyncRecords(mifare_desfire_tag *tag, byte fid, uint32_t recordSize, uint32_t count, const mifare_desfire_file_fingerprint_t *previous, mifare_desfire_file_fingerprint_t *current, mifare_desfire_file_change_t *change, byte *buffer, size_t bufferSize, uint32_t *bytesRead)
+{
+	StatusCode response;
+	size_t length = 0;
+	uint32_t expected = count;
+	uint32_t read;
+
+	response.mfrc522 = STATUS_OK;
+	response.desfire = MF_OPERATION_OK;
+
+	current->state = count;
+	current->newest_record_hash = 0;
+	change->data_offset = 0;
+
+	if (count == 0 || recordSize == 0) {
+		// Cleared, or still empty
+		if (previous == NULL || previous->state != 0)
+			change->changes |= MDSC_RECORDS;
+		return response;
+	}
+
+	// Records expected to be new, plus the one that should be the newest known record
+	if (previous != NULL && previous->state > 0)
+		expected = (count > previous->state) ? count - previous->state : 0;
+	read = (previous != NULL && expected < count) ? expected + 1 : count;
+
+	if (read * recordSize > bufferSize) {
+		response.mfrc522 = STATUS_NO_ROOM;
+		return response;
+	}
+	length = read * recordSize;
+	response = MIFARE_DESFIRE_ReadRecords(tag, fid, 0, read, buffer, &length);
+	if (!IsStatusCodeOK(response))
+		return response;
+	*bytesRead += length;
+	if (length != read * recordSize) {
+		response.mfrc522 = STATUS_ERROR;
+		return response;
+	}
+	// The records come oldest first, the newest one is last
+	current->newest_record_hash = GetFingerprintHash(buffer + (read - 1) * recordSize, recordSize);
+
+	uint32_t fresh = count;
+	if (previous != NULL && previous->state > 0) {
+		// The newest known record should be right before the new ones, otherwise look for it
+		if (expected < read && GetFingerprintHash(buffer + (read - 1 - expected) * recordSize, recordSize) == previous->newest_record_hash) {
+			fresh = expected;
+		}
+		else {
+			// i records are newer than the one looked at
+			for (uint32_t i = 0; i < count; i++) {
+				if (i == read) {
+					// Walk further back one record at a time, older records go in front
+					if ((read + 1) * recordSize > bufferSize) {
+						response.mfrc522 = STATUS_NO_ROOM;
+						return response;
+					}
+					memmove(buffer + recordSize, buffer, read * recordSize);
+					length = recordSize;
+					response = MIFARE_DESFIRE_ReadRecords(tag, fid, read, 1, buffer, &length);
+					if (!IsStatusCodeOK(response))
+						return response;
+					*bytesRead += length;
+					read++;
+				}
+				if (GetFingerprintHash(buffer + (read - 1 - i) * recordSize, recordSize) == previous->newest_record_hash) {
+					fresh = i;
+					break;
+				}
+			}
 		}
 	}
 
+	if (previous == NULL || fresh > 0) {
+		// The new records are the last ones read, move them to the start of buffer
+		memmove(buffer, buffer + (read - fresh) * recordSize, fresh * recordSize);
+		change->changes |= MDSC_RECORDS;
+		change->new_records = fresh;
+		change->data_length = fresh * recordSize;
+	}
 
-	Serial.println(F("-------------------------------------------------------------"));
-}
\ No newline at end of file
+	return response;
+} // End PICC_MifareDesfireSyncRecords()
@@ -4,6 +4,8 @@
 #include <Arduino.h>
 #include <SPI.h>
 #include <MFRC522.h>
+#include "DesfireCommand.h"
+#include "DesfireCrypto.h"
 
 /* --------------------------------------
 * DESFire Logical Structure
@@ -14,6 +16,49 @@
 #define MIFARE_UID_BYTES             7  /* number of UID bytes */
 #define MIFARE_AID_SIZE              3  /* number of AID bytes */
 
+/* --------------------------------------
+* ISO/IEC 14443-4 Frames
+* --------------------------------------
+* DESFIRE_FSD sizes the frame buffers on the stack, several of them during one command. A native
+* DESFire answers 59 data bytes per frame whatever the FSD, only ISO READ BINARY and other chained
+* APDUs get larger frames from a larger FSD. Raise it as a build flag of the whole project
+* (-DDESFIRE_FSD=256), a #define in the sketch does not reach the library.
+*/
+#ifndef DESFIRE_FSD
+#define DESFIRE_FSD                  64  /* max frame size accepted from the PICC (16..256) */
+#endif
+#define DESFIRE_FRAME_OVERHEAD       5  /* PCB + CID + command/status + CRC_A */
+#define DESFIRE_NATIVE_FRAME_DATA    59 /* data bytes of a native answer frame, whatever the FSD */
+#define DESFIRE_FIFO_WATER_LEVEL     16 /* FIFO level used to refill/drain frames over 64 bytes */
+#ifndef DESFIRE_RF_WINDOW
+#define DESFIRE_RF_WINDOW            16 /* frames between two adaptive RF adjustments */
+#endif
+#define DESFIRE_RF_HIGH_ERROR_RATE   26 /* failed frames out of 256 (10%) triggering an adjustment */
+#define DESFIRE_RF_LOW_ERROR_RATE    3  /* failed frames out of 256 under which the bit rate is raised again */
+#define DESFIRE_DEFAULT_FWT          4833 /* frame waiting time in us for the default FWI of 4 */
+#define DESFIRE_DELTA_FWT            3625 /* us allowed past the FWT, ISO/IEC 14443-4 deltaFWT */
+#define DESFIRE_NOT_AUTHENTICATED    0xFF
+#define DESFIRE_AUTH_ANSWER_SIZE     21 /* PCB + CID + NAD + 16 byte challenge + SW1 SW2 of a wrapped answer */
+#define DESFIRE_MAC_SIZE             8  /* CMAC bytes appended to the answers of an AES session */
+#ifndef DESFIRE_COST_SLOTS
+#define DESFIRE_COST_SLOTS           8  /* commands whose duration is learned for the deadline */
+#endif
+#define DESFIRE_DEFAULT_COMMAND_COST 6000 /* us expected per frame of a command not timed yet */
+#ifndef DESFIRE_ISO_MAX_LE
+#define DESFIRE_ISO_MAX_LE           256 /* max Le per ISO READ BINARY, above 256 needs extended length */
+#endif
+
+/* --------------------------------------
+* Names
+* --------------------------------------
+* Define DESFIRE_NO_NAMES to leave all status, file type, communication mode and card type
+* names out of flash. The name functions then return an empty string and the dump functions
+* print the codes only.
+*/
+
+class DesfireTrace;
+class DesfireTransport;
+
 class DESFire : public MFRC522 {
 public:
 	// DESFire Status and Error Codes.
@@ -119,11 +164,180 @@ public:
 		} settings;
 	} mifare_desfire_file_settings_t;
 
+	// A struct used for passing a DESFire application ISO name (EV1 and later)
+	typedef struct {
+		mifare_desfire_aid_t aid;
+		uint16_t iso_fid;
+		uint8_t name[16];
+		uint8_t name_length;
+	} mifare_desfire_df_name_t;
+
+	// Census flags, select the optional parts of the card walk
+	enum mifare_desfire_census_flags : byte {
+		MDCF_FILE_SETTINGS = 0x01,    /* GetFileSettings for every file */
+		MDCF_KEY_VERSIONS  = 0x02,    /* GetKeyVersion for every key */
+		MDCF_DF_NAMES      = 0x04,    /* GetDFNames (EV1 and later, one frame per application) */
+		MDCF_DEFAULT       = MDCF_FILE_SETTINGS
+	};
+
+	// A struct used for passing one application of a card census
+	typedef struct {
+		mifare_desfire_aid_t aid;
+		uint8_t key_settings;
+		uint8_t max_keys;
+		uint8_t key_versions[14];             /* only with MDCF_KEY_VERSIONS */
+		uint16_t iso_fid;                     /* only with MDCF_DF_NAMES */
+		uint8_t df_name[16];                  /* only with MDCF_DF_NAMES */
+		uint8_t df_name_length;               /* 0 if the application has no DF name */
+		uint8_t file_count;
+		uint8_t files[MIFARE_MAX_FILE_COUNT];
+		mifare_desfire_file_settings_t file_settings[MIFARE_MAX_FILE_COUNT]; /* only with MDCF_FILE_SETTINGS */
+	} mifare_desfire_application_census_t;
+
+	// A struct used for passing the structure of a whole card, see PICC_MifareDesfireCensus()
+	typedef struct {
+		mifare_desfire_application_census_t *applications; /* one slot per application to keep */
+		uint8_t capacity;                     /* slots in *applications */
+		MIFARE_DESFIRE_Version_t version;
+		uint32_t free_memory;                 /* EV1 and later, 0 otherwise */
+		uint8_t master_key_settings;
+		uint8_t master_max_keys;
+		uint8_t application_count;            /* applications stored, at most capacity */
+		uint16_t exchanges;                   /* frames exchanged to take the census */
+		uint8_t skipped;                      /* census flags dropped to stay within the deadline */
+	} mifare_desfire_census_t;
+
+	// A struct used for declaring one file of a card layout
+	typedef struct {
+		mifare_desfire_aid_t aid;             /* application the file belongs to */
+		uint8_t file_no;
+		mifare_desfire_file_settings_t settings; /* value files: limited_credit_value is the initial value */
+	} mifare_desfire_file_layout_t;
+
+	// A struct used for declaring one application of a card layout
+	typedef struct {
+		mifare_desfire_aid_t aid;
+		uint8_t key_settings;
+		uint8_t key_count;                    /* number of keys, EV1 crypto method in bits 7..6 */
+	} mifare_desfire_application_layout_t;
+
+	// A card layout compiled into ready to send frames, see PICC_MifareDesfireCompileLayout()
+	typedef struct {
+		uint8_t *frames;                      /* [command][length][data] for each step */
+		uint16_t capacity;                    /* size of *frames */
+		uint16_t size;                        /* bytes of *frames in use */
+		uint16_t steps;
+		uint32_t cards;                       /* cards personalized with this layout */
+		uint64_t elapsed;                     /* microseconds spent personalizing them, 32 bits wrap in 72 minutes */
+	} mifare_desfire_compiled_layout_t;
+
+	// Sync changes, what changed in a file since the previous fingerprint
+	enum mifare_desfire_sync_changes : byte {
+		MDSC_ADDED    = 0x01,    /* file did not exist */
+		MDSC_REMOVED  = 0x02,    /* file no longer exists */
+		MDSC_SETTINGS = 0x04,    /* file settings changed, the whole content was read */
+		MDSC_CONTENT  = 0x08,    /* data file content changed */
+		MDSC_VALUE    = 0x10,    /* value file value changed */
+		MDSC_RECORDS  = 0x20,    /* record file has new records (or was cleared) */
+		MDSC_DENIED   = 0x40     /* content could not be read without authentication */
+	};
+
+	// A struct used for passing the fingerprint of one file
+	typedef struct {
+		uint8_t file_no;
+		uint32_t settings_hash;               /* settings without the volatile parts */
+		uint32_t state;                       /* content hash, value or current number of records */
+		uint32_t newest_record_hash;          /* record files only */
+	} mifare_desfire_file_fingerprint_t;
+
+	// A struct used for passing the fingerprint of one application of a card, see PICC_MifareDesfireSync()
+	typedef struct {
+		uint8_t uid[MIFARE_UID_BYTES];
+		mifare_desfire_aid_t aid;
+		uint8_t file_count;
+		mifare_desfire_file_fingerprint_t files[MIFARE_MAX_FILE_COUNT];
+	} mifare_desfire_fingerprint_t;
+
+	// A struct used for passing the change of one file found by a sync
+	typedef struct {
+		uint8_t file_no;
+		uint8_t changes;                      /* mifare_desfire_sync_changes */
+		int32_t value;                        /* MDSC_VALUE: the new value */
+		uint16_t new_records;                 /* MDSC_RECORDS: number of new records, oldest first */
+		uint32_t data_offset;                 /* MDSC_CONTENT/MDSC_RECORDS: data in the sync buffer */
+		uint32_t data_length;
+	} mifare_desfire_file_change_t;
+
+	// A struct used for passing the difference between two fingerprints
 	typedef struct {
+		uint8_t change_count;
+		mifare_desfire_file_change_t changes[2 * MIFARE_MAX_FILE_COUNT]; /* removed files come on top */
+		uint32_t bytes_read;                  /* file data bytes read */
+		uint16_t exchanges;                   /* frames exchanged for the sync */
+	} mifare_desfire_sync_diff_t;
+
+	// A struct used for passing the RF parameters chosen by the adaptive RF tuning
+	typedef struct {
+		uint8_t rx_gain;                      /* RFCfgReg RxGain, MFRC522::PCD_RxGain */
+		uint8_t mod_width;                    /* ModWidthReg */
+		uint8_t max_bit_rate;                 /* highest DRI/DSI allowed in PPS: 0 = 106kBd .. 3 = 848kBd */
+		uint8_t error_rate;                   /* failed frames out of 256, smoothed */
+		uint16_t adjustments;                 /* changes made since PCD_SetAdaptiveRF() */
+	} mifare_desfire_rf_parameters_t;
+
+	// Protocol and authentication state of one PICC, valid from RATS until the PICC leaves the field.
+	// Plain data, so it can live on the stack and be copied or moved between readers or tasks.
+	struct DesfireSession {
 		byte cid;	// Card ID
-		byte pcb;	// Protocol Control Byte
+		byte pcb;	// Protocol Control Byte of the next I-block, NAD bit (0x04) set to send nad
+		byte nad;	// Node address
+		uint16_t fsc;	// Max frame size the PICC accepts, from the ATS
+		uint16_t fsd;	// Max frame size announced to the PICC in RATS
+		uint32_t fwt;	// Frame waiting time in microseconds, from the ATS
 		byte selected_application[MIFARE_AID_SIZE];
-	} mifare_desfire_tag;
+		byte authenticated_key;	// Key number of the current authentication, DESFIRE_NOT_AUTHENTICATED if none
+		byte session_key[24];
+		byte session_key_length;
+		byte iv[16];
+		uint16_t command_counter;	// Commands exchanged since the authentication
+		byte mac_block[16];	// Answer bytes of an AES session not chained into iv yet
+		byte mac_block_length;
+		byte mac_tail[DESFIRE_MAC_SIZE];	// End of a full answer frame, the CMAC may start there
+		byte mac_tail_length;
+
+		DesfireSession() { Reset(); }
+
+		// Back to the state of a freshly activated PICC: PICC level selected, not authenticated
+		void Reset() {
+			cid = 0x00;
+			pcb = 0x0A;
+			nad = 0x00;
+			fsc = 32;
+			fsd = DESFIRE_FSD;
+			fwt = DESFIRE_DEFAULT_FWT;
+			memset(selected_application, 0, MIFARE_AID_SIZE);
+			ResetAuthentication();
+		}
+
+		// Drops the session key, the PICC does the same on any select or failed command
+		void ResetAuthentication() {
+			authenticated_key = DESFIRE_NOT_AUTHENTICATED;
+			memset(session_key, 0, sizeof(session_key));
+			session_key_length = 0;
+			memset(iv, 0, sizeof(iv));
+			command_counter = 0;
+			mac_block_length = 0;
+			mac_tail_length = 0;
+		}
+
+		bool IsSelected(const byte *aid) const { return memcmp(selected_application, aid, MIFARE_AID_SIZE) == 0; }
+		bool IsAuthenticated(byte key) const { return authenticated_key == key; }
+	};
+	typedef DesfireSession mifare_desfire_tag;
+
+	// Authenticates the session with a key of the selected application, supplied by the caller of
+	// DesfireKeyRollover and DesfireReadPlan: typically MIFARE_DESFIRE_AuthenticateAES() with its key
+	typedef StatusCode (*authenticate_t)(DESFire *reader, mifare_desfire_tag *tag, mifare_desfire_aid_t *aid, byte key, void *context);
 
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Functions for setting up the Arduino
@@ -135,39 +349,111 @@ public:
 	/////////////////////////////////////////////////////////////////////////////////////
 	// ISO/IEC 14443 functions not currentlly present in MFRC522 library
 	/////////////////////////////////////////////////////////////////////////////////////
-	MFRC522::StatusCode PICC_RequestATS(byte *atsBuffer, byte *atsLength);
+	// Drops the FSC and FWT of the ATS: sessions keep 32 byte frames, too small for ChangeKey and AuthenticateAES
+	MFRC522::StatusCode PICC_RequestATS(byte *atsBuffer, byte *atsLength) __attribute__((deprecated("pass the DesfireSession to start")));
+	MFRC522::StatusCode PICC_RequestATS(DesfireSession *session, byte *atsBuffer, byte *atsLength);
 	MFRC522::StatusCode PICC_ProtocolAndParameterSelection(byte cid, byte pps0, byte pps1 = 0x00);
 
+	// Logs every frame into trace (NULL to stop tracing)
+	void PCD_SetTrace(DesfireTrace *trace) { _trace = trace; };
+	// Exchanges frames through transport instead of the MFRC522 (NULL for the MFRC522)
+	void PCD_SetTransport(DesfireTransport *transport) { _transport = transport; };
+
+	// Adaptive RF tuning from the frame error rate, see PCD_DesfireTuneRF()
+	void PCD_SetAdaptiveRF(bool enabled);
+	void PCD_GetRFParameters(mifare_desfire_rf_parameters_t *parameters) { *parameters = _rf; parameters->error_rate = _rfErrorRate >> 8; };
+	void PCD_SetRFParameters(mifare_desfire_rf_parameters_t *parameters);
+
+	// Transaction deadline, see PCD_SetDeadline()
+	void PCD_SetDeadline(uint32_t budget);
+	void PCD_ClearDeadline() { _deadline = false; };
+	uint32_t PCD_GetRemainingBudget();
+	bool PCD_IsDeadlineExceeded() { return _deadlineExceeded; };
+	bool PCD_HasBudget(byte cmd, byte count = 1, uint32_t reserve = 0);
+	uint32_t PCD_GetCommandCost(byte cmd, uint16_t frames = 1);
+	void PCD_SetCommandCost(byte cmd, uint32_t cost);
+
+	// Runs the crypto of the authentication while frames are on air, see PCD_DesfireRunOverlap()
+	void PCD_SetCryptoOverlap(bool enabled) { _overlapEnabled = enabled; };
+
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Functions for MIFARE DESFire
 	/////////////////////////////////////////////////////////////////////////////////////
+	void MIFARE_DESFIRE_SetWrappedMode(bool wrapped) { _wrapped = wrapped; };
 	StatusCode MIFARE_DESFIRE_GetVersion(mifare_desfire_tag *tag, MIFARE_DESFIRE_Version_t *versionInfo);
 	StatusCode MIFARE_DESFIRE_GetApplicationIds(mifare_desfire_tag *tag, mifare_desfire_aid_t *aids, byte *applicationCount);
 	StatusCode MIFARE_DESFIRE_SelectApplication(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid);
 	StatusCode MIFARE_DESFIRE_GetKeySettings(mifare_desfire_tag *tag, byte *settings, byte *maxKeys);
 	StatusCode MIFARE_DESFIRE_GetKeyVersion(mifare_desfire_tag *tag, byte key, byte *version);
+	StatusCode MIFARE_DESFIRE_GetFreeMemory(mifare_desfire_tag *tag, uint32_t *freeMemory);
+	StatusCode MIFARE_DESFIRE_GetDFNames(mifare_desfire_tag *tag, mifare_desfire_df_name_t *names, byte *nameCount);
+	StatusCode MIFARE_DESFIRE_CreateApplication(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid, byte settings, byte keyCount);
+	StatusCode MIFARE_DESFIRE_DeleteApplication(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid);
+	StatusCode MIFARE_DESFIRE_FormatPICC(mifare_desfire_tag *tag);
+	StatusCode MIFARE_DESFIRE_ChangeKeySettings(mifare_desfire_tag *tag, byte *cryptogram, byte cryptogramLength);
+	StatusCode MIFARE_DESFIRE_ChangeKey(mifare_desfire_tag *tag, byte key, byte *cryptogram, byte cryptogramLength);
+	StatusCode MIFARE_DESFIRE_AuthenticateAES(mifare_desfire_tag *tag, byte key, const byte *keyData, DesfireAES *sessionCipher = NULL);
 
 	/////////////////////////////////////////////////////////////////////////////////////
 	// MIFARE DESFire application level commands
 	/////////////////////////////////////////////////////////////////////////////////////
 	StatusCode MIFARE_DESFIRE_GetFileIDs(mifare_desfire_tag *tag, byte *files, byte *filesCount);
 	StatusCode MIFARE_DESFIRE_GetFileSettings(mifare_desfire_tag *tag, byte *file, mifare_desfire_file_settings_t *fileSettings);
+	StatusCode MIFARE_DESFIRE_CreateStdDataFile(mifare_desfire_tag *tag, byte fid, byte communication, uint16_t accessRights, uint32_t fileSize);
+	StatusCode MIFARE_DESFIRE_CreateBackupDataFile(mifare_desfire_tag *tag, byte fid, byte communication, uint16_t accessRights, uint32_t fileSize);
+	StatusCode MIFARE_DESFIRE_CreateValueFile(mifare_desfire_tag *tag, byte fid, byte communication, uint16_t accessRights, int32_t lowerLimit, int32_t upperLimit, int32_t value, byte limitedCreditEnabled);
+	StatusCode MIFARE_DESFIRE_CreateLinearRecordFile(mifare_desfire_tag *tag, byte fid, byte communication, uint16_t accessRights, uint32_t recordSize, uint32_t maxRecords);
+	StatusCode MIFARE_DESFIRE_CreateCyclicRecordFile(mifare_desfire_tag *tag, byte fid, byte communication, uint16_t accessRights, uint32_t recordSize, uint32_t maxRecords);
 
 	/////////////////////////////////////////////////////////////////////////////////////
 	// MIFARE DESFire data manipulation commands
 	/////////////////////////////////////////////////////////////////////////////////////
 	StatusCode MIFARE_DESFIRE_ReadData(mifare_desfire_tag *tag, byte fid, uint32_t offset, uint32_t length, byte *backData, size_t *backLen);
+	StatusCode MIFARE_DESFIRE_ReadRecords(mifare_desfire_tag *tag, byte fid, uint32_t offset, uint32_t count, byte *backData, size_t *backLen);
 	StatusCode MIFARE_DESFIRE_GetValue(mifare_desfire_tag *tag, byte fid, int32_t *value);
 
+	/////////////////////////////////////////////////////////////////////////////////////
+	// MIFARE DESFire ISO/IEC 7816-4 commands
+	/////////////////////////////////////////////////////////////////////////////////////
+	StatusCode MIFARE_DESFIRE_ISOSelectDFName(mifare_desfire_tag *tag, byte *name, byte nameLength);
+	StatusCode MIFARE_DESFIRE_ISOReadBinary(mifare_desfire_tag *tag, byte sfi, uint16_t offset, uint16_t length, byte *backData, size_t *backLen);
+
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Support functions
 	/////////////////////////////////////////////////////////////////////////////////////
 	static const __FlashStringHelper *GetDesfireStatusCodeName(DesfireStatusCode code);
+	static DesfireStatusCode GetDesfireStatusCode(uint16_t statusWord);
 	virtual const __FlashStringHelper *GetStatusCodeName(MFRC522::StatusCode code) { return MFRC522::GetStatusCodeName(code);  };
 	static const __FlashStringHelper *GetStatusCodeName(StatusCode code);
 	static const __FlashStringHelper *GetFileTypeName(mifare_desfire_file_types fileType);
 	static const __FlashStringHelper *GetCommunicationModeName(mifare_desfire_communication_modes communicationMode);
 	bool IsStatusCodeOK(StatusCode code);
+	uint32_t GetExchangeCount() { return _exchangeCount; };
+	static uint32_t GetCardsPerMinute(mifare_desfire_compiled_layout_t *layout);
+	static uint32_t GetFingerprintHash(const byte *data, size_t length, uint32_t hash = 0x811C9DC5);
+
+	/**
+	 * Moves entry to the front of a most recently used list of *count entries. A NULL entry
+	 * takes a new slot, the oldest one once all capacity slots are used, left for the caller
+	 * to fill in.
+	 *
+	 * @return The front entry.
+	 */
+	template <typename Entry>
+	static Entry *MoveToFront(Entry *entries, byte *count, byte capacity, Entry *entry)
+	{
+		if (entry == NULL) {
+			if (*count < capacity)
+				(*count)++;
+			entry = &entries[*count - 1];
+		}
+
+		Entry moved = *entry;
+		memmove(entries + 1, entries, (entry - entries) * sizeof(Entry));
+		entries[0] = moved;
+
+		return &entries[0];
+	}
 
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Functions for debugging
@@ -175,13 +461,132 @@ public:
 	void PICC_DumpMifareDesfireMasterKey(mifare_desfire_tag *tag);
 	void PICC_DumpMifareDesfireVersion(mifare_desfire_tag *tag, MIFARE_DESFIRE_Version_t *versionInfo);
 	void PICC_DumpMifareDesfireApplication(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid);
+	static void DumpHex(byte value);
+	static void DumpBytes(const byte *data, size_t length);
+
+	/////////////////////////////////////////////////////////////////////////////////////
+	// Card level operations
+	/////////////////////////////////////////////////////////////////////////////////////
+	StatusCode PICC_MifareDesfireCensus(mifare_desfire_tag *tag, mifare_desfire_census_t *census, byte flags = MDCF_DEFAULT);
+	MFRC522::StatusCode PICC_MifareDesfireCompileLayout(mifare_desfire_application_layout_t *applications, byte applicationCount, mifare_desfire_file_layout_t *files, uint16_t fileCount, mifare_desfire_compiled_layout_t *layout);
+	StatusCode PICC_MifareDesfirePersonalize(mifare_desfire_tag *tag, mifare_desfire_compiled_layout_t *layout, uint16_t *failedStep = NULL);
+	StatusCode PICC_MifareDesfireSync(mifare_desfire_tag *tag, mifare_desfire_aid_t *aid, mifare_desfire_fingerprint_t *fingerprint, mifare_desfire_sync_diff_t *diff, byte *buffer, size_t bufferSize, uint32_t volatileFiles = 0);
 
 protected:
+	byte _txMode = 0x00;			// TxModeReg bit rate negotiated with PPS (CRC bit excluded)
+	byte _rxMode = 0x00;			// RxModeReg bit rate negotiated with PPS (CRC bit excluded)
+	uint32_t _exchangeCount = 0;	// Number of frames exchanged with PICCs
+	DesfireTrace *_trace = NULL;	// Frame trace, if enabled
+	DesfireTransport *_transport = NULL;	// Frame transport, NULL for the MFRC522
+	bool _wrapped = false;			// Send native commands wrapped in ISO/IEC 7816-4 APDUs
+	bool _rfAdaptive = false;		// Adaptive RF tuning enabled
+	mifare_desfire_rf_parameters_t _rf = { RxGain_avg, 0x26, 3, 0, 0 };
+	uint16_t _rfErrorRate = 0;		// Failed frames out of 65536, smoothed over about 16 frames
+	byte _rfFrames = 0;				// Frames in the current window
+	byte _rfTimeouts = 0;			// Frames of the current window without an answer
+	byte _rfCorrupted = 0;			// Frames of the current window received with CRC, parity or collision errors
+	byte _rfCleanWindows = 0;		// Consecutive windows below DESFIRE_RF_LOW_ERROR_RATE
+	bool _deadline = false;			// Transaction deadline set
+	bool _deadlineExceeded = false;	// A command was refused since PCD_SetDeadline()
+	unsigned long _deadlineStart = 0;
+	uint32_t _deadlineBudget = 0;
+	byte _costCommands[DESFIRE_COST_SLOTS];	// Commands of _costs
+	uint32_t _costs[DESFIRE_COST_SLOTS];	// Microseconds per frame of each command, smoothed over about 4 commands
+	byte _costCount = 0;
+	byte _costNext = 0;				// Slot replaced by the next new command once all are used
+	byte _command = 0x00;			// Command being timed, 0x00 if none
+	unsigned long _commandStarted = 0;
+	uint32_t _commandExchanges = 0;	// _exchangeCount when _command started
+	uint16_t _commandFrames = 1;	// Frames expected from the next command, see PCD_DesfireExpectAnswer()
+	bool _overlapEnabled = true;	// Run _overlap while the frame is on air
+	void (*_overlap)(void *context) = NULL;	// Work for the next frame, see PCD_DesfireRunOverlap()
+	void *_overlapContext = NULL;
+	byte _overlapBackLen = 0;		// Longest answer to the frame _overlap is left for, without CRC_A
+	uint32_t _fwt = DESFIRE_DEFAULT_FWT;	// Frame waiting time of the PICC in the field, us
+
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Helper methods
 	/////////////////////////////////////////////////////////////////////////////////////
+	virtual MFRC522::StatusCode PCD_DesfireTransceive(byte *sendData, byte sendLen, byte *backData, byte *backLen);
+	MFRC522::StatusCode PCD_DesfireExchangeFrame(byte *sendData, byte sendLen, byte *backData, byte *backLen);
+	void PCD_DesfireTuneRF(MFRC522::StatusCode status);
+	void PCD_DesfireLearnCost(byte cmd, uint32_t elapsed, uint32_t frames);
+	void PCD_DesfireExpectAnswer(size_t length, byte frameData);
+	bool PCD_DesfireStartCommand(byte cmd);
+	void PCD_DesfireEndCommand(StatusCode result);
+	void PCD_DesfireRunOverlap(bool onAir);
+	virtual void PCD_DesfireRandom(byte *buffer, byte length);
+	static byte PCD_DesfireFrameHeader(mifare_desfire_tag *tag, byte *buffer);
+	static byte PCD_DesfireFrameHeaderSize(byte pcb);
+	// Largest frame to send, with CRC_A: what the PICC accepts and the frame buffers hold
+	static uint16_t PCD_DesfireSendLimit(mifare_desfire_tag *tag) { return (tag->fsc < DESFIRE_FSD) ? tag->fsc : DESFIRE_FSD; };
+	void MIFARE_DESFIRE_TrackStatus(mifare_desfire_tag *tag, DesfireStatusCode status);
 	StatusCode MIFARE_BlockExchange(mifare_desfire_tag *tag, byte cmd, byte *backData = NULL, byte *backLen = NULL);
 	StatusCode MIFARE_BlockExchangeWithData(mifare_desfire_tag *tag, byte cmd, byte *sendData = NULL, byte *sendLen = NULL, byte *backData = NULL, byte *backLen = NULL);
+	StatusCode MIFARE_BlockExchangeNative(mifare_desfire_tag *tag, byte cmd, byte *sendData, byte *sendLen, byte *backData, byte *backLen);
+	StatusCode MIFARE_BlockExchangeWrapped(mifare_desfire_tag *tag, byte cmd, byte *sendData, byte *sendLen, byte *backData, byte *backLen);
+	// Not inlined, its cipher stays off the stack of exchanges outside AES sessions
+	StatusCode MIFARE_BlockExchangeMACed(mifare_desfire_tag *tag, byte cmd, byte *sendData, byte *sendLen, byte *backData, byte *backLen) __attribute__((noinline));
+	StatusCode MIFARE_BlockExchangeAPDU(mifare_desfire_tag *tag, byte *apdu, byte apduLen, byte *backData, uint16_t *backLen, uint16_t *statusWord);
+	StatusCode MIFARE_BlockExchangeISO(mifare_desfire_tag *tag, byte *apdu, byte apduLen, byte *backData, uint16_t *backLen, uint16_t *statusWord);
+	struct AuthenticationState;
+	static void MIFARE_DESFIRE_AuthenticatePrepare(void *context);
+	static void MIFARE_DESFIRE_AuthenticateExpect(void *context);
+	StatusCode PICC_MifareDesfireCensusWalk(mifare_desfire_tag *tag, mifare_desfire_census_t *census, byte flags);
+	StatusCode PICC_MifareDesfireSyncRecords(mifare_desfire_tag *tag, byte fid, uint32_t recordSize, uint32_t count, const mifare_desfire_file_fingerprint_t *previous, mifare_desfire_file_fingerprint_t *current, mifare_desfire_file_change_t *change, byte *buffer, size_t bufferSize, uint32_t *bytesRead);
+	static uint32_t GetFileSettingsHash(mifare_desfire_file_settings_t *settings);
+	static const __FlashStringHelper *GetPackedName(const byte *codes, byte codeCount, const char *names, byte code);
+
+	// Dump formatting
+	void PICC_DumpMifareDesfireVersionPart(const __FlashStringHelper *title, const uint8_t *part);
+	static void DumpSpaces(byte count);
+	static void DumpTitle(const __FlashStringHelper *title);
+	static void DumpRule(byte indent);
+	static void DumpLabel(byte indent, const __FlashStringHelper *label);
+	static void DumpHexField(byte indent, const __FlashStringHelper *label, byte value, const __FlashStringHelper *name = NULL);
+	static void DumpKeyLabel(byte key);
+	static void DumpStatus(StatusCode code);
+
+	template <typename Command>
+	StatusCode MIFARE_DESFIRE_ReadChained(mifare_desfire_tag *tag, byte fid, uint32_t offset, uint32_t length, byte *backData, size_t *backLen);
+
+	/**
+	 * Appends one [command][length][data] step encoded from args to a compiled layout.
+	 */
+	template <typename Command, typename... Args>
+	bool PICC_MifareDesfireLayoutStep(mifare_desfire_compiled_layout_t *layout, Args... args)
+	{
+		if (layout->size + 2 + Command::request::size > layout->capacity)
+			return false;
+
+		byte *step = layout->frames + layout->size;
+		step[0] = Command::opcode;
+		step[1] = Command::request::size;
+		Command::request::encode(step + 2, args...);
+		layout->size += 2 + Command::request::size;
+		layout->steps++;
+
+		return true;
+	}
+
+	/**
+	 * Encodes the request of a DesfireCommand from args, exchanges it and makes sure a successful
+	 * response carries at least the fixed part of the declared response layout.
+	 */
+	template <typename Command, typename... Args>
+	StatusCode MIFARE_DESFIRE_Exchange(mifare_desfire_tag *tag, byte *backData, byte *backLen, Args... args)
+	{
+		byte buffer[Command::request::size + 1];
+		byte sendLen = Command::request::size;
+
+		Command::request::encode(buffer, args...);
+
+		StatusCode result = MIFARE_BlockExchangeWithData(tag, Command::opcode, buffer, &sendLen, backData, backLen);
+		if (IsStatusCodeOK(result) && backLen != NULL && *backLen < Command::response::size)
+			result.mfrc522 = STATUS_ERROR;
+
+		return result;
+	}
 };
 
 #endif
\ No newline at end of file
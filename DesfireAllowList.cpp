@@ -0,0 +1,96 @@
+#include <DesfireAllowList.h>
+
+DesfireAllowList::DesfireAllowList(const byte *entries, uint16_t count) : _entries(entries), _count(count)
+{
+	if (_count > 0) {
+		_firstKey = ReadKey(0);
+		_lastKey = ReadKey(_count - 1);
+	}
+} // End DesfireAllowList()
+
+/**
+ * Returns the first 4 bytes of an entry as a big-endian integer, the interpolation key.
+ */
+uint32_t DesfireAllowList::ReadKey(uint16_t index)
+{
+	const byte *entry = _entries + (uint32_t)index * MIFARE_UID_BYTES;
+
+	_reads++;
+	return ((uint32_t)pgm_read_byte(entry) << 24) | ((uint32_t)pgm_read_byte(entry + 1) << 16) |
+		((uint32_t)pgm_read_byte(entry + 2) << 8) | (uint32_t)pgm_read_byte(entry + 3);
+} // End ReadKey()
+
+/**
+ * Compares an entry with uid, like memcmp(), and returns its interpolation key in *key.
+ */
+int DesfireAllowList::Compare(uint16_t index, const byte *uid, uint32_t *key)
+{
+	const byte *entry = _entries + (uint32_t)index * MIFARE_UID_BYTES;
+	byte value[MIFARE_UID_BYTES];
+
+	_reads++;
+	memcpy_P(value, entry, MIFARE_UID_BYTES);
+	*key = ((uint32_t)value[0] << 24) | ((uint32_t)value[1] << 16) | ((uint32_t)value[2] << 8) | (uint32_t)value[3];
+
+	return memcmp(value, uid, MIFARE_UID_BYTES);
+} // End Compare()
+
+/**
+ * Looks up a 7 byte UID in the list.
+ *
+ * @return true if the UID is in the list.
+ */
+bool DesfireAllowList::Contains(const byte *uid)
+{
+	uint32_t key = ((uint32_t)uid[0] << 24) | ((uint32_t)uid[1] << 16) | ((uint32_t)uid[2] << 8) | (uint32_t)uid[3];
+	int32_t low = 0;
+	int32_t high = (int32_t)_count - 1;
+	// Range binary search would have left after the same number of probes, plus the slack
+	uint32_t budget = (uint32_t)_count << DESFIRE_ALLOWLIST_SLACK;
+	bool interpolate = true;
+
+	_reads = 0;
+	if (_count == 0 || key < _firstKey || key > _lastKey)
+		return false;
+
+	// Entries at lowIndex/highIndex bound the interpolation, the first and last entries to start with
+	int32_t lowIndex = low;
+	int32_t highIndex = high;
+	uint32_t lowKey = _firstKey;
+	uint32_t highKey = _lastKey;
+
+	while (low <= high) {
+		int32_t middle;
+		uint32_t middleKey;
+
+		if (interpolate && highKey > lowKey) {
+			middle = lowIndex + (int32_t)((uint64_t)(key - lowKey) * (uint32_t)(highIndex - lowIndex) / (highKey - lowKey));
+			if (middle < low)
+				middle = low;
+			if (middle > high)
+				middle = high;
+		} else {
+			middle = low + (high - low) / 2;
+		}
+
+		int comparison = Compare(middle, uid, &middleKey);
+		if (comparison == 0)
+			return true;
+		if (comparison < 0) {
+			low = middle + 1;
+			lowIndex = middle;
+			lowKey = middleKey;
+		} else {
+			high = middle - 1;
+			highIndex = middle;
+			highKey = middleKey;
+		}
+
+		budget >>= 1;
+		// Interpolation fell behind binary search, bisect the rest
+		if ((uint32_t)(high - low + 1) > budget)
+			interpolate = false;
+	}
+
+	return false;
+} // End Contains()
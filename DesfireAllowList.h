@@ -0,0 +1,62 @@
+#ifndef DESFIRE_ALLOWLIST_h
+#define DESFIRE_ALLOWLIST_h
+
+#include <Arduino.h>
+#include "Desfire.h"
+
+/* --------------------------------------
+* UID Allow-List
+* --------------------------------------
+* Read-only list of 7 byte UIDs (or credential IDs padded to 7 bytes) kept in flash, sorted in
+* ascending byte order. Generate it with tools/allowlist.py, which writes a header such as:
+*
+*   const byte doors_entries[] PROGMEM = { ... };
+*   const uint16_t doors_count = 4000;
+*
+* and query it with:
+*
+*   DesfireAllowList doors(doors_entries, doors_count);
+*   if (doors.Contains(versionInfo.uid)) ...
+*
+* Lookups use interpolation search (UIDs are close to uniformly distributed) while every probe
+* keeps up with binary search, halving the range left, give or take DESFIRE_ALLOWLIST_SLACK
+* probes. Once interpolation falls behind the range is bisected, so a lookup never reads more
+* than ceil(log2(count + 1)) + 1 + DESFIRE_ALLOWLIST_SLACK entries. The keys of the first and
+* last entries are read once, by the constructor.
+*
+* On AVR pgm_read_byte() only reaches the lower 64K of flash and an object cannot exceed 32767
+* bytes, a list holds at most DESFIRE_ALLOWLIST_MAX_COUNT (4681) UIDs and the generated header
+* asserts it. The linker places PROGMEM data before the code, so such a list stays in the lower
+* 64K unless other PROGMEM data push it out. Tens of thousands of UIDs take a 32 bit board.
+*/
+#ifndef DESFIRE_ALLOWLIST_SLACK
+#define DESFIRE_ALLOWLIST_SLACK      1  /* interpolation probes allowed behind binary search */
+#endif
+#ifdef __AVR__
+#define DESFIRE_ALLOWLIST_MAX_COUNT  (32767 / MIFARE_UID_BYTES)
+#else
+#define DESFIRE_ALLOWLIST_MAX_COUNT  0xFFFF
+#endif
+
+class DesfireAllowList {
+public:
+	DesfireAllowList(const byte *entries, uint16_t count);
+
+	bool Contains(const byte *uid);
+
+	uint16_t GetCount() { return _count; };
+	// Number of entries read from flash by the last lookup
+	byte GetLastReadCount() { return _reads; };
+
+protected:
+	const byte *_entries;
+	uint16_t _count;
+	byte _reads = 0;
+	uint32_t _firstKey = 0;
+	uint32_t _lastKey = 0;
+
+	uint32_t ReadKey(uint16_t index);
+	int Compare(uint16_t index, const byte *uid, uint32_t *key);
+};
+
+#endif
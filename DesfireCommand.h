@@ -0,0 +1,144 @@
+#ifndef DESFIRE_COMMAND_h
+#define DESFIRE_COMMAND_h
+
+#include <Arduino.h>
+
+/* --------------------------------------
+* DESFire Command Descriptors
+* --------------------------------------
+* Each command is declared once with its opcode, the fields of the request and the fields of
+* the response. Sizes and field offsets are resolved at compile time and all encoders and
+* decoders are inlined, so no tables end up in flash or RAM.
+*
+*   typedef DesfireCommand<0x6C, DesfireLayout<DesfireU8>, DesfireLayout<DesfireS32> > GetValueCommand;
+*
+*   byte buffer[GetValueCommand::request::size];
+*   GetValueCommand::request::encode(buffer, fid);
+*   int32_t value = GetValueCommand::response::get<0>(buffer);
+*/
+
+// Little-endian integer of N bytes (DESFire sends all multi-byte values LSB first)
+template <byte N>
+struct DesfireLE {
+	static inline uint32_t decode(const byte *buffer) {
+		return (uint32_t)buffer[0] | (DesfireLE<N - 1>::decode(buffer + 1) << 8);
+	}
+	static inline void encode(byte *buffer, uint32_t value) {
+		buffer[0] = (byte)value;
+		DesfireLE<N - 1>::encode(buffer + 1, value >> 8);
+	}
+};
+
+template <>
+struct DesfireLE<0> {
+	static inline uint32_t decode(const byte *) { return 0; }
+	static inline void encode(byte *, uint32_t) {}
+};
+
+// Integer field of N bytes on the wire, T in memory
+template <byte N, typename T>
+struct DesfireField {
+	static_assert(N > 0 && N <= 4, "DESFire integer fields are 1 to 4 bytes long");
+	typedef T type;
+	static const byte size = N;
+
+	static inline T decode(const byte *buffer) { return (T)DesfireLE<N>::decode(buffer); }
+	static inline void encode(byte *buffer, T value) { DesfireLE<N>::encode(buffer, (uint32_t)value); }
+};
+
+// Opaque field of N bytes copied as is (AIDs, UIDs, keys...)
+template <byte N>
+struct DesfireBytes {
+	typedef const byte *type;
+	static const byte size = N;
+
+	static inline const byte *decode(const byte *buffer) { return buffer; }
+	static inline void encode(byte *buffer, const byte *value) { memcpy(buffer, value, N); }
+};
+
+typedef DesfireField<1, byte>     DesfireU8;
+typedef DesfireField<2, uint16_t> DesfireU16;
+typedef DesfireField<3, uint32_t> DesfireU24;
+typedef DesfireField<4, uint32_t> DesfireU32;
+typedef DesfireField<4, int32_t>  DesfireS32;
+typedef DesfireBytes<3>           DesfireAID;
+
+// Sequence of fields laid out back to back
+template <typename... Fields>
+struct DesfireLayout;
+
+template <>
+struct DesfireLayout<> {
+	static const byte size = 0;
+	static inline void encode(byte *) {}
+};
+
+template <typename First, typename... Rest>
+struct DesfireLayout<First, Rest...> {
+	typedef DesfireLayout<Rest...> rest;
+	static const byte size = First::size + rest::size;
+
+	// Type and byte offset of field I
+	template <byte I, bool Last = (I == 0)>
+	struct field {
+		typedef typename rest::template field<I - 1>::type type;
+		static const byte offset = First::size + rest::template field<I - 1>::offset;
+	};
+	template <byte I>
+	struct field<I, true> {
+		typedef First type;
+		static const byte offset = 0;
+	};
+
+	static inline void encode(byte *buffer, typename First::type value, typename Rest::type... values) {
+		First::encode(buffer, value);
+		rest::encode(buffer + First::size, values...);
+	}
+
+	template <byte I>
+	static inline typename field<I>::type::type get(const byte *buffer) {
+		return field<I>::type::decode(buffer + field<I>::offset);
+	}
+};
+
+// A DESFire native command: opcode, request fields and (fixed part of the) response fields
+template <byte Opcode, typename Request, typename Response>
+struct DesfireCommand {
+	// PCB + CID + command + data + CRC_A must fit the smallest FIFO sized frame
+	static_assert(Request::size + 5 <= 64, "DESFire command does not fit in a single frame");
+
+	static const byte opcode = Opcode;
+	typedef Request request;
+	typedef Response response;
+};
+
+/* --------------------------------------
+* DESFire Commands
+* --------------------------------------
+*/
+typedef DesfireCommand<0x5A, DesfireLayout<DesfireAID>, DesfireLayout<> > DesfireSelectApplicationCommand;
+typedef DesfireCommand<0x45, DesfireLayout<>, DesfireLayout<DesfireU8, DesfireU8> > DesfireGetKeySettingsCommand;
+typedef DesfireCommand<0x64, DesfireLayout<DesfireU8>, DesfireLayout<DesfireU8> > DesfireGetKeyVersionCommand;
+typedef DesfireCommand<0x6E, DesfireLayout<>, DesfireLayout<DesfireU24> > DesfireGetFreeMemoryCommand;
+typedef DesfireCommand<0x6D, DesfireLayout<>, DesfireLayout<DesfireAID, DesfireU16> > DesfireGetDFNamesCommand;
+typedef DesfireCommand<0x6C, DesfireLayout<DesfireU8>, DesfireLayout<DesfireS32> > DesfireGetValueCommand;
+typedef DesfireCommand<0xBD, DesfireLayout<DesfireU8, DesfireU24, DesfireU24>, DesfireLayout<> > DesfireReadDataCommand;
+typedef DesfireCommand<0xBB, DesfireLayout<DesfireU8, DesfireU24, DesfireU24>, DesfireLayout<> > DesfireReadRecordsCommand;
+
+// Personalization, file creation commands share FileNo + CommSett + AccessRights
+typedef DesfireCommand<0xCA, DesfireLayout<DesfireAID, DesfireU8, DesfireU8>, DesfireLayout<> > DesfireCreateApplicationCommand;
+typedef DesfireCommand<0xDA, DesfireLayout<DesfireAID>, DesfireLayout<> > DesfireDeleteApplicationCommand;
+typedef DesfireCommand<0xFC, DesfireLayout<>, DesfireLayout<> > DesfireFormatPICCCommand;
+typedef DesfireCommand<0xCD, DesfireLayout<DesfireU8, DesfireU8, DesfireU16, DesfireU24>, DesfireLayout<> > DesfireCreateStdDataFileCommand;
+typedef DesfireCommand<0xCB, DesfireLayout<DesfireU8, DesfireU8, DesfireU16, DesfireU24>, DesfireLayout<> > DesfireCreateBackupDataFileCommand;
+typedef DesfireCommand<0xCC, DesfireLayout<DesfireU8, DesfireU8, DesfireU16, DesfireS32, DesfireS32, DesfireS32, DesfireU8>, DesfireLayout<> > DesfireCreateValueFileCommand;
+typedef DesfireCommand<0xC1, DesfireLayout<DesfireU8, DesfireU8, DesfireU16, DesfireU24, DesfireU24>, DesfireLayout<> > DesfireCreateLinearRecordFileCommand;
+typedef DesfireCommand<0xC0, DesfireLayout<DesfireU8, DesfireU8, DesfireU16, DesfireU24, DesfireU24>, DesfireLayout<> > DesfireCreateCyclicRecordFileCommand;
+
+// GetFileSettings: common header followed by the file type specific part
+typedef DesfireCommand<0xF5, DesfireLayout<DesfireU8>, DesfireLayout<DesfireU8, DesfireU8, DesfireU16> > DesfireGetFileSettingsCommand;
+typedef DesfireLayout<DesfireU24> DesfireDataFileSettings;
+typedef DesfireLayout<DesfireS32, DesfireS32, DesfireS32, DesfireU8> DesfireValueFileSettings;
+typedef DesfireLayout<DesfireU24, DesfireU24, DesfireU24> DesfireRecordFileSettings;
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef DESFIRE_CRYPTO_h
+#define DESFIRE_CRYPTO_h
+
+#include <Arduino.h>
+
+/* --------------------------------------
+* DESFire Crypto
+* --------------------------------------
+* AES-128 block cipher modes used by DESFire EV1 and later: CBC for authentication and
+* enciphered communication, CMAC for MACed communication. The block cipher itself is a
+* backend chosen at compile time, DesfireCipher<Backend> calls it directly so nothing goes
+* through a virtual call:
+*
+*   DesfireAES cipher;                        // DesfireCipher<DESFIRE_AES_BACKEND>
+*   cipher.SetKey(sessionKey);
+*   cipher.CMAC(data, length, iv);            // iv becomes the CMAC, as DESFire chains it
+*
+* A backend is a class with SetKey(const byte *key), Encrypt(byte *block) and
+* Decrypt(byte *block) working on 16 byte blocks in place. This file ships:
+*   DesfireSoftwareAES  portable byte oriented AES, S-boxes in PROGMEM (any board)
+*   DesfireAESNI        x86 AES-NI instructions (hosts built with -maes)
+*
+* DESFIRE_AES_BACKEND defaults to DesfireAESNI when the compiler targets AES-NI and to
+* DesfireSoftwareAES otherwise. Define it before including this file to plug in another
+* backend, such as the AES peripheral of the board.
+*/
+
+// Portable AES-128, about 200 bytes of RAM for both key schedules
+class DesfireSoftwareAES {
+public:
+	void SetKey(const byte *key);
+	void Encrypt(byte *block) const;
+	void Decrypt(byte *block) const;
+
+protected:
+	byte _roundKeys[176];
+
+	static inline byte XTime(byte value) { return (value << 1) ^ ((value & 0x80) ? 0x1B : 0x00); }
+	static void MixColumns(byte *state);
+};
+
+#if defined(__AES__) && defined(__SSE2__) && !defined(DESFIRE_NO_AESNI)
+#define DESFIRE_HAVE_AESNI
+#include <wmmintrin.h>
+
+// AES-128 with the x86 AES-NI instructions
+class DesfireAESNI {
+public:
+	void SetKey(const byte *key) {
+		__m128i roundKey = _mm_loadu_si128((const __m128i *)key);
+
+		_encrypt[0] = roundKey;
+		// The round constant of aeskeygenassist must be an immediate
+		_encrypt[1] = roundKey = Expand(roundKey, _mm_aeskeygenassist_si128(roundKey, 0x01));
+		_encrypt[2] = roundKey = Expand(roundKey, _mm_aeskeygenassist_si128(roundKey, 0x02));
+		_encrypt[3] = roundKey = Expand(roundKey, _mm_aeskeygenassist_si128(roundKey, 0x04));
+		_encrypt[4] = roundKey = Expand(roundKey, _mm_aeskeygenassist_si128(roundKey, 0x08));
+		_encrypt[5] = roundKey = Expand(roundKey, _mm_aeskeygenassist_si128(roundKey, 0x10));
+		_encrypt[6] = roundKey = Expand(roundKey, _mm_aeskeygenassist_si128(roundKey, 0x20));
+		_encrypt[7] = roundKey = Expand(roundKey, _mm_aeskeygenassist_si128(roundKey, 0x40));
+		_encrypt[8] = roundKey = Expand(roundKey, _mm_aeskeygenassist_si128(roundKey, 0x80));
+		_encrypt[9] = roundKey = Expand(roundKey, _mm_aeskeygenassist_si128(roundKey, 0x1B));
+		_encrypt[10] = Expand(roundKey, _mm_aeskeygenassist_si128(roundKey, 0x36));
+
+		// Equivalent inverse cipher: reversed round keys, InvMixColumns applied to the inner ones
+		_decrypt[0] = _encrypt[10];
+		for (byte i = 1; i < 10; i++)
+			_decrypt[i] = _mm_aesimc_si128(_encrypt[10 - i]);
+		_decrypt[10] = _encrypt[0];
+	}
+
+	inline void Encrypt(byte *block) const {
+		__m128i state = _mm_xor_si128(_mm_loadu_si128((const __m128i *)block), _encrypt[0]);
+		for (byte i = 1; i < 10; i++)
+			state = _mm_aesenc_si128(state, _encrypt[i]);
+		_mm_storeu_si128((__m128i *)block, _mm_aesenclast_si128(state, _encrypt[10]));
+	}
+
+	inline void Decrypt(byte *block) const {
+		__m128i state = _mm_xor_si128(_mm_loadu_si128((const __m128i *)block), _decrypt[0]);
+		for (byte i = 1; i < 10; i++)
+			state = _mm_aesdec_si128(state, _decrypt[i]);
+		_mm_storeu_si128((__m128i *)block, _mm_aesdeclast_si128(state, _decrypt[10]));
+	}
+
+protected:
+	__m128i _encrypt[11];
+	__m128i _decrypt[11];
+
+	static inline __m128i Expand(__m128i key, __m128i assist) {
+		assist = _mm_shuffle_epi32(assist, 0xFF);
+		key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+		key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+		key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+		return _mm_xor_si128(key, assist);
+	}
+};
+#endif
+
+#ifndef DESFIRE_AES_BACKEND
+#ifdef DESFIRE_HAVE_AESNI
+#define DESFIRE_AES_BACKEND DesfireAESNI
+#else
+#define DESFIRE_AES_BACKEND DesfireSoftwareAES
+#endif
+#endif
+
+// Block cipher modes over a backend
+template <class Backend>
+class DesfireCipher {
+public:
+	static const byte blockSize = 16;
+
+	// Sets the key and derives the CMAC subkeys
+	void SetKey(const byte *key) {
+		byte carry;
+
+		_backend.SetKey(key);
+
+		// K1 = L << 1 and K2 = K1 << 1 with L = E(0), reduced by x^128 + x^7 + x^2 + x + 1
+		memset(_k1, 0, blockSize);
+		_backend.Encrypt(_k1);
+		carry = ShiftLeft(_k1);
+		_k1[blockSize - 1] ^= carry ? 0x87 : 0x00;
+		memcpy(_k2, _k1, blockSize);
+		carry = ShiftLeft(_k2);
+		_k2[blockSize - 1] ^= carry ? 0x87 : 0x00;
+	}
+
+	void EncryptBlock(byte *block) const { _backend.Encrypt(block); }
+	void DecryptBlock(byte *block) const { _backend.Decrypt(block); }
+
+	// Enciphers length bytes (a multiple of blockSize) in place, iv is chained to the last block
+	void EncryptCBC(byte *data, size_t length, byte *iv) const {
+		for (size_t offset = 0; offset + blockSize <= length; offset += blockSize) {
+			Xor(data + offset, iv);
+			_backend.Encrypt(data + offset);
+			memcpy(iv, data + offset, blockSize);
+		}
+	}
+
+	// Deciphers length bytes (a multiple of blockSize) in place, iv is chained to the last block
+	void DecryptCBC(byte *data, size_t length, byte *iv) const {
+		byte cipherText[blockSize];
+
+		for (size_t offset = 0; offset + blockSize <= length; offset += blockSize) {
+			memcpy(cipherText, data + offset, blockSize);
+			_backend.Decrypt(data + offset);
+			Xor(data + offset, iv);
+			memcpy(iv, cipherText, blockSize);
+		}
+	}
+
+	/**
+	 * CMAC (NIST SP 800-38B) of length bytes, chained from iv instead of zero the way DESFire
+	 * does it: iv receives the full CMAC, DESFire sends its first 8 bytes as the MAC.
+	 */
+	void CMAC(const byte *data, size_t length, byte *iv) const {
+		byte block[blockSize];
+		byte blockLength = 0;
+
+		CMACUpdate(data, length, iv, block, &blockLength);
+		CMACFinal(iv, block, blockLength);
+	}
+
+	/**
+	 * CMAC of a message fed in pieces, such as an answer spread over frames. A complete block
+	 * goes through CBC into iv once more data follows it, block keeps the last blockLength bytes
+	 * (up to a whole block) for CMACFinal(). Start with blockLength 0.
+	 */
+	void CMACUpdate(const byte *data, size_t length, byte *iv, byte *block, byte *blockLength) const {
+		while (length > 0) {
+			if (*blockLength == blockSize) {
+				Xor(iv, block);
+				_backend.Encrypt(iv);
+				*blockLength = 0;
+			}
+
+			byte chunk = blockSize - *blockLength;
+			if (chunk > length)
+				chunk = length;
+			memcpy(block + *blockLength, data, chunk);
+			*blockLength += chunk;
+			data += chunk;
+			length -= chunk;
+		}
+	}
+
+	// Ends a CMACUpdate() message, iv receives the CMAC
+	void CMACFinal(byte *iv, byte *block, byte blockLength) const {
+		// A complete last block is masked with K1, a padded one (0x80 0x00...) with K2
+		if (blockLength == blockSize) {
+			Xor(block, _k1);
+		}
+		else {
+			memset(block + blockLength, 0, blockSize - blockLength);
+			block[blockLength] = 0x80;
+			Xor(block, _k2);
+		}
+		Xor(iv, block);
+		_backend.Encrypt(iv);
+	}
+
+protected:
+	Backend _backend;
+	byte _k1[blockSize];
+	byte _k2[blockSize];
+
+	static inline void Xor(byte *target, const byte *value) {
+		for (byte i = 0; i < blockSize; i++)
+			target[i] ^= value[i];
+	}
+
+	// Shifts a block left by one bit, returns the bit shifted out
+	static inline byte ShiftLeft(byte *block) {
+		byte carry = 0;
+		for (int8_t i = blockSize - 1; i >= 0; i--) {
+			byte next = block[i] >> 7;
+			block[i] = (block[i] << 1) | carry;
+			carry = next;
+		}
+		return carry;
+	}
+};
+
+typedef DesfireCipher<DESFIRE_AES_BACKEND> DesfireAES;
+
+#endif
@@ -0,0 +1,214 @@
+#include <DesfireKeyRollover.h>
+
+static_assert(DESFIRE_ROLLOVER_MAX_RULES <= 16, "cache_t::known has one bit per rule");
+
+/**
+ * Adds a key slot to the policy, or moves an existing slot to a new target version. Rules of
+ * the same application are kept together so Process() selects every application once.
+ *
+ * @return false if the policy is full.
+ */
+bool DesfireKeyRollover::AddRule(DESFire::mifare_desfire_aid_t *aid, byte key, byte version, byte changeKey)
+{
+	byte position = _ruleCount;
+
+	for (byte i = 0; i < _ruleCount; i++) {
+		if (memcmp(_rules[i].aid.data, aid->data, MIFARE_AID_SIZE) != 0)
+			continue;
+		if (_rules[i].key == key) {
+			_rules[i].version = version;
+			_rules[i].change_key = changeKey;
+			return true;
+		}
+		position = i + 1;
+	}
+
+	if (_ruleCount >= DESFIRE_ROLLOVER_MAX_RULES)
+		return false;
+
+	// Versions cached for the rules after position move along with them
+	for (byte i = 0; i < _cacheCount; i++) {
+		cache_t *entry = &_cache[i];
+		uint16_t low = entry->known & ((1 << position) - 1);
+		memmove(entry->versions + position + 1, entry->versions + position, _ruleCount - position);
+		entry->known = low | ((entry->known & ~((1 << position) - 1)) << 1);
+	}
+	memmove(_rules + position + 1, _rules + position, (_ruleCount - position) * sizeof(rule_t));
+
+	_rules[position].aid = *aid;
+	_rules[position].key = key;
+	_rules[position].version = version;
+	_rules[position].change_key = changeKey;
+	_ruleCount++;
+
+	return true;
+} // End AddRule()
+
+DesfireKeyRollover::cache_t *DesfireKeyRollover::Find(const byte *uid)
+{
+	for (byte i = 0; i < _cacheCount; i++) {
+		if (memcmp(_cache[i].uid, uid, MIFARE_UID_BYTES) == 0)
+			return &_cache[i];
+	}
+
+	return NULL;
+} // End Find()
+
+/**
+ * Finds the cache entry of uid and moves it to the front, the least recently tapped card
+ * makes room for a new one.
+ */
+DesfireKeyRollover::cache_t *DesfireKeyRollover::Lookup(const byte *uid)
+{
+	cache_t *found = Find(uid);
+	cache_t *entry = DESFire::MoveToFront(_cache, &_cacheCount, DESFIRE_ROLLOVER_CACHE_SIZE, found);
+
+	if (found == NULL) {
+		memcpy(entry->uid, uid, MIFARE_UID_BYTES);
+		entry->known = 0;
+	}
+
+	return entry;
+} // End Lookup()
+
+/**
+ * Forgets the key versions of a card, the next tap queries all its slots again.
+ */
+void DesfireKeyRollover::Forget(const byte *uid)
+{
+	cache_t *found = Find(uid);
+
+	if (found != NULL) {
+		memmove(found, found + 1, (_cache + _cacheCount - found - 1) * sizeof(cache_t));
+		_cacheCount--;
+	}
+} // End Forget()
+
+bool DesfireKeyRollover::IsCurrent(cache_t *entry, byte rule)
+{
+	return (entry->known & (1 << rule)) && entry->versions[rule] == _rules[rule].version;
+} // End IsCurrent()
+
+/**
+ * @return true if every slot of the policy is known to be current for uid, a tap of that card
+ *         would not cost any frame.
+ */
+bool DesfireKeyRollover::IsCurrent(const byte *uid)
+{
+	cache_t *entry = Find(uid);
+	if (entry == NULL)
+		return false;
+
+	for (byte i = 0; i < _ruleCount; i++) {
+		if (!IsCurrent(entry, i))
+			return false;
+	}
+
+	return true;
+} // End IsCurrent()
+
+/**
+ * Brings the key slots of the policy to their target version on the PICC in the field, the
+ * card is identified by reader->uid.
+ *
+ * A failed slot stays stale and is retried on the next tap, the other slots are still
+ * processed unless the PICC stopped answering. Slots the cryptogram callback refuses fail
+ * with STATUS_INVALID. GetLastReport() tells what the tap cost.
+ *
+ * @return The status of the first failed slot, or success.
+ */
+DESFire::StatusCode DesfireKeyRollover::Process(DESFire *reader, DESFire::mifare_desfire_tag *tag, DESFire::authenticate_t authenticate, cryptogram_t cryptogram, void *context)
+{
+	DESFire::StatusCode result;
+	uint32_t exchanges = reader->GetExchangeCount();
+	unsigned long started = micros();
+	byte uid[MIFARE_UID_BYTES];
+
+	result.mfrc522 = MFRC522::STATUS_OK;
+	result.desfire = DESFire::MF_OPERATION_OK;
+	memset(&_report, 0, sizeof(report_t));
+
+	// Single and double size UIDs are cached padded with zeros
+	memset(uid, 0, MIFARE_UID_BYTES);
+	memcpy(uid, reader->uid.uidByte, (reader->uid.size < MIFARE_UID_BYTES) ? reader->uid.size : MIFARE_UID_BYTES);
+	cache_t *entry = Lookup(uid);
+
+	for (byte i = 0; i < _ruleCount; i++) {
+		if (IsCurrent(entry, i)) {
+			_report.cached++;
+			continue;
+		}
+
+		DESFire::StatusCode response = Roll(reader, tag, entry, i, authenticate, cryptogram, context);
+		if (!reader->IsStatusCodeOK(response)) {
+			_report.failed++;
+			if (reader->IsStatusCodeOK(result))
+				result = response;
+			// The PICC left the field or the frame got lost, leave the remaining slots for the next tap
+			if (response.mfrc522 != MFRC522::STATUS_OK && response.mfrc522 != MFRC522::STATUS_INVALID)
+				break;
+		}
+	}
+
+	_report.exchanges = reader->GetExchangeCount() - exchanges;
+	_report.elapsed = micros() - started;
+
+	return result;
+} // End Process()
+
+/**
+ * Queries one key slot and changes the key when its version is stale.
+ */
+DESFire::StatusCode DesfireKeyRollover::Roll(DESFire *reader, DESFire::mifare_desfire_tag *tag, cache_t *entry, byte rule, DESFire::authenticate_t authenticate, cryptogram_t cryptogram, void *context)
+{
+	DESFire::StatusCode response;
+	rule_t *slot = &_rules[rule];
+	byte version;
+
+	response = reader->MIFARE_DESFIRE_SelectApplication(tag, &(slot->aid));
+	if (!reader->IsStatusCodeOK(response))
+		return response;
+
+	response = reader->MIFARE_DESFIRE_GetKeyVersion(tag, slot->key, &version);
+	_report.queried++;
+	if (!reader->IsStatusCodeOK(response))
+		return response;
+
+	entry->versions[rule] = version;
+	entry->known |= (1 << rule);
+	if (version == slot->version)
+		return response;
+
+	if (!tag->IsAuthenticated(slot->change_key)) {
+		if (authenticate != NULL) {
+			response = authenticate(reader, tag, &(slot->aid), slot->change_key, context);
+		}
+		else {
+			response.mfrc522 = MFRC522::STATUS_OK;
+			response.desfire = DESFire::MF_AUTHENTICATION_ERROR;
+		}
+		if (!reader->IsStatusCodeOK(response))
+			return response;
+		tag->authenticated_key = slot->change_key;
+	}
+
+	byte buffer[40];
+	byte bufferSize = sizeof(buffer);
+	if (cryptogram == NULL || !cryptogram(tag, slot, version, buffer, &bufferSize, context)) {
+		response.mfrc522 = MFRC522::STATUS_INVALID;
+		return response;
+	}
+
+	response = reader->MIFARE_DESFIRE_ChangeKey(tag, slot->key, buffer, bufferSize);
+	if (!reader->IsStatusCodeOK(response))
+		return response;
+
+	entry->versions[rule] = slot->version;
+	_report.changed++;
+
+	// Changing the key of the authentication ends it
+	if (slot->key == slot->change_key)
+		tag->ResetAuthentication();
+
+	return response;
+} // End Roll()
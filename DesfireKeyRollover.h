@@ -0,0 +1,90 @@
+#ifndef DESFIRE_KEY_ROLLOVER_h
+#define DESFIRE_KEY_ROLLOVER_h
+
+#include <Arduino.h>
+#include "Desfire.h"
+
+/* --------------------------------------
+* Key Rollover
+* --------------------------------------
+* Moves the keys of a fleet of cards to new versions, one card at a time as they are tapped.
+* A policy names the key slots to roll and their target version:
+*
+*   DesfireKeyRollover rollover;
+*   rollover.AddRule(&ticketing, 0x01, 0x02, 0x00);   // key 1 to version 2, changed with key 0
+*
+*   // In the normal transaction, after the application work is done:
+*   rollover.Process(&mfrc522, &tag, authenticate, cryptogram, NULL);
+*
+* Only the named slots are queried with GetKeyVersion, and versions already known to be
+* current for the UID are not queried at all: a card that was rolled (or checked) on a
+* previous tap costs no extra frame. Process() runs inside the caller's session, so an
+* application the transaction already selected and a key it already authenticated with are
+* reused as is.
+*
+* The authenticate callback opens the session the ChangeKey needs, with
+* MIFARE_DESFIRE_AuthenticateAES() for AES keys, and the cryptogram callback builds the ChangeKey
+* cryptogram from its session key (see MIFARE_DESFIRE_ChangeKey()). The cache is not persistent,
+* and a key changed by another terminal is only noticed once the UID drops out of the cache.
+*/
+#ifndef DESFIRE_ROLLOVER_MAX_RULES
+#define DESFIRE_ROLLOVER_MAX_RULES  8   /* key slots in a policy */
+#endif
+#ifndef DESFIRE_ROLLOVER_CACHE_SIZE
+#define DESFIRE_ROLLOVER_CACHE_SIZE 16  /* cards whose key versions are remembered */
+#endif
+
+class DesfireKeyRollover {
+public:
+	// A struct used for passing one key slot of a rollover policy
+	typedef struct {
+		DESFire::mifare_desfire_aid_t aid;
+		uint8_t key;                          /* key to roll */
+		uint8_t version;                      /* target version */
+		uint8_t change_key;                   /* key authenticated to run ChangeKey */
+	} rule_t;
+
+	// A struct used for passing the overhead of the last tap
+	typedef struct {
+		uint8_t queried;                      /* GetKeyVersion sent */
+		uint8_t cached;                       /* slots known to be current, not queried */
+		uint8_t changed;                      /* keys moved to their target version */
+		uint8_t failed;                       /* slots left stale */
+		uint16_t exchanges;                   /* frames exchanged by Process() */
+		uint32_t elapsed;                     /* microseconds spent in Process() */
+	} report_t;
+
+	// Builds the ChangeKey cryptogram moving rule->key from version to rule->version, false to skip the slot
+	typedef bool (*cryptogram_t)(DESFire::mifare_desfire_tag *tag, const rule_t *rule, byte version, byte *cryptogram, byte *cryptogramLength, void *context);
+
+	bool AddRule(DESFire::mifare_desfire_aid_t *aid, byte key, byte version, byte changeKey);
+	void ClearRules() { _ruleCount = 0; };
+	void ClearCache() { _cacheCount = 0; };
+	void Forget(const byte *uid);
+
+	DESFire::StatusCode Process(DESFire *reader, DESFire::mifare_desfire_tag *tag, DESFire::authenticate_t authenticate, cryptogram_t cryptogram, void *context = NULL);
+
+	bool IsCurrent(const byte *uid);
+	report_t *GetLastReport() { return &_report; };
+
+protected:
+	// Key versions known for one UID, most recently tapped first
+	typedef struct {
+		byte uid[MIFARE_UID_BYTES];
+		byte versions[DESFIRE_ROLLOVER_MAX_RULES];
+		uint16_t known;                       /* bit n set when versions[n] is known */
+	} cache_t;
+
+	rule_t _rules[DESFIRE_ROLLOVER_MAX_RULES];
+	byte _ruleCount = 0;
+	cache_t _cache[DESFIRE_ROLLOVER_CACHE_SIZE];
+	byte _cacheCount = 0;
+	report_t _report;
+
+	cache_t *Find(const byte *uid);
+	cache_t *Lookup(const byte *uid);
+	bool IsCurrent(cache_t *entry, byte rule);
+	DESFire::StatusCode Roll(DESFire *reader, DESFire::mifare_desfire_tag *tag, cache_t *entry, byte rule, DESFire::authenticate_t authenticate, cryptogram_t cryptogram, void *context);
+};
+
+#endif
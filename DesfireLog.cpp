@@ -0,0 +1,154 @@
+#include <DesfireLog.h>
+
+/**
+ * CRC_A (ISO/IEC 14443-3) over the record, without the crc field.
+ */
+uint16_t DesfireLog::CalculateCRC(const record_t *record)
+{
+	const byte *data = (const byte *)record;
+	uint16_t crc = 0x6363;
+
+	for (uint16_t i = 0; i < offsetof(record_t, crc); i++) {
+		crc ^= data[i];
+		for (byte bit = 0; bit < 8; bit++)
+			crc = (crc & 0x0001) ? (crc >> 1) ^ 0x8408 : (crc >> 1);
+	}
+
+	return crc;
+} // End CalculateCRC()
+
+bool DesfireLog::ReadSlot(uint32_t slot, record_t *record)
+{
+	_storage->Read(slot * sizeof(record_t), (byte *)record, sizeof(record_t));
+
+	return record->crc == CalculateCRC(record) && (record->sequence % _slots) == slot;
+} // End ReadSlot()
+
+/**
+ * Recovers the log position from storage, call once at start-up.
+ *
+ * @return false if the storage cannot hold a single sector of records.
+ */
+bool DesfireLog::Begin()
+{
+	record_t record;
+	bool found = false;
+	uint16_t sectorSize = _storage->GetSectorSize();
+
+	// Records never straddle sectors
+	_slotsPerSector = (sectorSize > sizeof(record_t)) ? sectorSize / sizeof(record_t) : 1;
+	if (sectorSize > sizeof(record_t))
+		_slots = (_storage->GetSize() / sectorSize) * _slotsPerSector;
+	else
+		_slots = _storage->GetSize() / sizeof(record_t);
+
+	if (_slots < _slotsPerSector || _slots == 0)
+		return false;
+
+	_next = 0;
+	for (uint32_t slot = 0; slot < _slots; slot++) {
+		if (ReadSlot(slot, &record) && (!found || record.sequence >= _next)) {
+			_next = record.sequence + 1;
+			found = true;
+		}
+	}
+
+	// Oldest readable record, the sector being written next may already be erased
+	_first = (_next > _slots) ? _next - _slots : 0;
+	while (_first < _next && !ReadSlot(_first % _slots, &record))
+		_first++;
+
+	_stored = _next;
+	_acknowledged = _first;
+	_pending = 0;
+
+	return true;
+} // End Begin()
+
+/**
+ * Appends a record to the RAM buffer. Sets its sequence number and CRC.
+ * Runs in constant time and never touches the storage.
+ *
+ * @return false if the RAM buffer is full, call Flush() first.
+ */
+bool DesfireLog::Append(record_t *record)
+{
+	if (_pending >= DESFIRE_LOG_RAM_RECORDS)
+		return false;
+
+	record->sequence = _next++;
+	record->crc = CalculateCRC(record);
+	_ram[record->sequence % DESFIRE_LOG_RAM_RECORDS] = *record;
+	_pending++;
+
+	return true;
+} // End Append()
+
+/**
+ * Writes up to maxRecords pending records to storage, meant to be called from idle time.
+ *
+ * @return the number of records written.
+ */
+byte DesfireLog::Flush(byte maxRecords)
+{
+	byte written = 0;
+
+	while (_pending > 0 && written < maxRecords) {
+		uint32_t slot = _stored % _slots;
+
+		// Never overwrite records the back-office has not acknowledged
+		if (_stored - _acknowledged >= _slots)
+			break;
+
+		// Entering a new sector: its oldest records are lost
+		if ((slot % _slotsPerSector) == 0) {
+			uint32_t sectorEnd = _stored + _slotsPerSector;
+			if (sectorEnd > _slots && sectorEnd - _slots > _acknowledged)
+				break;
+			_storage->EraseSector(slot * sizeof(record_t));
+			if (sectorEnd > _slots && sectorEnd - _slots > _first)
+				_first = sectorEnd - _slots;
+		}
+
+		record_t *record = &(_ram[_stored % DESFIRE_LOG_RAM_RECORDS]);
+		_storage->Write(slot * sizeof(record_t), (const byte *)record, sizeof(record_t));
+
+		_stored++;
+		_pending--;
+		written++;
+	}
+
+	if (written > 0)
+		_storage->Commit();
+
+	return written;
+} // End Flush()
+
+/**
+ * Reads a record back, from RAM if it has not been flushed yet.
+ *
+ * @return false if the record has been overwritten, is not written yet or is corrupt.
+ */
+bool DesfireLog::Read(uint32_t sequence, record_t *record)
+{
+	if (sequence >= _next || sequence < _first)
+		return false;
+
+	if (sequence >= _stored) {
+		*record = _ram[sequence % DESFIRE_LOG_RAM_RECORDS];
+		return true;
+	}
+
+	return ReadSlot(sequence % _slots, record) && record->sequence == sequence;
+} // End Read()
+
+/**
+ * Marks all the records below sequence as synchronized, their slots may be reused.
+ */
+void DesfireLog::Acknowledge(uint32_t sequence)
+{
+	if (sequence > _stored)
+		sequence = _stored;
+	if (sequence > _acknowledged)
+		_acknowledged = sequence;
+} // End Acknowledge()
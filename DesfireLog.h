@@ -0,0 +1,83 @@
+#ifndef DESFIRE_LOG_h
+#define DESFIRE_LOG_h
+
+#include <Arduino.h>
+#include "Desfire.h"
+
+/* --------------------------------------
+* Offline Transaction Log
+* --------------------------------------
+* Fixed size records are appended to a RAM ring buffer in constant time from the tap path and
+* written to non-volatile storage later, from idle time, with Flush().
+*
+* The storage is used as a ring of record slots: record n always goes to slot n % slots, so
+* every slot is written once per lap (wear levelling) and the position is recovered after a
+* reset by scanning for the highest valid sequence number. Each record carries a CRC_A
+* (ISO/IEC 14443-3 CRC) so torn or erased slots are ignored. Records are only overwritten
+* once they have been acknowledged with Acknowledge(), after a reset all the records found
+* in storage are considered unacknowledged.
+*
+* The storage is a DesfireLogStorage. DesfireLogEEPROM.h holds one for the Arduino EEPROM
+* library, kept out of the library sources for cores without it (Due...).
+*/
+#ifndef DESFIRE_LOG_RAM_RECORDS
+#define DESFIRE_LOG_RAM_RECORDS      8  /* records buffered in RAM waiting for Flush() */
+#endif
+
+/**
+ * Non-volatile storage used by DesfireLog. Flash based storage must erase whole sectors,
+ * EEPROM based storage uses a sector size of one byte and an empty EraseSector().
+ */
+class DesfireLogStorage {
+public:
+	virtual uint32_t GetSize() = 0;
+	virtual uint16_t GetSectorSize() = 0;
+	virtual void Read(uint32_t address, byte *data, uint16_t length) = 0;
+	virtual void Write(uint32_t address, const byte *data, uint16_t length) = 0;
+	virtual void EraseSector(uint32_t address) = 0;
+	virtual void Commit() {};
+};
+
+class DesfireLog {
+public:
+	// A struct used for passing one logged DESFire transaction
+	typedef struct {
+		uint32_t sequence;                    /* set by Append() */
+		uint32_t timestamp;                   /* caller defined (RTC seconds, millis()...) */
+		int32_t value_before;                 /* MIFARE_DESFIRE_GetValue() before the transaction */
+		int32_t value_after;
+		uint8_t uid[MIFARE_UID_BYTES];
+		uint8_t aid[MIFARE_AID_SIZE];
+		uint8_t mfrc522_status;               /* MFRC522::StatusCode */
+		uint8_t desfire_status;               /* DESFire::DesfireStatusCode */
+		uint16_t crc;                         /* set by Append() */
+	} record_t;
+
+	explicit DesfireLog(DesfireLogStorage *storage) : _storage(storage) {};
+
+	bool Begin();
+	bool Append(record_t *record);
+	byte Flush(byte maxRecords = DESFIRE_LOG_RAM_RECORDS);
+	bool Read(uint32_t sequence, record_t *record);
+	void Acknowledge(uint32_t sequence);
+
+	byte GetPendingCount() { return _pending; };
+	uint32_t GetFirstSequence() { return _first; };    // Oldest record that can be read
+	uint32_t GetNextSequence() { return _next; };      // Sequence of the next appended record
+
+protected:
+	DesfireLogStorage *_storage;
+	uint32_t _slots = 0;            // Records fitting in the storage
+	uint32_t _slotsPerSector = 1;
+	uint32_t _first = 0;
+	uint32_t _stored = 0;           // Next sequence to be written to storage
+	uint32_t _next = 0;
+	uint32_t _acknowledged = 0;     // Records below this sequence may be overwritten
+	record_t _ram[DESFIRE_LOG_RAM_RECORDS];
+	byte _pending = 0;
+
+	static uint16_t CalculateCRC(const record_t *record);
+	bool ReadSlot(uint32_t slot, record_t *record);
+};
+
+#endif
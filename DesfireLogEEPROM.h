@@ -0,0 +1,50 @@
+#ifndef DESFIRE_LOG_EEPROM_h
+#define DESFIRE_LOG_EEPROM_h
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "DesfireLog.h"
+
+/* --------------------------------------
+* EEPROM Log Storage
+* --------------------------------------
+* DesfireLog storage in the Arduino EEPROM library. Header only: Arduino builds every .cpp of a
+* library, so only the sketches including this header need a core with EEPROM.
+*
+* Only bytes that change are written. ESP8266 and ESP32 emulate the EEPROM in flash, call
+* EEPROM.begin() with at least address + size first, Flush() commits the written records.
+*/
+class DesfireEEPROMLogStorage : public DesfireLogStorage {
+public:
+	DesfireEEPROMLogStorage(uint16_t address, uint16_t size) : _address(address), _size(size) {};
+
+	virtual uint32_t GetSize() { return _size; };
+	virtual uint16_t GetSectorSize() { return 1; };
+
+	virtual void Read(uint32_t address, byte *data, uint16_t length) {
+		for (uint16_t i = 0; i < length; i++)
+			data[i] = EEPROM.read(_address + address + i);
+	};
+
+	// Not EEPROM.update(), the ESP cores do not have it
+	virtual void Write(uint32_t address, const byte *data, uint16_t length) {
+		for (uint16_t i = 0; i < length; i++) {
+			if (EEPROM.read(_address + address + i) != data[i])
+				EEPROM.write(_address + address + i, data[i]);
+		}
+	};
+
+	virtual void EraseSector(uint32_t) {};
+
+	virtual void Commit() {
+#if defined(ESP8266) || defined(ESP32)
+		EEPROM.commit();
+#endif
+	};
+
+protected:
+	uint16_t _address;
+	uint16_t _size;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include <DesfireProfiles.h>
+
+static_assert(sizeof(DESFire::MIFARE_DESFIRE_Version_t::hardware) + sizeof(DESFire::MIFARE_DESFIRE_Version_t::software) == 14, "profile_t::family holds both version parts");
+
+/**
+ * Sets the file read on every tap. The profiles learned for the previous target are dropped,
+ * they tell nothing about the new one.
+ *
+ * @param length Bytes to read, data must have room for them.
+ */
+void DesfireProfiles::SetTarget(DESFire::mifare_desfire_aid_t *aid, byte fileNo, uint32_t offset, uint32_t length)
+{
+	_aid = *aid;
+	_fileNo = fileNo;
+	_offset = offset;
+	_length = length;
+	_profileCount = 0;
+} // End SetTarget()
+
+/**
+ * The UID past the prefix is unique per card (or random), the ATS, SAK, UID size and
+ * manufacturer are the same for every card of a kind.
+ */
+uint32_t DesfireProfiles::GetSignature(DESFire *reader, const byte *ats, byte atsLength)
+{
+	byte prefix = (reader->uid.size < DESFIRE_PROFILE_UID_PREFIX) ? reader->uid.size : DESFIRE_PROFILE_UID_PREFIX;
+
+	uint32_t signature = DESFire::GetFingerprintHash(ats, atsLength);
+	signature = DESFire::GetFingerprintHash(&(reader->uid.sak), 1, signature);
+	signature = DESFire::GetFingerprintHash(&(reader->uid.size), 1, signature);
+	return DESFire::GetFingerprintHash(reader->uid.uidByte, prefix, signature);
+} // End GetSignature()
+
+DesfireProfiles::profile_t *DesfireProfiles::Find(uint32_t signature)
+{
+	for (byte i = 0; i < _profileCount; i++) {
+		if (_profiles[i].signature == signature)
+			return &_profiles[i];
+	}
+
+	return NULL;
+} // End Find()
+
+/**
+ * Finds the profile of signature and moves it to the front, the least recently tapped kind
+ * makes room for a new one.
+ */
+DesfireProfiles::profile_t *DesfireProfiles::Lookup(uint32_t signature)
+{
+	profile_t *found = Find(signature);
+	profile_t *profile = DESFire::MoveToFront(_profiles, &_profileCount, DESFIRE_PROFILE_COUNT, found);
+
+	if (found == NULL) {
+		memset(profile, 0, sizeof(profile_t));
+		profile->signature = signature;
+	}
+
+	return profile;
+} // End Lookup()
+
+/**
+ * Folds a discovered card into the profile of its signature: an answer like the profile's
+ * raises the confidence, another one lowers it and replaces the profile once it is gone. A
+ * stray card of another kind does not wipe out what the rest of the fleet taught.
+ */
+void DesfireProfiles::Learn(uint32_t signature, bool readable)
+{
+	profile_t *profile = Lookup(signature);
+
+	if (profile->readable == readable && memcmp(profile->family, &(_version.hardware), sizeof(profile->family)) == 0) {
+		if (readable && profile->confidence < DESFIRE_PROFILE_MAX_CONFIDENCE)
+			profile->confidence++;
+		return;
+	}
+
+	if (profile->confidence > 0) {
+		profile->confidence--;
+		return;
+	}
+
+	memcpy(profile->family, &(_version.hardware), sizeof(profile->family));
+	profile->readable = readable;
+	profile->confidence = readable ? 1 : 0;
+} // End Learn()
+
+DESFire::StatusCode DesfireProfiles::ReadTarget(DESFire *reader, DESFire::mifare_desfire_tag *tag, byte *data)
+{
+	DESFire::StatusCode response;
+	size_t length = _length;
+
+	response = reader->MIFARE_DESFIRE_SelectApplication(tag, &_aid);
+	if (!reader->IsStatusCodeOK(response))
+		return response;
+
+	response = reader->MIFARE_DESFIRE_ReadData(tag, _fileNo, _offset, _length, data, &length);
+	if (reader->IsStatusCodeOK(response) && length != _length)
+		response.mfrc522 = MFRC522::STATUS_ERROR;
+
+	return response;
+} // End ReadTarget()
+
+/**
+ * Reads the target file of the PICC in the field, which must be activated (RATS, and PPS if
+ * any) with ats its answer to RATS. A known kind of card is read right away, any other one
+ * after GetVersion.
+ *
+ * A speculative read the card answers with an error status is what discovery would have read
+ * too, it stands and only GetVersion follows to teach the profile. A speculative read that lost
+ * frames is discovered and read again. Frames lost or the PICC leaving the field during
+ * discovery end Read() and teach nothing. GetLastReport() tells which path was taken.
+ *
+ * @return The status of the read.
+ */
+DESFire::StatusCode DesfireProfiles::Read(DESFire *reader, DESFire::mifare_desfire_tag *tag, const byte *ats, byte atsLength, byte *data)
+{
+	DESFire::StatusCode result;
+	uint32_t exchanges = reader->GetExchangeCount();
+	unsigned long started = micros();
+	uint32_t signature = GetSignature(reader, ats, atsLength);
+	profile_t *profile = Find(signature);
+	bool read = false;
+
+	memset(&_report, 0, sizeof(report_t));
+
+	if (profile != NULL && profile->readable && profile->confidence > 0) {
+		_report.speculative = 1;
+		result = ReadTarget(reader, tag, data);
+
+		if (reader->IsStatusCodeOK(result)) {
+			_report.hit = 1;
+			profile = Lookup(signature);
+			if (profile->confidence < DESFIRE_PROFILE_MAX_CONFIDENCE)
+				profile->confidence++;
+
+			// The version of the kind, the UID of this card
+			memset(&_version, 0, sizeof(DESFire::MIFARE_DESFIRE_Version_t));
+			memcpy(&(_version.hardware), profile->family, sizeof(profile->family));
+			memcpy(_version.uid, reader->uid.uidByte, (reader->uid.size < MIFARE_UID_BYTES) ? reader->uid.size : MIFARE_UID_BYTES);
+			read = true;
+		}
+		else if (result.mfrc522 == MFRC522::STATUS_OK) {
+			// The same select and read as discovery, only the kind of card is missing
+			profile->confidence--;
+			if (reader->IsStatusCodeOK(reader->MIFARE_DESFIRE_GetVersion(tag, &_version)))
+				Learn(signature, false);
+			read = true;
+		}
+	}
+
+	if (!read) {
+		result = reader->MIFARE_DESFIRE_GetVersion(tag, &_version);
+		if (reader->IsStatusCodeOK(result)) {
+			result = ReadTarget(reader, tag, data);
+			if (result.mfrc522 == MFRC522::STATUS_OK)
+				Learn(signature, reader->IsStatusCodeOK(result));
+		}
+	}
+
+	_report.exchanges = reader->GetExchangeCount() - exchanges;
+	_report.elapsed = micros() - started;
+
+	return result;
+} // End Read()
@@ -0,0 +1,81 @@
+#ifndef DESFIRE_PROFILES_h
+#define DESFIRE_PROFILES_h
+
+#include <Arduino.h>
+#include "Desfire.h"
+
+/* --------------------------------------
+* Card Profiles
+* --------------------------------------
+* Reads a credential file without spending GetVersion (three frames) on cards of a kind already
+* seen. Cards are told apart by a signature of their ATS, SAK and UID prefix (the manufacturer),
+* learned on the first tap of each kind together with the GetVersion of the card and whether
+* the file could be read:
+*
+*   DesfireProfiles profiles;
+*   profiles.SetTarget(&ticketing, 0x01, 0, 32);   // application, file, offset, length
+*
+*   // After PICC_RequestATS() and PICC_ProtocolAndParameterSelection():
+*   profiles.Read(&mfrc522, &tag, ats, atsLength, credential);
+*
+* For a known signature the select and ReadData go out straight away and GetVersion() answers
+* from the profile. When the card answers the speculative commands with an error status, that
+* is the answer discovery would have got: it is returned as is and only GetVersion follows, for
+* the profile to learn from. A miss thus costs the frames of discovery and no more, a known card
+* two frames instead of five. A profile that keeps missing stops speculating until discovery
+* confirms it again. See examples/CardProfiles.ino.
+*/
+#ifndef DESFIRE_PROFILE_COUNT
+#define DESFIRE_PROFILE_COUNT        8   /* card kinds remembered */
+#endif
+#ifndef DESFIRE_PROFILE_UID_PREFIX
+#define DESFIRE_PROFILE_UID_PREFIX   1   /* UID bytes in the signature, the rest is per card */
+#endif
+#define DESFIRE_PROFILE_MAX_CONFIDENCE 3 /* a miss costs 2, a profile at most speculates through one */
+
+class DesfireProfiles {
+public:
+	// A struct used for passing the cost of the last tap
+	typedef struct {
+		uint8_t speculative;                  /* target read without GetVersion first */
+		uint8_t hit;                          /* the speculative read succeeded */
+		uint16_t exchanges;                   /* frames exchanged by Read() */
+		uint32_t elapsed;                     /* microseconds spent in Read() */
+	} report_t;
+
+	void SetTarget(DESFire::mifare_desfire_aid_t *aid, byte fileNo, uint32_t offset, uint32_t length);
+	void ClearProfiles() { _profileCount = 0; };
+
+	DESFire::StatusCode Read(DESFire *reader, DESFire::mifare_desfire_tag *tag, const byte *ats, byte atsLength, byte *data);
+
+	// Version of the last card read, from its profile (no batch number nor production date) on a hit
+	DESFire::MIFARE_DESFIRE_Version_t *GetVersion() { return &_version; };
+	report_t *GetLastReport() { return &_report; };
+
+protected:
+	// What one kind of card answered, most recently tapped first
+	typedef struct {
+		uint32_t signature;                   /* ATS, SAK and UID prefix */
+		byte family[14];                      /* hardware and software parts of GetVersion */
+		uint8_t readable;                     /* the target could be read */
+		uint8_t confidence;                   /* speculate while above 0 */
+	} profile_t;
+
+	DESFire::mifare_desfire_aid_t _aid;
+	byte _fileNo = 0;
+	uint32_t _offset = 0;
+	uint32_t _length = 0;
+
+	profile_t _profiles[DESFIRE_PROFILE_COUNT];
+	byte _profileCount = 0;
+	DESFire::MIFARE_DESFIRE_Version_t _version;
+	report_t _report;
+
+	static uint32_t GetSignature(DESFire *reader, const byte *ats, byte atsLength);
+	profile_t *Find(uint32_t signature);
+	profile_t *Lookup(uint32_t signature);
+	void Learn(uint32_t signature, bool readable);
+	DESFire::StatusCode ReadTarget(DESFire *reader, DESFire::mifare_desfire_tag *tag, byte *data);
+};
+
+#endif
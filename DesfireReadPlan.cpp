@@ -0,0 +1,219 @@
+#include <DesfireReadPlan.h>
+
+/**
+ * Adds a read to the plan, data must have room for length bytes (plus MAC or padding for
+ * MACed and enciphered files).
+ *
+ * @return false if the plan is full.
+ */
+bool DesfireReadPlan::Add(DESFire::mifare_desfire_aid_t *aid, byte fileNo, uint32_t offset, uint32_t length, byte communication, byte key, byte *data)
+{
+	if (_count >= DESFIRE_READ_PLAN_MAX_REQUESTS)
+		return false;
+
+	request_t *request = &_requests[_count++];
+	request->aid = *aid;
+	request->file_no = fileNo;
+	request->communication = communication;
+	request->key = key;
+	request->offset = offset;
+	request->length = length;
+	request->data = data;
+	request->received = 0;
+	request->status.mfrc522 = MFRC522::STATUS_OK;
+	request->status.desfire = DESFire::MF_OPERATION_OK;
+	_compiled = false;
+
+	return true;
+} // End Add()
+
+/**
+ * Orders requests by application, key, file, communication mode and offset.
+ */
+int DesfireReadPlan::Compare(const request_t *a, const request_t *b)
+{
+	int order = memcmp(a->aid.data, b->aid.data, MIFARE_AID_SIZE);
+	if (order != 0)
+		return order;
+	if (a->key != b->key)
+		return (int)a->key - b->key;
+	if (a->file_no != b->file_no)
+		return (int)a->file_no - b->file_no;
+	if (a->communication != b->communication)
+		return (int)a->communication - b->communication;
+	if (a->offset != b->offset)
+		return (a->offset < b->offset) ? -1 : 1;
+
+	return 0;
+} // End Compare()
+
+/**
+ * @return Frames needed by a ReadData of length bytes, the PICC sends at most 59 bytes per frame.
+ */
+uint16_t DesfireReadPlan::GetReadFrames(uint32_t length)
+{
+	return (length > 59) ? 1 + (length - 1) / 59 : 1;
+} // End GetReadFrames()
+
+/**
+ * Orders the requests and merges adjacent plain reads, called by Execute() when needed.
+ */
+void DesfireReadPlan::Compile()
+{
+	uint32_t start = 0;
+	uint32_t stop = 0;
+
+	_naive = 0;
+	_reads = 0;
+
+	// Insertion sort, plans are small
+	for (byte i = 0; i < _count; i++) {
+		byte j = i;
+		while (j > 0 && Compare(&_requests[_order[j - 1]], &_requests[i]) > 0) {
+			_order[j] = _order[j - 1];
+			j--;
+		}
+		_order[j] = i;
+
+		// One select, the authentication (two frames) and the read for every request
+		_naive += 1 + GetReadFrames(_requests[i].length);
+		if (_requests[i].key != DESFIRE_NOT_AUTHENTICATED)
+			_naive += 2;
+	}
+
+	for (byte i = 0; i < _count; i++) {
+		request_t *request = &_requests[_order[i]];
+		uint32_t end = request->offset + request->length;
+
+		_merged[i] = false;
+		if (i > 0 && request->length > 0 && request->communication == DESFire::MDCM_PLAIN) {
+			request_t *previous = &_requests[_order[i - 1]];
+
+			if (previous->length > 0 && previous->communication == DESFire::MDCM_PLAIN &&
+			    previous->file_no == request->file_no && previous->key == request->key &&
+			    memcmp(previous->aid.data, request->aid.data, MIFARE_AID_SIZE) == 0 &&
+			    request->offset <= stop && ((end > stop) ? end : stop) - start <= _scratchSize) {
+				_merged[i] = true;
+				if (end > stop)
+					stop = end;
+				continue;
+			}
+		}
+
+		start = request->offset;
+		stop = end;
+		_reads++;
+	}
+
+	_compiled = true;
+} // End Compile()
+
+void DesfireReadPlan::SetStatus(byte first, byte last, DESFire::StatusCode status)
+{
+	for (byte i = first; i < last; i++) {
+		_requests[_order[i]].status = status;
+		_requests[_order[i]].received = 0;
+	}
+} // End SetStatus()
+
+/**
+ * Executes the plan on the PICC in the field.
+ *
+ * The session skips selecting an application that is already selected and keys it is already
+ * authenticated with. Other keys are authenticated through authenticate, requests needing a
+ * key fail with MF_AUTHENTICATION_ERROR when it is NULL. A failed select or authentication
+ * fails all requests depending on it, other requests are still executed.
+ *
+ * @return The status of the first failed request, or success.
+ */
+DESFire::StatusCode DesfireReadPlan::Execute(DESFire *reader, DESFire::mifare_desfire_tag *tag, DESFire::authenticate_t authenticate, void *context)
+{
+	DESFire::StatusCode result;
+	uint32_t exchanges = reader->GetExchangeCount();
+	byte position = 0;
+
+	result.mfrc522 = MFRC522::STATUS_OK;
+	result.desfire = DESFire::MF_OPERATION_OK;
+
+	if (!_compiled)
+		Compile();
+
+	while (position < _count) {
+		request_t *first = &_requests[_order[position]];
+		DESFire::StatusCode response;
+		byte end = position + 1;
+
+		response = reader->MIFARE_DESFIRE_SelectApplication(tag, &(first->aid));
+		if (!reader->IsStatusCodeOK(response)) {
+			// Skip the whole application
+			while (end < _count && memcmp(_requests[_order[end]].aid.data, first->aid.data, MIFARE_AID_SIZE) == 0)
+				end++;
+		}
+		else if (first->key != DESFIRE_NOT_AUTHENTICATED && !tag->IsAuthenticated(first->key)) {
+			if (authenticate != NULL) {
+				response = authenticate(reader, tag, &(first->aid), first->key, context);
+			}
+			else {
+				response.mfrc522 = MFRC522::STATUS_OK;
+				response.desfire = DESFire::MF_AUTHENTICATION_ERROR;
+			}
+
+			if (reader->IsStatusCodeOK(response)) {
+				tag->authenticated_key = first->key;
+			}
+			else {
+				// Skip every request needing this key
+				while (end < _count && _requests[_order[end]].key == first->key &&
+				       memcmp(_requests[_order[end]].aid.data, first->aid.data, MIFARE_AID_SIZE) == 0)
+					end++;
+			}
+		}
+
+		if (reader->IsStatusCodeOK(response)) {
+			while (end < _count && _merged[end])
+				end++;
+
+			if (end - position == 1) {
+				first->received = first->length;
+				response = reader->MIFARE_DESFIRE_ReadData(tag, first->file_no, first->offset, first->length, first->data, &(first->received));
+				first->status = response;
+			}
+			else {
+				// Requests are ordered by offset, the first one starts the merged range
+				uint32_t stop = 0;
+				size_t received = _scratchSize;
+
+				for (byte i = position; i < end; i++) {
+					request_t *request = &_requests[_order[i]];
+					if (request->offset + request->length > stop)
+						stop = request->offset + request->length;
+				}
+
+				response = reader->MIFARE_DESFIRE_ReadData(tag, first->file_no, first->offset, stop - first->offset, _scratch, &received);
+				SetStatus(position, end, response);
+				if (reader->IsStatusCodeOK(response)) {
+					for (byte i = position; i < end; i++) {
+						request_t *request = &_requests[_order[i]];
+						uint32_t skip = request->offset - first->offset;
+
+						request->received = (received > skip) ? received - skip : 0;
+						if (request->received > request->length)
+							request->received = request->length;
+						memcpy(request->data, _scratch + skip, request->received);
+					}
+				}
+			}
+		}
+		else {
+			SetStatus(position, end, response);
+		}
+
+		if (reader->IsStatusCodeOK(result) && !reader->IsStatusCodeOK(response))
+			result = response;
+		position = end;
+	}
+
+	_roundTrips = reader->GetExchangeCount() - exchanges;
+
+	return result;
+} // End Execute()
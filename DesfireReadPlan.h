@@ -0,0 +1,76 @@
+#ifndef DESFIRE_READ_PLAN_h
+#define DESFIRE_READ_PLAN_h
+
+#include <Arduino.h>
+#include "Desfire.h"
+
+/* --------------------------------------
+* Multi-Application Read Planner
+* --------------------------------------
+* Collects reads from several applications and executes them with as few frames as possible:
+* requests are ordered by application and key so every application is selected once and every
+* key authenticated once, and plain reads of adjacent or overlapping ranges of the same file
+* are merged into a single ReadData.
+*
+*   byte scratch[128];
+*   DesfireReadPlan plan(scratch, sizeof(scratch));
+*   plan.Add(&ticketing, 0x01, 0, 32, DESFire::MDCM_PLAIN, DESFIRE_NOT_AUTHENTICATED, header);
+*   plan.Add(&loyalty, 0x02, 0, 4, DESFire::MDCM_PLAIN, 0x01, points);
+*   plan.Add(&ticketing, 0x01, 32, 16, DESFire::MDCM_PLAIN, DESFIRE_NOT_AUTHENTICATED, validity);
+*   plan.Execute(&mfrc522, &tag, authenticate, NULL);
+*
+* Each request owns its output slot. Merged reads go through the scratch buffer and are only
+* merged while they fit in it. MACed and enciphered reads are never merged, their slot receives
+* the raw response so it needs room for the MAC or the padding.
+*/
+#ifndef DESFIRE_READ_PLAN_MAX_REQUESTS
+#define DESFIRE_READ_PLAN_MAX_REQUESTS 16 /* requests per plan */
+#endif
+
+class DesfireReadPlan {
+public:
+	// A struct used for passing one read of a plan
+	typedef struct {
+		DESFire::mifare_desfire_aid_t aid;
+		uint8_t file_no;
+		uint8_t communication;                /* DESFire::mifare_desfire_communication_modes */
+		uint8_t key;                          /* key with read access, DESFIRE_NOT_AUTHENTICATED for free access */
+		uint32_t offset;
+		uint32_t length;
+		byte *data;                           /* output slot */
+		size_t received;                      /* bytes stored in the slot by Execute() */
+		DESFire::StatusCode status;           /* set by Execute() */
+	} request_t;
+
+	DesfireReadPlan(byte *scratch, size_t scratchSize) : _scratch(scratch), _scratchSize(scratchSize) {};
+
+	bool Add(DESFire::mifare_desfire_aid_t *aid, byte fileNo, uint32_t offset, uint32_t length, byte communication, byte key, byte *data);
+	void Clear() { _count = 0; _compiled = false; };
+	void Compile();
+	DESFire::StatusCode Execute(DESFire *reader, DESFire::mifare_desfire_tag *tag, DESFire::authenticate_t authenticate = NULL, void *context = NULL);
+
+	byte GetCount() { return _count; };
+	request_t *GetRequest(byte index) { return &_requests[index]; };
+	byte GetReadCount() { return _reads; };                    // ReadData commands after merging
+	uint16_t GetNaiveRoundTrips() { return _naive; };           // Estimate for one select (and authentication) per request
+	uint16_t GetRoundTrips() { return _roundTrips; };           // Frames exchanged by the last Execute()
+	int32_t GetSavedRoundTrips() { return (int32_t)_naive - _roundTrips; };
+
+protected:
+	byte *_scratch;
+	size_t _scratchSize;
+	request_t _requests[DESFIRE_READ_PLAN_MAX_REQUESTS];
+	byte _order[DESFIRE_READ_PLAN_MAX_REQUESTS];        // Requests in execution order
+	bool _merged[DESFIRE_READ_PLAN_MAX_REQUESTS];       // Read together with the previous request in _order
+	byte _count = 0;
+	byte _reads = 0;
+	bool _compiled = false;
+	uint16_t _naive = 0;
+	uint16_t _roundTrips = 0;
+
+	static int Compare(const request_t *a, const request_t *b);
+	static uint16_t GetReadFrames(uint32_t length);
+	void SetStatus(byte first, byte last, DESFire::StatusCode status);
+};
+
+#endif
@@ -0,0 +1,684 @@
+#include <DesfireSimulatedCard.h>
+#include <DesfireCommand.h>
+
+DesfireSimulatedCard::DesfireSimulatedCard(const byte *uid)
+{
+	static const byte defaultUid[MIFARE_UID_BYTES] = {0x04, 0x53, 0x49, 0x4D, 0x00, 0x00, 0x01};
+	static const byte defaultKey[16] = {0};
+
+	memcpy(_uid, (uid != NULL) ? uid : defaultUid, MIFARE_UID_BYTES);
+	_cipher.SetKey(defaultKey);
+	Format();
+} // End DesfireSimulatedCard()
+
+/**
+ * Deletes all applications and frees the whole memory, as FormatPICC does.
+ */
+void DesfireSimulatedCard::Format()
+{
+	_applicationCount = 0;
+	_selected = NULL;
+	_memoryUsed = 0;
+	_pendingSize = 0;
+	_chaining = false;
+	_authenticating = false;
+	_authenticated = false;
+} // End Format()
+
+/**
+ * Answers one frame: RATS, PPS, S(DESELECT) and I-blocks carrying native or wrapped commands.
+ * R-blocks and chained commands are not simulated, the PICC stays mute like a real one
+ * receiving a frame it does not understand.
+ */
+MFRC522::StatusCode DesfireSimulatedCard::Transceive(byte *sendData, byte sendLen, byte *backData, byte *backLen)
+{
+	byte response[64];
+	byte size = 0;
+
+	_frames++;
+	if (_failEvery != 0 && (_frames % _failEvery) == 0)
+		return _failStatus;
+	if (sendLen == 0)
+		return MFRC522::STATUS_TIMEOUT;
+
+	if (sendData[0] == 0xE0) {
+		// RATS: FSCI 5 (64 bytes), 106 kbit/s to 848 kbit/s, FWI 8, CID supported
+		static const byte ats[] = {0x06, 0x75, 0x77, 0x81, 0x02, 0x80};
+		memcpy(response, ats, sizeof(ats));
+		size = sizeof(ats);
+		_selected = NULL;
+		_chaining = false;
+		_authenticating = false;
+		_authenticated = false;
+	}
+	else if ((sendData[0] & 0xF0) == 0xD0) {
+		// PPS, accepted as requested
+		response[size++] = sendData[0];
+	}
+	else if ((sendData[0] & 0xF7) == 0xC2) {
+		// S(DESELECT), echoed with its CID
+		memcpy(response, sendData, sendLen);
+		size = sendLen;
+		_selected = NULL;
+		_chaining = false;
+		_authenticating = false;
+		_authenticated = false;
+	}
+	else if ((sendData[0] & 0xE2) == 0x02 && (sendData[0] & 0x10) == 0x00) {
+		// I-block, answered with the same PCB, CID and NAD
+		byte header = 1;
+		if (sendData[0] & 0x08)
+			header++;
+		if (sendData[0] & 0x04)
+			header++;
+		if (sendLen <= header)
+			return MFRC522::STATUS_TIMEOUT;
+		memcpy(response, sendData, header);
+		size = header;
+
+		const byte *apdu = sendData + header;
+		byte apduLen = sendLen - header;
+		DESFire::DesfireStatusCode status;
+
+		if (apdu[0] == 0x90) {
+			// CLA, INS, P1, P2, [Lc, Data,] Le
+			if (apduLen < 5 || (apduLen > 5 && apduLen != 6 + apdu[4])) {
+				response[size++] = 0x67;
+				response[size++] = 0x00;
+			}
+			else {
+				status = Execute(apdu[1], apdu + 5, (apduLen > 5) ? apdu[4] : 0);
+				if (status == DESFire::MF_OPERATION_OK || status == DESFire::MF_ADDITIONAL_FRAME)
+					size += NextFrame(response + size);
+				response[size++] = 0x91;
+				response[size++] = _chaining ? DESFire::MF_ADDITIONAL_FRAME : status;
+			}
+		}
+		else if (apdu[0] == 0x00) {
+			// ISO 7816-4 commands are not simulated: INS not supported
+			response[size++] = 0x6D;
+			response[size++] = 0x00;
+		}
+		else {
+			status = Execute(apdu[0], apdu + 1, apduLen - 1);
+			byte statusByte = size++;
+			if (status == DESFire::MF_OPERATION_OK || status == DESFire::MF_ADDITIONAL_FRAME)
+				size += NextFrame(response + size);
+			response[statusByte] = _chaining ? DESFire::MF_ADDITIONAL_FRAME : status;
+		}
+	}
+	else {
+		return MFRC522::STATUS_TIMEOUT;
+	}
+
+	if (size > *backLen)
+		return MFRC522::STATUS_NO_ROOM;
+	memcpy(backData, response, size);
+	*backLen = size;
+
+	return MFRC522::STATUS_OK;
+} // End Transceive()
+
+/**
+ * Moves the next frame of the pending response to response, _chaining tells whether more
+ * frames follow.
+ *
+ * @return The number of bytes moved.
+ */
+byte DesfireSimulatedCard::NextFrame(byte *response)
+{
+	byte size = 59;
+
+	if (_pendingFrame < sizeof(_pendingFrames) && _pendingFrames[_pendingFrame] != 0)
+		size = _pendingFrames[_pendingFrame];
+	if (size > _pendingSize - _pendingOffset)
+		size = _pendingSize - _pendingOffset;
+
+	memcpy(response, _pending + _pendingOffset, size);
+	_pendingOffset += size;
+	_pendingFrame++;
+	_chaining = _pendingOffset < _pendingSize;
+
+	return size;
+} // End NextFrame()
+
+/**
+ * Runs the two steps of an AES authentication with the all-zero key and starts the session:
+ * _session keyed with the session key, _iv zero.
+ */
+DESFire::DesfireStatusCode DesfireSimulatedCard::Authenticate(byte cmd, const byte *data, byte length)
+{
+	byte block[32];
+
+	if (cmd == 0xAA) {
+		if (length != 1)
+			return DESFire::MF_LENGTH_ERROR;
+		if (data[0] >= ((_selected == NULL) ? 1 : (_selected->key_count & 0x0F)))
+			return DESFire::MF_NO_SUCH_KEY;
+
+		for (byte i = 0; i < 16; i++)
+			_rndB[i] = random(256);
+		memcpy(block, _rndB, 16);
+		memset(_iv, 0, sizeof(_iv));
+		_cipher.EncryptCBC(block, 16, _iv);
+		Respond(block, 16);
+		_authenticating = true;
+		return DESFire::MF_ADDITIONAL_FRAME;
+	}
+
+	// RndA + RndB rotated left by one byte
+	_authenticating = false;
+	if (length != 32)
+		return DESFire::MF_LENGTH_ERROR;
+	memcpy(block, data, 32);
+	_cipher.DecryptCBC(block, 32, _iv);
+	if (memcmp(block + 16, _rndB + 1, 15) != 0 || block[31] != _rndB[0])
+		return DESFire::MF_AUTHENTICATION_ERROR;
+
+	// RndA 0..3, RndB 0..3, RndA 12..15, RndB 12..15
+	byte sessionKey[16];
+	memcpy(sessionKey, block, 4);
+	memcpy(sessionKey + 4, _rndB, 4);
+	memcpy(sessionKey + 8, block + 12, 4);
+	memcpy(sessionKey + 12, _rndB + 12, 4);
+	_session.SetKey(sessionKey);
+
+	// RndA rotated left by one byte
+	byte first = block[0];
+	memmove(block, block + 1, 15);
+	block[15] = first;
+	_cipher.EncryptCBC(block, 16, _iv);
+	Respond(block, 16);
+
+	memset(_iv, 0, sizeof(_iv));
+	_authenticated = true;
+	return DESFire::MF_OPERATION_OK;
+} // End Authenticate()
+
+/**
+ * Appends data to the pending response.
+ */
+void DesfireSimulatedCard::Respond(const byte *data, uint16_t length)
+{
+	if (length > sizeof(_pending) - _pendingSize)
+		length = sizeof(_pending) - _pendingSize;
+	memcpy(_pending + _pendingSize, data, length);
+	_pendingSize += length;
+} // End Respond()
+
+/**
+ * Runs a native command, its response data is left in _pending. 0xAF continues the response
+ * being sent.
+ *
+ * After an authentication every command but SelectApplication is MACed into the session IV
+ * and a successful answer gets the first 8 bytes of the CMAC over its data and status. Any
+ * error or select ends the session.
+ *
+ * @return The status of the command.
+ */
+DESFire::DesfireStatusCode DesfireSimulatedCard::Execute(byte cmd, const byte *data, byte length)
+{
+	DESFire::DesfireStatusCode status;
+	byte block[16];
+	byte blockLength = 0;
+
+	if (cmd == 0xAF && !_authenticating)
+		return _chaining ? DESFire::MF_OPERATION_OK : DESFire::MF_ILLEGAL_COMMAND_CODE;
+
+	// Any other command aborts the response being sent
+	_pendingSize = 0;
+	_pendingOffset = 0;
+	_pendingFrame = 0;
+	memset(_pendingFrames, 0, sizeof(_pendingFrames));
+	_chaining = false;
+
+	if (cmd == 0xAA || cmd == 0xAF) {
+		_authenticated = false;
+		return Authenticate(cmd, data, length);
+	}
+
+	if (_authenticated && cmd != 0x5A) {
+		_session.CMACUpdate(&cmd, 1, _iv, block, &blockLength);
+		_session.CMACUpdate(data, length, _iv, block, &blockLength);
+		_session.CMACFinal(_iv, block, blockLength);
+	}
+
+	status = Run(cmd, data, length);
+	if (!_authenticated)
+		return status;
+	if (status != DESFire::MF_OPERATION_OK || cmd == 0x5A) {
+		_authenticated = false;
+		return status;
+	}
+
+	byte statusByte = status;
+	blockLength = 0;
+	_session.CMACUpdate(_pending, _pendingSize, _iv, block, &blockLength);
+	_session.CMACUpdate(&statusByte, 1, _iv, block, &blockLength);
+	_session.CMACFinal(_iv, block, blockLength);
+	Respond(_iv, DESFIRE_MAC_SIZE);
+
+	return status;
+} // End Execute()
+
+/**
+ * Runs a native command other than an authentication, see Execute().
+ */
+DESFire::DesfireStatusCode DesfireSimulatedCard::Run(byte cmd, const byte *data, byte length)
+{
+	byte buffer[DesfireGetFileSettingsCommand::response::size + DesfireValueFileSettings::size];
+	byte size;
+	application_t *application;
+	file_t *file;
+
+	switch (cmd) {
+		case 0x60: // GetVersion: hardware, software and production parts in three frames
+			buffer[0] = 0x04;     // NXP
+			buffer[1] = 0x01;     // DESFire
+			buffer[2] = 0x01;
+			buffer[3] = 0x01;     // EV1
+			buffer[4] = 0x00;
+			buffer[5] = GetStorageSize();
+			buffer[6] = 0x05;     // ISO/IEC 14443-2 and -3
+			Respond(buffer, 7);
+			buffer[4] = 0x04;
+			Respond(buffer, 7);
+			Respond(_uid, MIFARE_UID_BYTES);
+			memset(buffer, 0, 7); // Batch number, production week and year
+			Respond(buffer, 7);
+			_pendingFrames[0] = 7;
+			_pendingFrames[1] = 7;
+			return DESFire::MF_OPERATION_OK;
+
+		case 0x6A: // GetApplicationIDs
+			if (_selected != NULL)
+				return DESFire::MF_PERMISSION_ERROR;
+			for (byte i = 0; i < _applicationCount; i++)
+				Respond(_applications[i].aid, MIFARE_AID_SIZE);
+			return DESFire::MF_OPERATION_OK;
+
+		case 0x6D: // GetDFNames, the simulated applications have no ISO names
+			return (_selected != NULL) ? DESFire::MF_PERMISSION_ERROR : DESFire::MF_OPERATION_OK;
+
+		case 0x5A: // SelectApplication
+			if (length != DesfireSelectApplicationCommand::request::size)
+				return DESFire::MF_LENGTH_ERROR;
+			if (data[0] == 0x00 && data[1] == 0x00 && data[2] == 0x00) {
+				_selected = NULL;
+				return DESFire::MF_OPERATION_OK;
+			}
+			application = FindApplication(data);
+			if (application == NULL)
+				return DESFire::MF_APPLICATION_NOT_FOUND;
+			_selected = application;
+			return DESFire::MF_OPERATION_OK;
+
+		case 0x45: // GetKeySettings: the PICC master key is a single changeable DES key
+			if (_selected == NULL) {
+				DesfireGetKeySettingsCommand::response::encode(buffer, 0x0F, 0x01);
+			}
+			else {
+				DesfireGetKeySettingsCommand::response::encode(buffer, _selected->key_settings, _selected->key_count);
+			}
+			Respond(buffer, DesfireGetKeySettingsCommand::response::size);
+			return DESFire::MF_OPERATION_OK;
+
+		case 0x64: // GetKeyVersion, every key is still at version 0
+			if (length != DesfireGetKeyVersionCommand::request::size)
+				return DESFire::MF_LENGTH_ERROR;
+			if (data[0] >= ((_selected == NULL) ? 1 : (_selected->key_count & 0x0F)))
+				return DESFire::MF_NO_SUCH_KEY;
+			buffer[0] = 0x00;
+			Respond(buffer, DesfireGetKeyVersionCommand::response::size);
+			return DESFire::MF_OPERATION_OK;
+
+		case 0x6E: // GetFreeMemory
+			DesfireGetFreeMemoryCommand::response::encode(buffer, GetFreeMemory());
+			Respond(buffer, DesfireGetFreeMemoryCommand::response::size);
+			return DESFire::MF_OPERATION_OK;
+
+		case 0xCA: // CreateApplication
+			if (length != DesfireCreateApplicationCommand::request::size)
+				return DESFire::MF_LENGTH_ERROR;
+			if (_selected != NULL)
+				return DESFire::MF_PERMISSION_ERROR;
+			if ((data[4] & 0x0F) == 0 || (data[4] & 0x0F) > 14)
+				return DESFire::MF_PARAMETER_ERROR;
+			if (FindApplication(data) != NULL)
+				return DESFire::MF_DUPLICATE_ERROR;
+			if (_applicationCount >= DESFIRE_SIM_MAX_APPLICATIONS)
+				return DESFire::MF_COUNT_ERROR;
+			application = &_applications[_applicationCount++];
+			memcpy(application->aid, data, MIFARE_AID_SIZE);
+			application->key_settings = data[3];
+			application->key_count = data[4];
+			application->file_count = 0;
+			return DESFire::MF_OPERATION_OK;
+
+		case 0xDA: // DeleteApplication, like a real PICC the memory is only freed by a format
+			if (length != DesfireDeleteApplicationCommand::request::size)
+				return DESFire::MF_LENGTH_ERROR;
+			application = FindApplication(data);
+			if (application == NULL)
+				return DESFire::MF_APPLICATION_NOT_FOUND;
+			if (_selected == application)
+				_selected = NULL;
+			else if (_selected > application)
+				_selected--;
+			memmove(application, application + 1, (_applications + _applicationCount - application - 1) * sizeof(application_t));
+			_applicationCount--;
+			return DESFire::MF_OPERATION_OK;
+
+		case 0xFC: // FormatPICC
+			if (_selected != NULL)
+				return DESFire::MF_PERMISSION_ERROR;
+			Format();
+			return DESFire::MF_OPERATION_OK;
+
+		case 0x6F: // GetFileIDs
+			if (_selected == NULL)
+				return DESFire::MF_PERMISSION_ERROR;
+			for (byte i = 0; i < _selected->file_count; i++)
+				Respond(&_selected->files[i].file_no, 1);
+			return DESFire::MF_OPERATION_OK;
+
+		case 0xF5: // GetFileSettings
+			if (length != DesfireGetFileSettingsCommand::request::size)
+				return DESFire::MF_LENGTH_ERROR;
+			file = FindFile(_selected, data[0]);
+			if (file == NULL)
+				return (_selected == NULL) ? DESFire::MF_PERMISSION_ERROR : DESFire::MF_FILE_NOT_FOUND;
+
+			DesfireGetFileSettingsCommand::response::encode(buffer, file->settings.file_type, file->settings.communication_settings, file->settings.access_rights);
+			size = DesfireGetFileSettingsCommand::response::size;
+			switch (file->settings.file_type) {
+				case DESFire::MDFT_STANDARD_DATA_FILE:
+				case DESFire::MDFT_BACKUP_DATA_FILE:
+					DesfireDataFileSettings::encode(buffer + size, file->settings.settings.standard_file.file_size);
+					size += DesfireDataFileSettings::size;
+					break;
+				case DESFire::MDFT_VALUE_FILE_WITH_BACKUP:
+					DesfireValueFileSettings::encode(buffer + size, file->settings.settings.value_file.lower_limit, file->settings.settings.value_file.upper_limit,
+					                                 file->settings.settings.value_file.limited_credit_value, file->settings.settings.value_file.limited_credit_enabled);
+					size += DesfireValueFileSettings::size;
+					break;
+				default:
+					DesfireRecordFileSettings::encode(buffer + size, file->settings.settings.record_file.record_size, file->settings.settings.record_file.max_number_of_records,
+					                                  file->settings.settings.record_file.current_number_of_records);
+					size += DesfireRecordFileSettings::size;
+					break;
+			}
+			Respond(buffer, size);
+			return DESFire::MF_OPERATION_OK;
+
+		case 0xCD: // CreateStdDataFile
+			return CreateFile(DESFire::MDFT_STANDARD_DATA_FILE, data, length);
+		case 0xCB: // CreateBackupDataFile
+			return CreateFile(DESFire::MDFT_BACKUP_DATA_FILE, data, length);
+		case 0xCC: // CreateValueFile
+			return CreateFile(DESFire::MDFT_VALUE_FILE_WITH_BACKUP, data, length);
+		case 0xC1: // CreateLinearRecordFile
+			return CreateFile(DESFire::MDFT_LINEAR_RECORD_FILE_WITH_BACKUP, data, length);
+		case 0xC0: // CreateCyclicRecordFile
+			return CreateFile(DESFire::MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP, data, length);
+
+		case 0xBD: // ReadData
+		case 0xBB: // ReadRecords
+			return Read(cmd, data, length);
+
+		case 0x6C: // GetValue
+			if (length != DesfireGetValueCommand::request::size)
+				return DESFire::MF_LENGTH_ERROR;
+			file = FindFile(_selected, data[0]);
+			if (file == NULL)
+				return (_selected == NULL) ? DESFire::MF_PERMISSION_ERROR : DESFire::MF_FILE_NOT_FOUND;
+			if (file->settings.file_type != DESFire::MDFT_VALUE_FILE_WITH_BACKUP)
+				return DESFire::MF_PARAMETER_ERROR;
+			DesfireGetValueCommand::response::encode(buffer, file->value);
+			Respond(buffer, DesfireGetValueCommand::response::size);
+			return DESFire::MF_OPERATION_OK;
+	}
+
+	return DESFire::MF_ILLEGAL_COMMAND_CODE;
+} // End Run()
+
+/**
+ * Creates a file of the given type in the selected application, data holds the request of the
+ * matching Create*File command.
+ */
+DESFire::DesfireStatusCode DesfireSimulatedCard::CreateFile(byte type, const byte *data, byte length)
+{
+	typedef DesfireCreateStdDataFileCommand::request DataRequest;
+	typedef DesfireCreateValueFileCommand::request ValueRequest;
+	typedef DesfireCreateLinearRecordFileCommand::request RecordRequest;
+
+	file_t file;
+	uint32_t size = 0;
+
+	if (_selected == NULL)
+		return DESFire::MF_PERMISSION_ERROR;
+
+	file.file_no = data[0];
+	file.settings.file_type = type;
+	file.settings.communication_settings = data[1];
+	file.settings.access_rights = DataRequest::get<2>(data);
+	file.value = 0;
+	file.newest = 0;
+
+	switch (type) {
+		case DESFire::MDFT_STANDARD_DATA_FILE:
+		case DESFire::MDFT_BACKUP_DATA_FILE:
+			if (length != DataRequest::size)
+				return DESFire::MF_LENGTH_ERROR;
+			size = DataRequest::get<3>(data);
+			file.settings.settings.standard_file.file_size = size;
+			break;
+
+		case DESFire::MDFT_VALUE_FILE_WITH_BACKUP:
+			if (length != ValueRequest::size)
+				return DESFire::MF_LENGTH_ERROR;
+			file.settings.settings.value_file.lower_limit = ValueRequest::get<3>(data);
+			file.settings.settings.value_file.upper_limit = ValueRequest::get<4>(data);
+			file.settings.settings.value_file.limited_credit_value = 0;
+			file.settings.settings.value_file.limited_credit_enabled = ValueRequest::get<6>(data);
+			file.value = ValueRequest::get<5>(data);
+			if (file.settings.settings.value_file.lower_limit > file.settings.settings.value_file.upper_limit ||
+			    file.value < file.settings.settings.value_file.lower_limit || file.value > file.settings.settings.value_file.upper_limit)
+				return DESFire::MF_BOUNDARY_ERROR;
+			break;
+
+		default:
+			if (length != RecordRequest::size)
+				return DESFire::MF_LENGTH_ERROR;
+			file.settings.settings.record_file.record_size = RecordRequest::get<3>(data);
+			file.settings.settings.record_file.max_number_of_records = RecordRequest::get<4>(data);
+			file.settings.settings.record_file.current_number_of_records = 0;
+			// A cyclic file keeps one record free for the next write
+			if (file.settings.settings.record_file.record_size == 0 ||
+			    file.settings.settings.record_file.max_number_of_records < ((type == DESFire::MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP) ? 2 : 1))
+				return DESFire::MF_PARAMETER_ERROR;
+			size = file.settings.settings.record_file.record_size * file.settings.settings.record_file.max_number_of_records;
+			file.newest = file.settings.settings.record_file.max_number_of_records - 1;
+			break;
+	}
+
+	if (file.file_no > 31)
+		return DESFire::MF_PARAMETER_ERROR;
+	if (FindFile(_selected, file.file_no) != NULL)
+		return DESFire::MF_DUPLICATE_ERROR;
+	if (_selected->file_count >= DESFIRE_SIM_MAX_FILES)
+		return DESFire::MF_COUNT_ERROR;
+	if (size > GetFreeMemory())
+		return DESFire::MF_OUT_OF_EEPROM_ERROR;
+
+	file.data = _memoryUsed;
+	memset(_memory + _memoryUsed, 0, size);
+	_memoryUsed += size;
+	_selected->files[_selected->file_count++] = file;
+
+	return DESFire::MF_OPERATION_OK;
+} // End CreateFile()
+
+/**
+ * ReadData (offset and length in bytes) and ReadRecords (offset and count in records). A length
+ * of 0 reads everything from offset on. Like a real PICC ReadRecords returns the count records
+ * ending offset records before the newest one, oldest first.
+ */
+DESFire::DesfireStatusCode DesfireSimulatedCard::Read(byte cmd, const byte *data, byte length)
+{
+	typedef DesfireReadDataCommand::request Request;
+
+	if (length != Request::size)
+		return DESFire::MF_LENGTH_ERROR;
+
+	file_t *file = FindFile(_selected, Request::get<0>(data));
+	uint32_t offset = Request::get<1>(data);
+	uint32_t count = Request::get<2>(data);
+
+	if (file == NULL)
+		return (_selected == NULL) ? DESFire::MF_PERMISSION_ERROR : DESFire::MF_FILE_NOT_FOUND;
+
+	if (cmd == 0xBD) {
+		if (file->settings.file_type != DESFire::MDFT_STANDARD_DATA_FILE && file->settings.file_type != DESFire::MDFT_BACKUP_DATA_FILE)
+			return DESFire::MF_PARAMETER_ERROR;
+
+		uint32_t size = file->settings.settings.standard_file.file_size;
+		if (offset >= size)
+			return DESFire::MF_BOUNDARY_ERROR;
+		if (count == 0)
+			count = size - offset;
+		if (count > size - offset)
+			return DESFire::MF_BOUNDARY_ERROR;
+
+		Respond(_memory + file->data + offset, count);
+		return DESFire::MF_OPERATION_OK;
+	}
+
+	if (file->settings.file_type != DESFire::MDFT_LINEAR_RECORD_FILE_WITH_BACKUP && file->settings.file_type != DESFire::MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP)
+		return DESFire::MF_PARAMETER_ERROR;
+
+	uint32_t recordSize = file->settings.settings.record_file.record_size;
+	uint32_t records = file->settings.settings.record_file.current_number_of_records;
+	uint32_t slots = file->settings.settings.record_file.max_number_of_records;
+
+	if (offset >= records)
+		return DESFire::MF_BOUNDARY_ERROR;
+	if (count == 0)
+		count = records - offset;
+	if (count > records - offset)
+		return DESFire::MF_BOUNDARY_ERROR;
+
+	// Record i is i records older than the newest one
+	for (uint32_t i = offset + count; i > offset; i--)
+		Respond(_memory + file->data + ((file->newest + slots - (i - 1)) % slots) * recordSize, recordSize);
+
+	return DESFire::MF_OPERATION_OK;
+} // End Read()
+
+/**
+ * Overwrites part of a data file.
+ */
+DESFire::DesfireStatusCode DesfireSimulatedCard::WriteData(const byte *aid, byte fileNo, uint32_t offset, const byte *data, uint32_t length)
+{
+	application_t *application = FindApplication(aid);
+	if (application == NULL)
+		return DESFire::MF_APPLICATION_NOT_FOUND;
+	file_t *file = FindFile(application, fileNo);
+	if (file == NULL)
+		return DESFire::MF_FILE_NOT_FOUND;
+	if (file->settings.file_type != DESFire::MDFT_STANDARD_DATA_FILE && file->settings.file_type != DESFire::MDFT_BACKUP_DATA_FILE)
+		return DESFire::MF_PARAMETER_ERROR;
+	if (offset > file->settings.settings.standard_file.file_size || length > file->settings.settings.standard_file.file_size - offset)
+		return DESFire::MF_BOUNDARY_ERROR;
+
+	memcpy(_memory + file->data + offset, data, length);
+
+	return DESFire::MF_OPERATION_OK;
+} // End WriteData()
+
+/**
+ * Sets the value of a value file, within its limits.
+ */
+DESFire::DesfireStatusCode DesfireSimulatedCard::SetValue(const byte *aid, byte fileNo, int32_t value)
+{
+	application_t *application = FindApplication(aid);
+	if (application == NULL)
+		return DESFire::MF_APPLICATION_NOT_FOUND;
+	file_t *file = FindFile(application, fileNo);
+	if (file == NULL)
+		return DESFire::MF_FILE_NOT_FOUND;
+	if (file->settings.file_type != DESFire::MDFT_VALUE_FILE_WITH_BACKUP)
+		return DESFire::MF_PARAMETER_ERROR;
+	if (value < file->settings.settings.value_file.lower_limit || value > file->settings.settings.value_file.upper_limit)
+		return DESFire::MF_BOUNDARY_ERROR;
+
+	file->value = value;
+
+	return DESFire::MF_OPERATION_OK;
+} // End SetValue()
+
+/**
+ * Writes a record (record_size bytes) as the newest record of a record file. A full linear
+ * file refuses it, a full cyclic file drops its oldest record.
+ */
+DESFire::DesfireStatusCode DesfireSimulatedCard::AppendRecord(const byte *aid, byte fileNo, const byte *record)
+{
+	application_t *application = FindApplication(aid);
+	if (application == NULL)
+		return DESFire::MF_APPLICATION_NOT_FOUND;
+	file_t *file = FindFile(application, fileNo);
+	if (file == NULL)
+		return DESFire::MF_FILE_NOT_FOUND;
+	if (file->settings.file_type != DESFire::MDFT_LINEAR_RECORD_FILE_WITH_BACKUP && file->settings.file_type != DESFire::MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP)
+		return DESFire::MF_PARAMETER_ERROR;
+
+	uint32_t slots = file->settings.settings.record_file.max_number_of_records;
+	uint32_t capacity = (file->settings.file_type == DESFire::MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP) ? slots - 1 : slots;
+	uint32_t *records = &file->settings.settings.record_file.current_number_of_records;
+
+	if (*records >= capacity && file->settings.file_type == DESFire::MDFT_LINEAR_RECORD_FILE_WITH_BACKUP)
+		return DESFire::MF_BOUNDARY_ERROR;
+
+	file->newest = (file->newest + 1) % slots;
+	memcpy(_memory + file->data + file->newest * file->settings.settings.record_file.record_size, record, file->settings.settings.record_file.record_size);
+	if (*records < capacity)
+		(*records)++;
+
+	return DESFire::MF_OPERATION_OK;
+} // End AppendRecord()
+
+DesfireSimulatedCard::application_t *DesfireSimulatedCard::FindApplication(const byte *aid)
+{
+	for (byte i = 0; i < _applicationCount; i++) {
+		if (memcmp(_applications[i].aid, aid, MIFARE_AID_SIZE) == 0)
+			return &_applications[i];
+	}
+
+	return NULL;
+} // End FindApplication()
+
+DesfireSimulatedCard::file_t *DesfireSimulatedCard::FindFile(application_t *application, byte fileNo)
+{
+	if (application == NULL)
+		return NULL;
+
+	for (byte i = 0; i < application->file_count; i++) {
+		if (application->files[i].file_no == fileNo)
+			return &application->files[i];
+	}
+
+	return NULL;
+} // End FindFile()
+
+/**
+ * @return The storage size byte of GetVersion for the memory pool: n << 1 for exactly 2^n
+ *         bytes, bit 0 set for between 2^n and 2^(n+1) bytes.
+ */
+byte DesfireSimulatedCard::GetStorageSize()
+{
+	byte n = 0;
+	while ((2UL << n) <= DESFIRE_SIM_MEMORY)
+		n++;
+
+	return (n << 1) | (((1UL << n) == DESFIRE_SIM_MEMORY) ? 0x00 : 0x01);
+} // End GetStorageSize()
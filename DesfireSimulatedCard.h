@@ -0,0 +1,110 @@
+#ifndef DESFIRE_SIMULATED_CARD_h
+#define DESFIRE_SIMULATED_CARD_h
+
+#include <Arduino.h>
+#include "Desfire.h"
+#include "DesfireTransport.h"
+
+/* --------------------------------------
+* Simulated DESFire PICC
+* --------------------------------------
+* An in-process DESFire EV1 answering the frames of a DESFire instance, to run sketches and
+* benchmarks without a card in the field:
+*
+*   DesfireSimulatedCard card;
+*   mfrc522.PCD_SetTransport(&card);
+*   mfrc522.PICC_RequestATS(&tag, ats, &atsLength);
+*
+* It speaks native and ISO 7816-4 wrapped commands, with or without CID and NAD, and chains
+* long responses over 59 byte frames like a real card. Applications, data, value and record
+* files live in a fixed memory pool. AES authentication is answered for every key with the
+* all-zero key, a blank card's default, and the session that follows MACs commands and answers
+* like an EV1. Other keys, access rights and backup/commit are not simulated: every file is free
+* for everyone.
+*
+* The Set/Write/Append methods change the card behind the reader's back, as another terminal
+* would. SetFailure() drops every n-th frame to exercise the retry and RF tuning paths.
+*/
+#ifndef DESFIRE_SIM_MAX_APPLICATIONS
+#define DESFIRE_SIM_MAX_APPLICATIONS 8   /* applications on the simulated PICC */
+#endif
+#ifndef DESFIRE_SIM_MAX_FILES
+#define DESFIRE_SIM_MAX_FILES        8   /* files in each simulated application */
+#endif
+#ifndef DESFIRE_SIM_MEMORY
+#define DESFIRE_SIM_MEMORY           512 /* bytes of file data, also the longest response */
+#endif
+
+class DesfireSimulatedCard : public DesfireTransport {
+public:
+	DesfireSimulatedCard(const byte *uid = NULL);
+
+	virtual MFRC522::StatusCode Transceive(byte *sendData, byte sendLen, byte *backData, byte *backLen);
+
+	void Format();
+	DESFire::DesfireStatusCode WriteData(const byte *aid, byte fileNo, uint32_t offset, const byte *data, uint32_t length);
+	DESFire::DesfireStatusCode SetValue(const byte *aid, byte fileNo, int32_t value);
+	DESFire::DesfireStatusCode AppendRecord(const byte *aid, byte fileNo, const byte *record);
+	void SetFailure(uint16_t every, MFRC522::StatusCode status = MFRC522::STATUS_TIMEOUT) { _failEvery = every; _failStatus = status; };
+
+	uint32_t GetFrameCount() { return _frames; };
+	uint16_t GetFreeMemory() { return DESFIRE_SIM_MEMORY - _memoryUsed; };
+
+protected:
+	typedef struct {
+		byte file_no;
+		DESFire::mifare_desfire_file_settings_t settings;
+		int32_t value;                        /* value files */
+		uint16_t data;                        /* offset of the content in _memory */
+		uint16_t newest;                      /* record files: slot of the newest record */
+	} file_t;
+
+	typedef struct {
+		byte aid[MIFARE_AID_SIZE];
+		byte key_settings;
+		byte key_count;
+		byte file_count;
+		file_t files[DESFIRE_SIM_MAX_FILES];
+	} application_t;
+
+	byte _uid[MIFARE_UID_BYTES];
+	application_t _applications[DESFIRE_SIM_MAX_APPLICATIONS];
+	byte _applicationCount;
+	application_t *_selected;                 // NULL at PICC level
+	byte _memory[DESFIRE_SIM_MEMORY];
+	uint16_t _memoryUsed;
+
+	// Response still being sent, one frame per 0xAF
+	byte _pending[DESFIRE_SIM_MEMORY + DESFIRE_MAC_SIZE];
+	uint16_t _pendingSize;
+	uint16_t _pendingOffset;
+	byte _pendingFrames[3];                   // Sizes of the first frames, 0 for full frames
+	byte _pendingFrame;
+	bool _chaining;
+
+	// AES authentication waiting for the reader's answer, then the session it started
+	DesfireAES _cipher;                       // Keyed with the all-zero key
+	DesfireAES _session;                      // Keyed with the session key
+	byte _rndB[16];
+	byte _iv[16];
+	bool _authenticating;
+	bool _authenticated;
+
+	uint32_t _frames = 0;
+	uint16_t _failEvery = 0;
+	MFRC522::StatusCode _failStatus = MFRC522::STATUS_TIMEOUT;
+
+	DESFire::DesfireStatusCode Execute(byte cmd, const byte *data, byte length);
+	DESFire::DesfireStatusCode Run(byte cmd, const byte *data, byte length);
+	DESFire::DesfireStatusCode CreateFile(byte type, const byte *data, byte length);
+	DESFire::DesfireStatusCode Read(byte cmd, const byte *data, byte length);
+	DESFire::DesfireStatusCode Authenticate(byte cmd, const byte *data, byte length);
+	byte NextFrame(byte *response);
+
+	application_t *FindApplication(const byte *aid);
+	file_t *FindFile(application_t *application, byte fileNo);
+	void Respond(const byte *data, uint16_t length);
+	static byte GetStorageSize();
+};
+
+#endif
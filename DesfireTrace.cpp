@@ -0,0 +1,170 @@
+#include <DesfireTrace.h>
+
+void DesfireTrace::Push(byte value)
+{
+	_buffer[(_head + _length) % _size] = value;
+	_length++;
+}
+
+/**
+ * Drops the oldest record of the ring buffer.
+ */
+void DesfireTrace::DropOldest()
+{
+	// Flags, status, length and the delta time varint
+	uint16_t recordSize = 3;
+	while (Peek(recordSize) & 0x80)
+		recordSize++;
+	recordSize += 1 + Peek(2);
+
+	_head = (_head + recordSize) % _size;
+	_length -= recordSize;
+	_dropped++;
+}
+
+/**
+ * Appends a frame to the trace, dropping the oldest records if needed.
+ */
+void DesfireTrace::Record(bool received, MFRC522::StatusCode status, const byte *data, byte length)
+{
+	unsigned long now = micros();
+	uint32_t delta = _empty ? 0 : (uint32_t)(now - _last);
+
+	byte header[8];
+	byte headerSize = 3;
+	header[0] = received ? DESFIRE_TRACE_RECEIVED : 0x00;
+	header[1] = status;
+	header[2] = length;
+	do {
+		header[headerSize] = delta & 0x7F;
+		delta >>= 7;
+		if (delta)
+			header[headerSize] |= 0x80;
+		headerSize++;
+	} while (delta);
+
+	uint16_t recordSize = headerSize + length;
+	if (recordSize > _size)
+		return;
+
+	while (_size - _length < recordSize)
+		DropOldest();
+
+	for (byte i = 0; i < headerSize; i++)
+		Push(header[i]);
+	for (byte i = 0; i < length; i++)
+		Push(data[i]);
+
+	_last = now;
+	_empty = false;
+} // End Record()
+
+void DesfireTrace::Clear()
+{
+	_head = 0;
+	_length = 0;
+	_dropped = 0;
+	_empty = true;
+} // End Clear()
+
+bool DesfireTrace::Read(uint16_t *cursor, record_t *record)
+{
+	if (*cursor >= _length)
+		return false;
+
+	uint16_t offset = *cursor;
+	byte flags = Peek(offset++);
+	record->received = (flags & DESFIRE_TRACE_RECEIVED) != 0;
+	record->status = (MFRC522::StatusCode)Peek(offset++);
+	record->length = Peek(offset++);
+
+	record->delta = 0;
+	byte shift = 0;
+	byte value;
+	do {
+		value = Peek(offset++);
+		record->delta |= (uint32_t)(value & 0x7F) << shift;
+		shift += 7;
+	} while (value & 0x80);
+
+	for (byte i = 0; i < record->length; i++)
+		record->data[i] = Peek(offset++);
+
+	*cursor = offset;
+	return true;
+} // End Read()
+
+uint16_t DesfireTrace::Export(byte *buffer, uint16_t size)
+{
+	uint16_t length = (_length < size) ? _length : size;
+
+	for (uint16_t i = 0; i < length; i++)
+		buffer[i] = Peek(i);
+
+	return length;
+} // End Export()
+
+/**
+ * Decodes the record at the cursor of a linear (exported) trace.
+ */
+bool DesfireTracePlayer::NextRecord(DesfireTrace::record_t *record)
+{
+	if (_cursor + 4 > _length)
+		return false;
+
+	byte flags = _trace[_cursor++];
+	record->received = (flags & DESFIRE_TRACE_RECEIVED) != 0;
+	record->status = (MFRC522::StatusCode)_trace[_cursor++];
+	record->length = _trace[_cursor++];
+
+	record->delta = 0;
+	byte shift = 0;
+	byte value;
+	do {
+		value = _trace[_cursor++];
+		record->delta |= (uint32_t)(value & 0x7F) << shift;
+		shift += 7;
+	} while ((value & 0x80) && _cursor < _length);
+
+	if (_cursor + record->length > _length) {
+		_cursor = _length;
+		return false;
+	}
+
+	memcpy(record->data, _trace + _cursor, record->length);
+	_cursor += record->length;
+
+	return true;
+} // End NextRecord()
+
+MFRC522::StatusCode DesfireTracePlayer::PCD_DesfireTransceive(byte *sendData, byte sendLen, byte *backData, byte *backLen)
+{
+	DesfireTrace::record_t record;
+
+	// Sent frame, skipping anything received without a request
+	do {
+		if (!NextRecord(&record))
+			return STATUS_TIMEOUT;
+	} while (record.received);
+
+	if (record.length != sendLen || memcmp(record.data, sendData, sendLen) != 0)
+		_mismatches++;
+
+	// Answer of the PICC
+	if (!NextRecord(&record) || !record.received)
+		return STATUS_TIMEOUT;
+
+	if (_realTime) {
+		delay(record.delta / 1000);
+		delayMicroseconds(record.delta % 1000);
+	}
+
+	if (record.status == STATUS_OK && backData != NULL && backLen != NULL) {
+		if (record.length > *backLen)
+			return STATUS_NO_ROOM;
+		memcpy(backData, record.data, record.length);
+		*backLen = record.length;
+	}
+
+	return record.status;
+} // End PCD_DesfireTransceive()
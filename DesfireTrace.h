@@ -0,0 +1,97 @@
+#ifndef DESFIRE_TRACE_h
+#define DESFIRE_TRACE_h
+
+#include <Arduino.h>
+#include "Desfire.h"
+
+/* --------------------------------------
+* DESFire Frame Trace
+* --------------------------------------
+* Compact binary log of every frame exchanged by PCD_DesfireExchangeFrame(), kept in a caller
+* supplied ring buffer. When the buffer is full the oldest records are dropped.
+*
+* Record layout:
+*
+*  |-------|--------|--------|---------------------|------|
+*  | Flags | Status | Length | Delta time (varint) | Data |
+*  |-------|--------|--------|---------------------|------|
+*
+*  - Flags  : bit 7 is set for frames received from the PICC, bits 6..0 are reserved (0).
+*  - Status : MFRC522::StatusCode of the exchange (always STATUS_OK for sent frames).
+*  - Length : number of data bytes (frame without CRC_A).
+*  - Delta  : microseconds since the previous record, LEB128 encoded (1 to 5 bytes).
+*/
+#define DESFIRE_TRACE_RECEIVED       0x80
+
+class DesfireTrace {
+public:
+	// A struct used for passing one decoded trace record
+	typedef struct {
+		bool received;                        /* true for PICC to PCD frames */
+		MFRC522::StatusCode status;
+		uint32_t delta;                       /* microseconds since the previous record */
+		byte length;
+		byte data[DESFIRE_FSD - 2];
+	} record_t;
+
+	DesfireTrace(byte *buffer, uint16_t size) : _buffer(buffer), _size(size) {};
+
+	void Record(bool received, MFRC522::StatusCode status, const byte *data, byte length);
+	void Clear();
+
+	/**
+	 * Copies the oldest record at or after *cursor into *record and advances *cursor.
+	 * Start with *cursor = 0.
+	 *
+	 * @return false when there are no more records.
+	 */
+	bool Read(uint16_t *cursor, record_t *record);
+
+	uint16_t GetLength() { return _length; };
+	uint32_t GetDroppedCount() { return _dropped; };
+
+	// Linear copy of the trace, oldest record first, for sending it off the device.
+	uint16_t Export(byte *buffer, uint16_t size);
+
+protected:
+	byte *_buffer;
+	uint16_t _size;
+	uint16_t _head = 0;             // Offset of the oldest record
+	uint16_t _length = 0;           // Bytes in use
+	uint32_t _dropped = 0;          // Records dropped to make room
+	unsigned long _last = 0;        // micros() of the last record
+	bool _empty = true;
+
+	byte Peek(uint16_t offset) { return _buffer[(_head + offset) % _size]; };
+	void Push(byte value);
+	void DropOldest();
+};
+
+/**
+ * Replays a recorded trace through the DESFire class instead of a MFRC522.
+ *
+ * Every frame the library sends consumes the next sent record of the trace (mismatches are
+ * counted) and is answered with the following received record. Useful to benchmark and
+ * regression-test protocol changes against captured sessions.
+ */
+class DesfireTracePlayer : public DESFire {
+public:
+	explicit DesfireTracePlayer(const byte *trace, uint16_t length, bool realTime = false)
+		: DESFire(), _trace(trace), _length(length), _realTime(realTime) {};
+
+	void Rewind() { _cursor = 0; _mismatches = 0; };
+	bool IsFinished() { return _cursor >= _length; };
+	uint16_t GetMismatchCount() { return _mismatches; };
+
+protected:
+	const byte *_trace;
+	uint16_t _length;
+	bool _realTime;                 // Wait the recorded PICC response time
+	uint16_t _cursor = 0;
+	uint16_t _mismatches = 0;
+
+	virtual MFRC522::StatusCode PCD_DesfireTransceive(byte *sendData, byte sendLen, byte *backData, byte *backLen);
+	bool NextRecord(DesfireTrace::record_t *record);
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef DESFIRE_TRANSPORT_h
+#define DESFIRE_TRANSPORT_h
+
+#include <Arduino.h>
+#include <MFRC522.h>
+
+/* --------------------------------------
+* Frame Transport
+* --------------------------------------
+* Carries ISO/IEC 14443-4 frames (RATS, PPS and blocks, without CRC_A) between a DESFire
+* reader and a PICC. By default frames go through the MFRC522, set a transport with
+* DESFire::PCD_SetTransport() to exchange them with something else, such as another reader
+* chip or an in-process DesfireSimulatedCard.
+*
+* A transport belongs to one DESFire instance, the DESFire class keeps all its state in the
+* instance and its sessions so several readers can run side by side.
+*/
+class DesfireTransport {
+public:
+	virtual ~DesfireTransport() {};
+
+	/**
+	 * Exchanges one frame, same contract as DESFire::PCD_DesfireTransceive().
+	 *
+	 * @return STATUS_OK on success, STATUS_TIMEOUT if the PICC did not answer, STATUS_??? otherwise.
+	 */
+	virtual MFRC522::StatusCode Transceive(byte *sendData, byte sendLen, byte *backData, byte *backLen) = 0;
+};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * --------------------------------------------------------------------------------------------------------------------
+ * Example sketch/program measuring the time of a lookup in a flash resident UID allow-list.
+ * --------------------------------------------------------------------------------------------------------------------
+ * This is a MFRC522 library example; for further details and other examples see: https://github.com/miguelbalboa/rfid
+ *
+ * Looks up UIDs in a list of LIST_COUNT entries kept in flash, half of them in the list and half not, with
+ * DesfireAllowList::Contains() and with a plain binary search over the same entries, and prints the average and maximum
+ * time and entries read per lookup for both. No reader is needed.
+ *
+ * The list is generated by the preprocessor: 7 byte UIDs of manufacturer 0x04, evenly spread with some jitter like
+ * the UIDs of a real fleet. A real list comes from tools/allowlist.py instead.
+ *
+ * @license Released into the public domain.
+ */
+
+#include <MFRC522.h>
+#include <Desfire.h>
+#include <DesfireAllowList.h>
+
+#define LOOKUP_COUNT    2000       // Lookups per search
+#define LIST_COUNT      1024       // Entries generated by UIDS_1024()
+
+// Entry i: bits 47..38 count up, bits 37..0 are a hash of i
+#define UID_VALUE(i)    ((((uint64_t)(i)) << 38) | ((((uint64_t)(i)) * 0x9E3779B97F4A7C15ULL) >> 26))
+#define UID_ENTRY(i)    0x04, (byte)(UID_VALUE(i) >> 40), (byte)(UID_VALUE(i) >> 32), (byte)(UID_VALUE(i) >> 24), \
+                        (byte)(UID_VALUE(i) >> 16), (byte)(UID_VALUE(i) >> 8), (byte)UID_VALUE(i)
+#define UIDS_2(i)       UID_ENTRY(i), UID_ENTRY((i) + 1)
+#define UIDS_4(i)       UIDS_2(i), UIDS_2((i) + 2)
+#define UIDS_8(i)       UIDS_4(i), UIDS_4((i) + 4)
+#define UIDS_16(i)      UIDS_8(i), UIDS_8((i) + 8)
+#define UIDS_32(i)      UIDS_16(i), UIDS_16((i) + 16)
+#define UIDS_64(i)      UIDS_32(i), UIDS_32((i) + 32)
+#define UIDS_128(i)     UIDS_64(i), UIDS_64((i) + 64)
+#define UIDS_256(i)     UIDS_128(i), UIDS_128((i) + 128)
+#define UIDS_512(i)     UIDS_256(i), UIDS_256((i) + 256)
+#define UIDS_1024(i)    UIDS_512(i), UIDS_512((i) + 512)
+
+const byte list_entries[] PROGMEM = { UIDS_1024(0) };
+const uint16_t list_count = LIST_COUNT;
+static_assert(sizeof(list_entries) == LIST_COUNT * MIFARE_UID_BYTES, "UIDS_1024() generates LIST_COUNT entries");
+
+DesfireAllowList list(list_entries, list_count);
+byte bisectReads;
+
+/**
+ * The plain binary search Contains() is measured against.
+ */
+bool bisect(const byte *uid) {
+  int32_t low = 0;
+  int32_t high = list_count - 1;
+  byte entry[MIFARE_UID_BYTES];
+
+  bisectReads = 0;
+  while (low <= high) {
+    int32_t middle = low + (high - low) / 2;
+    bisectReads++;
+    memcpy_P(entry, list_entries + (uint32_t)middle * MIFARE_UID_BYTES, MIFARE_UID_BYTES);
+    int comparison = memcmp(entry, uid, MIFARE_UID_BYTES);
+    if (comparison == 0)
+      return true;
+    if (comparison < 0)
+      low = middle + 1;
+    else
+      high = middle - 1;
+  }
+  return false;
+}
+
+/**
+ * Lookup n: an entry of the list for even n, a UID between two entries for odd n.
+ */
+void makeUid(uint16_t n, byte *uid) {
+  uint16_t index = (uint16_t)(n * 40503U) % list_count;
+  memcpy_P(uid, list_entries + (uint32_t)index * MIFARE_UID_BYTES, MIFARE_UID_BYTES);
+  if (n & 1)
+    uid[3] ^= 0x01;
+}
+
+void report(const __FlashStringHelper *name, unsigned long total, unsigned long longest, unsigned long reads, byte maxReads, uint16_t found) {
+  Serial.print(name);
+  Serial.print(total / LOOKUP_COUNT);
+  Serial.print(F(" us/lookup avg, "));
+  Serial.print(longest);
+  Serial.print(F(" us max, "));
+  Serial.print((float)reads / LOOKUP_COUNT, 1);
+  Serial.print(F(" reads avg, "));
+  Serial.print(maxReads);
+  Serial.print(F(" max, "));
+  Serial.print(found);
+  Serial.println(F(" found"));
+}
+
+void setup() {
+  Serial.begin(9600);   // Initialize serial communications with the PC
+  while (!Serial);    // Do nothing if no serial port is opened (added for Arduinos based on ATMEGA32U4)
+
+  byte uid[MIFARE_UID_BYTES];
+  unsigned long total, longest, reads;
+  byte maxReads;
+  uint16_t found;
+
+  Serial.print(list_count);
+  Serial.println(F(" UIDs in flash"));
+
+  total = longest = reads = 0;
+  maxReads = 0;
+  found = 0;
+  for (uint16_t n = 0; n < LOOKUP_COUNT; n++) {
+    makeUid(n, uid);
+    unsigned long started = micros();
+    found += list.Contains(uid);
+    unsigned long elapsed = micros() - started;
+    total += elapsed;
+    if (elapsed > longest)
+      longest = elapsed;
+    reads += list.GetLastReadCount();
+    if (list.GetLastReadCount() > maxReads)
+      maxReads = list.GetLastReadCount();
+  }
+  report(F("Contains() : "), total, longest, reads, maxReads, found);
+
+  total = longest = reads = 0;
+  maxReads = 0;
+  found = 0;
+  for (uint16_t n = 0; n < LOOKUP_COUNT; n++) {
+    makeUid(n, uid);
+    unsigned long started = micros();
+    found += bisect(uid);
+    unsigned long elapsed = micros() - started;
+    total += elapsed;
+    if (elapsed > longest)
+      longest = elapsed;
+    reads += bisectReads;
+    if (bisectReads > maxReads)
+      maxReads = bisectReads;
+  }
+  report(F("Bisection  : "), total, longest, reads, maxReads, found);
+}
+
+void loop() {
+}
@@ -0,0 +1,119 @@
+/*
+ * --------------------------------------------------------------------------------------------------------------------
+ * Example sketch/program measuring the end-to-end latency of a DESFire AES authentication.
+ * --------------------------------------------------------------------------------------------------------------------
+ * This is a MFRC522 library example; for further details and other examples see: https://github.com/miguelbalboa/rfid
+ *
+ * Authenticates with an AES key of an application a number of times, first with the crypto run between the frames
+ * (PCD_SetCryptoOverlap(false)) and then with the crypto overlapped with the frames on air, and prints the average
+ * time per authentication for both. The saving is the CPU time of the key schedules, RndA and the expected answer:
+ * a few ms with the software AES of an 8-bit AVR, close to nothing on a fast board.
+ *
+ * Set AID, KEY_NUMBER and key below to an application and AES key of your card, a blank PICC master key is a DES key
+ * and cannot be used.
+ *
+ * @license Released into the public domain.
+ *
+ * Typical pin layout used:
+ * -----------------------------------------------------------------------------------------
+ *             MFRC522      Arduino       Arduino   Arduino    Arduino          Arduino
+ *             Reader/PCD   Uno/101       Mega      Nano v3    Leonardo/Micro   Pro Micro
+ * Signal      Pin          Pin           Pin       Pin        Pin              Pin
+ * -----------------------------------------------------------------------------------------
+ * RST/Reset   RST          9             5         D9         RESET/ICSP-5     RST
+ * SPI SS      SDA(SS)      10            53        D10        10               10
+ * SPI MOSI    MOSI         11 / ICSP-4   51        D11        ICSP-4           16
+ * SPI MISO    MISO         12 / ICSP-1   50        D12        ICSP-1           14
+ * SPI SCK     SCK          13 / ICSP-3   52        D13        ICSP-3           15
+ */
+
+#include <SPI.h>
+#include <MFRC522.h>
+#include <Desfire.h>
+
+#define RST_PIN         9          // Configurable, see typical pin layout above
+#define SS_PIN          10         // Configurable, see typical pin layout above
+
+#define AUTH_COUNT      20         // Authentications per mode
+#define KEY_NUMBER      0x00       // AES key of the application
+
+DESFire mfrc522(SS_PIN, RST_PIN);  // Create MFRC522 instance
+
+DESFire::mifare_desfire_aid_t aid = { { 0x01, 0x02, 0x03 } };
+const byte key[16] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+/**
+ * @return The average time of an authentication in us, 0 if one failed.
+ */
+unsigned long benchmark(DESFire::DesfireSession *tag, bool overlap) {
+  mfrc522.PCD_SetCryptoOverlap(overlap);
+
+  unsigned long started = micros();
+  for (int i = 0; i < AUTH_COUNT; i++) {
+    DESFire::StatusCode response = mfrc522.MIFARE_DESFIRE_AuthenticateAES(tag, KEY_NUMBER, key);
+    if ( ! mfrc522.IsStatusCodeOK(response)) {
+      Serial.print(F("Authentication failed: "));
+      Serial.println(mfrc522.GetStatusCodeName(response));
+      return 0;
+    }
+  }
+
+  return (micros() - started) / AUTH_COUNT;
+}
+
+void setup() {
+  Serial.begin(9600);   // Initialize serial communications with the PC
+  while (!Serial);    // Do nothing if no serial port is opened (added for Arduinos based on ATMEGA32U4)
+  SPI.begin();      // Init SPI bus
+  mfrc522.PCD_Init();   // Init MFRC522
+  randomSeed(analogRead(0));  // RndA, see PCD_DesfireRandom()
+  Serial.println(F("Scan a DESFire PICC to benchmark AES authentications..."));
+}
+
+void loop() {
+  // Look for new cards
+  if ( ! mfrc522.PICC_IsNewCardPresent()) {
+    return;
+  }
+
+  // Select one of the cards
+  if ( ! mfrc522.PICC_ReadCardSerial()) {
+    return;
+  }
+
+  if (mfrc522.uid.sak != 0x20) {
+    mfrc522.PICC_HaltA();
+    return;
+  }
+
+  DESFire::DesfireSession tag;
+  DESFire::StatusCode response;
+
+  byte ats[16];
+  byte atsLength = 16;
+  response.desfire = DESFire::MF_OPERATION_OK;
+  response.mfrc522 = mfrc522.PICC_RequestATS(&tag, ats, &atsLength);
+  if (mfrc522.IsStatusCodeOK(response))
+    response = mfrc522.MIFARE_DESFIRE_SelectApplication(&tag, &aid);
+  if ( ! mfrc522.IsStatusCodeOK(response)) {
+    Serial.print(F("Failed to select the application: "));
+    Serial.println(mfrc522.GetStatusCodeName(response));
+    mfrc522.PICC_HaltA();
+    return;
+  }
+
+  unsigned long sequentialTime = benchmark(&tag, false);
+  unsigned long overlappedTime = benchmark(&tag, true);
+
+  if (sequentialTime != 0 && overlappedTime != 0) {
+    Serial.print(F("Crypto between frames : "));
+    Serial.print(sequentialTime);
+    Serial.println(F(" us/authentication"));
+    Serial.print(F("Crypto overlapped     : "));
+    Serial.print(overlappedTime);
+    Serial.println(F(" us/authentication"));
+  }
+
+  mfrc522.PICC_HaltA();
+  Serial.println();
+}
@@ -0,0 +1,134 @@
+/*
+ * --------------------------------------------------------------------------------------------------------------------
+ * Example sketch/program showing the frames learned card profiles save, on simulated cards.
+ * --------------------------------------------------------------------------------------------------------------------
+ * This is a MFRC522 library example; for further details and other examples see: https://github.com/miguelbalboa/rfid
+ *
+ * Taps two DesfireSimulatedCards in turn on a reader reading a 32 byte ticket with DesfireProfiles: a ticket card
+ * holding the file and a blank card of the same kind (same ATS, SAK and manufacturer) that does not. The first tap is
+ * discovered (GetVersion, select, read: 5 frames), the next ones of the ticket card are read right away (2 frames). A
+ * blank card answers the speculative read with an error, which is kept, and only GetVersion follows: never more than
+ * the 5 frames of discovery, 4 here as the select already fails. Each tap prints the path taken, the frames exchanged
+ * and the time spent, each round the frames against reading every tap after GetVersion.
+ *
+ * @license Released into the public domain.
+ */
+
+#include <MFRC522.h>
+#include <Desfire.h>
+#include <DesfireProfiles.h>
+#include <DesfireSimulatedCard.h>
+
+#define TICKET_SIZE     32
+#define DISCOVERY_FRAMES 5         // GetVersion (3 frames), select and read
+
+const byte ticketUid[MIFARE_UID_BYTES] = { 0x04, 0x54, 0x49, 0x43, 0x4B, 0x00, 0x01 };
+const byte blankUid[MIFARE_UID_BYTES] = { 0x04, 0x42, 0x4C, 0x41, 0x4E, 0x4B, 0x01 };
+
+DESFire reader;
+DesfireSimulatedCard ticketCard(ticketUid);
+DesfireSimulatedCard blankCard(blankUid);
+DesfireProfiles profiles;
+
+DESFire::mifare_desfire_aid_t ticketing = { { 0x01, 0x02, 0x03 } };
+
+DESFire::mifare_desfire_application_layout_t applications[] = {
+  { { { 0x01, 0x02, 0x03 } }, 0x0F, 1 },
+};
+
+DESFire::mifare_desfire_file_layout_t files[] = {
+  { { { 0x01, 0x02, 0x03 } }, 0x01, { DESFire::MDFT_STANDARD_DATA_FILE, DESFire::MDCM_PLAIN, 0xEEEE, { { TICKET_SIZE } } } },
+};
+
+// Cards in the order they are tapped: T the ticket card, B the blank one
+const char taps[] = "TTTBTTBBTT";
+
+/**
+ * Brings card into the field and activates it, as anticollision and RATS would.
+ */
+bool present(DesfireSimulatedCard *card, const byte *uid, DESFire::DesfireSession *tag, byte *ats, byte *atsLength) {
+  reader.PCD_SetTransport(card);
+  reader.uid.size = MIFARE_UID_BYTES;
+  reader.uid.sak = 0x20;
+  memcpy(reader.uid.uidByte, uid, MIFARE_UID_BYTES);
+  return reader.PICC_RequestATS(tag, ats, atsLength) == MFRC522::STATUS_OK;
+}
+
+void setup() {
+  Serial.begin(9600);   // Initialize serial communications with the PC
+  while (!Serial);    // Do nothing if no serial port is opened (added for Arduinos based on ATMEGA32U4)
+
+  byte frames[32];
+  byte ticket[TICKET_SIZE];
+  byte ats[16];
+  byte atsLength = sizeof(ats);
+  uint16_t failedStep = 0;
+  DESFire::DesfireSession tag;
+  DESFire::mifare_desfire_compiled_layout_t layout;
+  DESFire::StatusCode response;
+
+  layout.frames = frames;
+  layout.capacity = sizeof(frames);
+  reader.PICC_MifareDesfireCompileLayout(applications, 1, files, 1, &layout);
+
+  response.desfire = DESFire::MF_OPERATION_OK;
+  response.mfrc522 = present(&ticketCard, ticketUid, &tag, ats, &atsLength) ? MFRC522::STATUS_OK : MFRC522::STATUS_TIMEOUT;
+  if (reader.IsStatusCodeOK(response))
+    response = reader.PICC_MifareDesfirePersonalize(&tag, &layout, &failedStep);
+  if ( ! reader.IsStatusCodeOK(response)) {
+    Serial.print(F("Failed to personalize the ticket card: "));
+    Serial.println(reader.GetStatusCodeName(response));
+    while (true);
+  }
+  for (byte i = 0; i < TICKET_SIZE; i++)
+    ticket[i] = i;
+  ticketCard.WriteData(ticketing.data, 0x01, 0, ticket, TICKET_SIZE);
+
+  profiles.SetTarget(&ticketing, 0x01, 0, TICKET_SIZE);
+}
+
+void loop() {
+  uint16_t frames = 0;
+  byte tapCount = sizeof(taps) - 1;
+
+  for (byte t = 0; t < tapCount; t++) {
+    DESFire::DesfireSession tag;
+    byte ticket[TICKET_SIZE];
+    byte ats[16];
+    byte atsLength = sizeof(ats);
+    bool blank = (taps[t] == 'B');
+
+    if ( ! present(blank ? &blankCard : &ticketCard, blank ? blankUid : ticketUid, &tag, ats, &atsLength)) {
+      Serial.println(F("No answer to RATS"));
+      continue;
+    }
+
+    DESFire::StatusCode response = profiles.Read(&reader, &tag, ats, atsLength, ticket);
+    DesfireProfiles::report_t *report = profiles.GetLastReport();
+    frames += report->exchanges;
+
+    Serial.print(blank ? F("Blank card : ") : F("Ticket card: "));
+    if ( ! report->speculative)
+      Serial.print(F("discovered,  "));
+    else if (report->hit)
+      Serial.print(F("known, hit,  "));
+    else
+      Serial.print(F("known, miss, "));
+    Serial.print(report->exchanges);
+    Serial.print(F(" frames, "));
+    Serial.print(report->elapsed);
+    Serial.print(F(" us, "));
+    Serial.println(reader.GetStatusCodeName(response));
+  }
+
+  Serial.print(F("Round of "));
+  Serial.print(tapCount);
+  Serial.print(F(" taps: "));
+  Serial.print(frames);
+  Serial.print(F(" frames, "));
+  Serial.print(tapCount * DISCOVERY_FRAMES);
+  Serial.println(F(" without profiles"));
+  Serial.println();
+
+  delay(5000);
+}
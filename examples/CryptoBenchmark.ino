@@ -0,0 +1,73 @@
+/*
+ * --------------------------------------------------------------------------------------------------------------------
+ * Example sketch/program comparing the DESFire crypto backends.
+ * --------------------------------------------------------------------------------------------------------------------
+ * This is a MFRC522 library example; for further details and other examples see: https://github.com/miguelbalboa/rfid
+ *
+ * Times the AES work of two DESFire workloads for every backend built in, no reader is needed:
+ *  - AES authentication: key schedule, RndB deciphered, RndA + RndB' enciphered, RndA' deciphered and the session key
+ *    schedule with its CMAC subkeys,
+ *  - MACed read: CMAC of 256 bytes of data plus the status byte.
+ * DesfireSoftwareAES runs everywhere, DesfireAESNI is added when the sketch is built for x86 with -maes.
+ *
+ * @license Released into the public domain.
+ */
+
+#include <DesfireCrypto.h>
+
+#define RUN_COUNT       100        // Workloads run per backend
+
+const byte key[16] = { 0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C };
+byte data[257];
+
+template <class Backend>
+void benchmark(const __FlashStringHelper *name) {
+  DesfireCipher<Backend> cipher;
+  byte buffer[32];
+  byte iv[16];
+
+  // AES authentication, reader side
+  unsigned long started = micros();
+  for (int i = 0; i < RUN_COUNT; i++) {
+    cipher.SetKey(key);
+    memset(iv, 0, sizeof(iv));
+    memcpy(buffer, data, 16);
+    cipher.DecryptCBC(buffer, 16, iv);
+    cipher.EncryptCBC(buffer, 32, iv);
+    cipher.DecryptCBC(buffer, 16, iv);
+    cipher.SetKey(buffer);
+  }
+  unsigned long authTime = micros() - started;
+
+  // MACed read of 256 bytes
+  cipher.SetKey(key);
+  memset(iv, 0, sizeof(iv));
+  started = micros();
+  for (int i = 0; i < RUN_COUNT; i++)
+    cipher.CMAC(data, sizeof(data), iv);
+  unsigned long macTime = micros() - started;
+
+  Serial.print(name);
+  Serial.print(F(": authentication "));
+  Serial.print(authTime / RUN_COUNT);
+  Serial.print(F(" us, MACed read of 256 bytes "));
+  Serial.print(macTime / RUN_COUNT);
+  Serial.println(F(" us"));
+}
+
+void setup() {
+  Serial.begin(9600);   // Initialize serial communications with the PC
+  while (!Serial);    // Do nothing if no serial port is opened (added for Arduinos based on ATMEGA32U4)
+
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = i;
+}
+
+void loop() {
+  benchmark<DesfireSoftwareAES>(F("DesfireSoftwareAES"));
+#ifdef DESFIRE_HAVE_AESNI
+  benchmark<DesfireAESNI>(F("DesfireAESNI      "));
+#endif
+  Serial.println();
+  delay(1000);
+}
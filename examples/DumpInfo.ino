@@ -71,19 +71,15 @@ void loop() {
   // Show an extra line
   Serial.println();
 
-  DESFire::mifare_desfire_tag tag;
+  DESFire::DesfireSession tag;
   DESFire::StatusCode response;
 
-  tag.pcb = 0x0A;
-  tag.cid = 0x00;
-  memset(tag.selected_application, 0, 3);
-
   // Make sure none DESFire status codes have DESFireStatus code to OK
   response.desfire = DESFire::MF_OPERATION_OK;
   
   byte ats[16];
   byte atsLength = 16;
-  response.mfrc522 = mfrc522.PICC_RequestATS(ats, &atsLength);
+  response.mfrc522 = mfrc522.PICC_RequestATS(&tag, ats, &atsLength);
   if ( ! mfrc522.IsStatusCodeOK(response)) {
     Serial.println(F("Failed to get ATS!"));
     Serial.println(mfrc522.GetStatusCodeName(response));
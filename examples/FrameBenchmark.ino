@@ -0,0 +1,113 @@
+/*
+ * --------------------------------------------------------------------------------------------------------------------
+ * Example sketch/program measuring the time spent per DESFire frame.
+ * --------------------------------------------------------------------------------------------------------------------
+ * This is a MFRC522 library example; for further details and other examples see: https://github.com/miguelbalboa/rfid
+ *
+ * Sends the same GetKeySettings command to the PICC master application a number of times, first through the generic
+ * MFRC522 path (PCD_CalculateCRC + PCD_TransceiveData) and then through the DESFire frame path (single FIFO burst and
+ * hardware CRC_A), and prints the average time per frame for both.
+ *
+ * @license Released into the public domain.
+ *
+ * Typical pin layout used:
+ * -----------------------------------------------------------------------------------------
+ *             MFRC522      Arduino       Arduino   Arduino    Arduino          Arduino
+ *             Reader/PCD   Uno/101       Mega      Nano v3    Leonardo/Micro   Pro Micro
+ * Signal      Pin          Pin           Pin       Pin        Pin              Pin
+ * -----------------------------------------------------------------------------------------
+ * RST/Reset   RST          9             5         D9         RESET/ICSP-5     RST
+ * SPI SS      SDA(SS)      10            53        D10        10               10
+ * SPI MOSI    MOSI         11 / ICSP-4   51        D11        ICSP-4           16
+ * SPI MISO    MISO         12 / ICSP-1   50        D12        ICSP-1           14
+ * SPI SCK     SCK          13 / ICSP-3   52        D13        ICSP-3           15
+ */
+
+#include <SPI.h>
+#include <MFRC522.h>
+#include <Desfire.h>
+
+#define RST_PIN         9          // Configurable, see typical pin layout above
+#define SS_PIN          10         // Configurable, see typical pin layout above
+
+#define FRAME_COUNT     100        // Number of frames sent through each path
+
+DESFire mfrc522(SS_PIN, RST_PIN);  // Create MFRC522 instance
+
+void setup() {
+  Serial.begin(9600);   // Initialize serial communications with the PC
+  while (!Serial);    // Do nothing if no serial port is opened (added for Arduinos based on ATMEGA32U4)
+  SPI.begin();      // Init SPI bus
+  mfrc522.PCD_Init();   // Init MFRC522
+  Serial.println(F("Scan a DESFire PICC to benchmark frame exchanges..."));
+}
+
+void loop() {
+  // Look for new cards
+  if ( ! mfrc522.PICC_IsNewCardPresent()) {
+    return;
+  }
+
+  // Select one of the cards
+  if ( ! mfrc522.PICC_ReadCardSerial()) {
+    return;
+  }
+
+  if (mfrc522.uid.sak != 0x20) {
+    mfrc522.PICC_HaltA();
+    return;
+  }
+
+  DESFire::DesfireSession tag;
+  DESFire::StatusCode response;
+
+  byte ats[16];
+  byte atsLength = 16;
+  response.desfire = DESFire::MF_OPERATION_OK;
+  response.mfrc522 = mfrc522.PICC_RequestATS(&tag, ats, &atsLength);
+  if ( ! mfrc522.IsStatusCodeOK(response)) {
+    Serial.println(F("Failed to get ATS!"));
+    mfrc522.PICC_HaltA();
+    return;
+  }
+
+  // Generic MFRC522 path: CRC coprocessor round trip plus PCD_TransceiveData()
+  byte buffer[64];
+  byte bufferSize;
+  unsigned int failures = 0;
+  unsigned long started = micros();
+  for (int i = 0; i < FRAME_COUNT; i++) {
+    buffer[0] = tag.pcb;
+    buffer[1] = tag.cid;
+    buffer[2] = 0x45;  // GetKeySettings
+    tag.pcb ^= 0x01;
+    bufferSize = sizeof(buffer);
+    if (mfrc522.PCD_CalculateCRC(buffer, 3, &buffer[3]) != MFRC522::STATUS_OK ||
+        mfrc522.PCD_TransceiveData(buffer, 5, buffer, &bufferSize) != MFRC522::STATUS_OK)
+      failures++;
+  }
+  unsigned long genericTime = micros() - started;
+
+  // DESFire frame path
+  byte settings;
+  byte maxKeys;
+  started = micros();
+  for (int i = 0; i < FRAME_COUNT; i++) {
+    response = mfrc522.MIFARE_DESFIRE_GetKeySettings(&tag, &settings, &maxKeys);
+    if ( ! mfrc522.IsStatusCodeOK(response))
+      failures++;
+  }
+  unsigned long desfireTime = micros() - started;
+
+  Serial.print(F("Generic path       : "));
+  Serial.print(genericTime / FRAME_COUNT);
+  Serial.println(F(" us/frame"));
+  Serial.print(F("DESFire frame path : "));
+  Serial.print(desfireTime / FRAME_COUNT);
+  Serial.println(F(" us/frame"));
+  Serial.print(F("Failed frames      : "));
+  Serial.println(failures);
+
+  mfrc522.PICC_HaltA();
+  Serial.println();
+}
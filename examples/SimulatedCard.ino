@@ -0,0 +1,132 @@
+/*
+ * --------------------------------------------------------------------------------------------------------------------
+ * Example sketch/program running DESFire sessions against simulated cards, without a reader or a card.
+ * --------------------------------------------------------------------------------------------------------------------
+ * This is a MFRC522 library example; for further details and other examples see: https://github.com/miguelbalboa/rfid
+ *
+ * Every reader gets its own DESFire instance, session and DesfireSimulatedCard as frame transport, nothing is shared
+ * between them. The cards are personalized once with a compiled layout, then each loop takes a census of every card
+ * and syncs one application, printing the frames exchanged and the time spent per reader.
+ *
+ * Useful to try sketches and measure the CPU time of the library itself, the simulated cards answer instantly. Each
+ * simulated card takes a few KB of RAM, use a board with enough of it (Mega, Due, ESP32...).
+ *
+ * @license Released into the public domain.
+ */
+
+#include <MFRC522.h>
+#include <Desfire.h>
+#include <DesfireSimulatedCard.h>
+
+#define READER_COUNT    2          // Independent readers, each with its own simulated card
+
+DESFire readers[READER_COUNT];
+DesfireSimulatedCard *cards[READER_COUNT];
+DESFire::DesfireSession sessions[READER_COUNT];
+DESFire::mifare_desfire_fingerprint_t fingerprints[READER_COUNT];
+
+DESFire::mifare_desfire_aid_t ticketing = { { 0x01, 0x02, 0x03 } };
+
+DESFire::mifare_desfire_application_layout_t applications[] = {
+  { { { 0x01, 0x02, 0x03 } }, 0x0F, 2 },
+};
+
+DESFire::mifare_desfire_file_layout_t files[] = {
+  { { { 0x01, 0x02, 0x03 } }, 0x01, { DESFire::MDFT_STANDARD_DATA_FILE, DESFire::MDCM_PLAIN, 0xEEEE, { { 32 } } } },
+  { { { 0x01, 0x02, 0x03 } }, 0x02, { DESFire::MDFT_VALUE_FILE_WITH_BACKUP, DESFire::MDCM_PLAIN, 0xEEEE, { { 0 } } } },
+  { { { 0x01, 0x02, 0x03 } }, 0x03, { DESFire::MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP, DESFire::MDCM_PLAIN, 0xEEEE, { { 16 } } } },
+};
+
+byte frames[64];
+DESFire::mifare_desfire_compiled_layout_t layout;
+
+void setup() {
+  Serial.begin(9600);   // Initialize serial communications with the PC
+  while (!Serial);    // Do nothing if no serial port is opened (added for Arduinos based on ATMEGA32U4)
+
+  // Value file between 0 and 10000, cyclic file of 6 records (5 usable)
+  files[1].settings.settings.value_file.upper_limit = 10000;
+  files[2].settings.settings.record_file.max_number_of_records = 6;
+
+  layout.frames = frames;
+  layout.capacity = sizeof(frames);
+  if (readers[0].PICC_MifareDesfireCompileLayout(applications, 1, files, 3, &layout) != MFRC522::STATUS_OK) {
+    Serial.println(F("Failed to compile the layout!"));
+    while (true);
+  }
+
+  for (byte r = 0; r < READER_COUNT; r++) {
+    byte uid[MIFARE_UID_BYTES] = { 0x04, 0x53, 0x49, 0x4D, 0x00, 0x00, (byte)(r + 1) };
+    byte ats[16];
+    byte atsLength = sizeof(ats);
+
+    cards[r] = new DesfireSimulatedCard(uid);
+    readers[r].PCD_SetTransport(cards[r]);
+
+    // There is no anticollision, the UID is the one the card was built with
+    readers[r].uid.size = MIFARE_UID_BYTES;
+    memcpy(readers[r].uid.uidByte, uid, MIFARE_UID_BYTES);
+
+    uint16_t failedStep = 0;
+    DESFire::StatusCode response;
+    response.desfire = DESFire::MF_OPERATION_OK;
+    response.mfrc522 = readers[r].PICC_RequestATS(&sessions[r], ats, &atsLength);
+    if (readers[r].IsStatusCodeOK(response))
+      response = readers[r].PICC_MifareDesfirePersonalize(&sessions[r], &layout, &failedStep);
+    if ( ! readers[r].IsStatusCodeOK(response)) {
+      Serial.print(F("Failed to personalize card "));
+      Serial.print(r);
+      Serial.print(F(" at step "));
+      Serial.print(failedStep);
+      Serial.print(F(": "));
+      Serial.println(readers[r].GetStatusCodeName(response));
+    }
+    memset(&fingerprints[r], 0, sizeof(fingerprints[r]));
+  }
+
+  Serial.print(F("Personalized "));
+  Serial.print(layout.cards);
+  Serial.print(F(" simulated cards, "));
+  Serial.print(DESFire::GetCardsPerMinute(&layout));
+  Serial.println(F(" cards per minute."));
+}
+
+void loop() {
+  static DESFire::mifare_desfire_census_t census;
+  static DESFire::mifare_desfire_application_census_t censusApplications[sizeof(applications) / sizeof(applications[0])];
+  static byte record[16];
+  DESFire::mifare_desfire_sync_diff_t diff;
+  byte buffer[128];
+
+  census.applications = censusApplications;
+  census.capacity = sizeof(censusApplications) / sizeof(censusApplications[0]);
+  for (byte r = 0; r < READER_COUNT; r++) {
+    // Another terminal used the card since the last sync
+    record[0]++;
+    cards[r]->AppendRecord(ticketing.data, 0x03, record);
+    cards[r]->SetValue(ticketing.data, 0x02, record[0]);
+
+    diff.change_count = 0;
+    uint32_t exchanges = readers[r].GetExchangeCount();
+    unsigned long started = micros();
+    DESFire::StatusCode response = readers[r].PICC_MifareDesfireCensus(&sessions[r], &census);
+    if (readers[r].IsStatusCodeOK(response))
+      response = readers[r].PICC_MifareDesfireSync(&sessions[r], &ticketing, &fingerprints[r], &diff, buffer, sizeof(buffer));
+    unsigned long elapsed = micros() - started;
+
+    Serial.print(F("Reader "));
+    Serial.print(r);
+    Serial.print(F(": "));
+    Serial.print(readers[r].GetStatusCodeName(response));
+    Serial.print(F(", "));
+    Serial.print(readers[r].GetExchangeCount() - exchanges);
+    Serial.print(F(" frames, "));
+    Serial.print(diff.change_count);
+    Serial.print(F(" changes, "));
+    Serial.print(elapsed);
+    Serial.println(F(" us"));
+  }
+
+  Serial.println();
+  delay(1000);
+}
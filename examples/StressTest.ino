@@ -0,0 +1,447 @@
+/*
+ * --------------------------------------------------------------------------------------------------------------------
+ * Example sketch/program stressing every enumeration and read function with a fully populated simulated card.
+ * --------------------------------------------------------------------------------------------------------------------
+ * This is a MFRC522 library example; for further details and other examples see: https://github.com/miguelbalboa/rfid
+ *
+ * Personalizes a DesfireSimulatedCard with as many applications and files as it holds, all file types, record files
+ * filled up to their maximum number of records and the whole memory in use. Then runs every enumeration and read
+ * function against it, natively and wrapped in ISO 7816-4 APDUs, and checks every answer against the layout: a missing,
+ * extra or truncated entry, or a write past the end of an output buffer, fails the step. For each step it prints the
+ * frames exchanged, the time spent and the peak stack used.
+ *
+ * The simulated card holds 8 applications of 8 files in 512 bytes by default. For a full card (28 applications of 16
+ * files in 8 KB, about 30 KB of RAM in all) build the library with
+ *   -DDESFIRE_SIM_MAX_APPLICATIONS=28 -DDESFIRE_SIM_MAX_FILES=16 -DDESFIRE_SIM_MEMORY=8192
+ * as a build flag of the whole project (defining them in the sketch only does not change the library), on a board with
+ * enough RAM or on a host build of the Arduino core.
+ *
+ * @license Released into the public domain.
+ */
+
+#include <MFRC522.h>
+#include <Desfire.h>
+#include <DesfireSimulatedCard.h>
+
+#define APPLICATION_COUNT  ((DESFIRE_SIM_MAX_APPLICATIONS < MIFARE_MAX_APPLICATION_COUNT) ? DESFIRE_SIM_MAX_APPLICATIONS : MIFARE_MAX_APPLICATION_COUNT)
+#define FILE_COUNT         ((DESFIRE_SIM_MAX_FILES < MIFARE_MAX_FILE_COUNT) ? DESFIRE_SIM_MAX_FILES : MIFARE_MAX_FILE_COUNT)
+#define KEY_COUNT          14         // Keys per application, the maximum
+#define STACK_PAINT_SIZE   4096       // Bytes of stack watched below the step functions
+#define STACK_PAINT_GAP    256        // Bytes below run() left to its own frame and the paint/measure calls
+#define STACK_PAINT        0xA5
+#define CANARY             0x5A       // Written past the end of output buffers
+
+DESFire reader;
+DesfireSimulatedCard card;
+DESFire::DesfireSession tag;
+
+DESFire::mifare_desfire_application_layout_t applications[APPLICATION_COUNT];
+DESFire::mifare_desfire_file_layout_t files[APPLICATION_COUNT * FILE_COUNT];
+byte frames[APPLICATION_COUNT * 12 + APPLICATION_COUNT * FILE_COUNT * 19];
+DESFire::mifare_desfire_compiled_layout_t layout;
+
+DESFire::mifare_desfire_census_t census;
+DESFire::mifare_desfire_application_census_t censusApplications[APPLICATION_COUNT];
+DESFire::mifare_desfire_fingerprint_t fingerprints[APPLICATION_COUNT];
+DESFire::mifare_desfire_sync_diff_t diff;
+byte buffer[DESFIRE_SIM_MEMORY + 1];
+uint32_t fileSize;                    // Bytes of each data file, records of each record file
+unsigned int failures = 0;
+volatile byte *stackRegion;           // STACK_PAINT_SIZE bytes of free stack the steps grow into
+
+/**
+ * File f of every application: standard, backup, value, linear record, cyclic record, standard...
+ */
+DESFire::mifare_desfire_file_types fileType(byte f) {
+  static const DESFire::mifare_desfire_file_types types[] = {
+    DESFire::MDFT_STANDARD_DATA_FILE, DESFire::MDFT_BACKUP_DATA_FILE, DESFire::MDFT_VALUE_FILE_WITH_BACKUP,
+    DESFire::MDFT_LINEAR_RECORD_FILE_WITH_BACKUP, DESFire::MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP
+  };
+  return types[f % 5];
+}
+
+byte pattern(byte a, byte f, uint32_t i) {
+  return (byte)(a * 31 + f * 7 + i);
+}
+
+bool fail(const __FlashStringHelper *what, byte a = 0xFF, byte f = 0xFF) {
+  Serial.print(F("  FAIL: "));
+  Serial.print(what);
+  if (a != 0xFF) {
+    Serial.print(F(" application "));
+    Serial.print(a);
+  }
+  if (f != 0xFF) {
+    Serial.print(F(" file "));
+    Serial.print(f);
+  }
+  Serial.println();
+  return false;
+}
+
+bool checkStatus(DESFire::StatusCode response, const __FlashStringHelper *what, byte a = 0xFF, byte f = 0xFF) {
+  if (reader.IsStatusCodeOK(response))
+    return true;
+  fail(what, a, f);
+  Serial.print(F("        "));
+  Serial.println(reader.GetStatusCodeName(response));
+  return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Stack usage: paint the free stack below the caller, run the step, count the bytes it changed
+/////////////////////////////////////////////////////////////////////////////////////
+void __attribute__((noinline)) paintStack(volatile byte *top) {
+  stackRegion = (volatile byte *)((uintptr_t)top - STACK_PAINT_GAP - STACK_PAINT_SIZE);
+  for (size_t i = 0; i < STACK_PAINT_SIZE; i++)
+    stackRegion[i] = STACK_PAINT;
+}
+
+/**
+ * Bytes of stack used below top since paintStack(), counted from the deepest painted byte up.
+ */
+size_t __attribute__((noinline)) measureStack() {
+  size_t untouched = 0;
+  while (untouched < STACK_PAINT_SIZE && stackRegion[untouched] == STACK_PAINT)
+    untouched++;
+  return STACK_PAINT_GAP + STACK_PAINT_SIZE - untouched;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Steps
+/////////////////////////////////////////////////////////////////////////////////////
+DESFire::mifare_desfire_aid_t piccAid = { { 0x00, 0x00, 0x00 } };
+
+bool stepVersion() {
+  DESFire::MIFARE_DESFIRE_Version_t version;
+  uint32_t freeMemory;
+
+  if (!checkStatus(reader.MIFARE_DESFIRE_SelectApplication(&tag, &piccAid), F("SelectApplication")))
+    return false;
+  if (!checkStatus(reader.MIFARE_DESFIRE_GetVersion(&tag, &version), F("GetVersion")))
+    return false;
+  if (memcmp(version.uid, reader.uid.uidByte, MIFARE_UID_BYTES) != 0)
+    return fail(F("GetVersion UID"));
+  if (!checkStatus(reader.MIFARE_DESFIRE_GetFreeMemory(&tag, &freeMemory), F("GetFreeMemory")))
+    return false;
+  if (freeMemory != card.GetFreeMemory())
+    return fail(F("GetFreeMemory value"));
+  return true;
+}
+
+bool stepApplicationIds() {
+  DESFire::mifare_desfire_aid_t aids[MIFARE_MAX_APPLICATION_COUNT + 1];
+  byte applicationCount = 0;
+
+  memset(aids, CANARY, sizeof(aids));
+  if (!checkStatus(reader.MIFARE_DESFIRE_GetApplicationIds(&tag, aids, &applicationCount), F("GetApplicationIds")))
+    return false;
+  if (applicationCount != APPLICATION_COUNT)
+    return fail(F("GetApplicationIds count"));
+  for (byte a = 0; a < APPLICATION_COUNT; a++) {
+    if (memcmp(aids[a].data, applications[a].aid.data, MIFARE_AID_SIZE) != 0)
+      return fail(F("GetApplicationIds AID"), a);
+  }
+  for (byte i = 0; i < MIFARE_AID_SIZE; i++) {
+    if (aids[MIFARE_MAX_APPLICATION_COUNT].data[i] != CANARY)
+      return fail(F("GetApplicationIds overflow"));
+  }
+  return true;
+}
+
+bool stepDFNames() {
+  DESFire::mifare_desfire_df_name_t names[MIFARE_MAX_APPLICATION_COUNT];
+  byte nameCount = MIFARE_MAX_APPLICATION_COUNT;
+
+  // The simulated applications have no ISO names
+  if (!checkStatus(reader.MIFARE_DESFIRE_GetDFNames(&tag, names, &nameCount), F("GetDFNames")))
+    return false;
+  if (nameCount != 0)
+    return fail(F("GetDFNames count"));
+  return true;
+}
+
+bool stepApplications() {
+  for (byte a = 0; a < APPLICATION_COUNT; a++) {
+    byte settings, maxKeys, version;
+    byte fileIds[MIFARE_MAX_FILE_COUNT + 1];
+    byte fileCount = 0;
+
+    if (!checkStatus(reader.MIFARE_DESFIRE_SelectApplication(&tag, &applications[a].aid), F("SelectApplication"), a))
+      return false;
+    if (!checkStatus(reader.MIFARE_DESFIRE_GetKeySettings(&tag, &settings, &maxKeys), F("GetKeySettings"), a))
+      return false;
+    if (settings != applications[a].key_settings || maxKeys != applications[a].key_count)
+      return fail(F("GetKeySettings value"), a);
+    for (byte k = 0; k < KEY_COUNT; k++) {
+      if (!checkStatus(reader.MIFARE_DESFIRE_GetKeyVersion(&tag, k, &version), F("GetKeyVersion"), a))
+        return false;
+    }
+
+    memset(fileIds, CANARY, sizeof(fileIds));
+    if (!checkStatus(reader.MIFARE_DESFIRE_GetFileIDs(&tag, fileIds, &fileCount), F("GetFileIDs"), a))
+      return false;
+    if (fileCount != FILE_COUNT || fileIds[MIFARE_MAX_FILE_COUNT] != CANARY)
+      return fail(F("GetFileIDs count"), a);
+
+    for (byte f = 0; f < FILE_COUNT; f++) {
+      DESFire::mifare_desfire_file_settings_t settings;
+      if (fileIds[f] != f)
+        return fail(F("GetFileIDs ID"), a, f);
+      if (!checkStatus(reader.MIFARE_DESFIRE_GetFileSettings(&tag, &f, &settings), F("GetFileSettings"), a, f))
+        return false;
+      if (settings.file_type != fileType(f))
+        return fail(F("GetFileSettings type"), a, f);
+    }
+  }
+  return true;
+}
+
+bool stepReads() {
+  for (byte a = 0; a < APPLICATION_COUNT; a++) {
+    if (!checkStatus(reader.MIFARE_DESFIRE_SelectApplication(&tag, &applications[a].aid), F("SelectApplication"), a))
+      return false;
+
+    for (byte f = 0; f < FILE_COUNT; f++) {
+      size_t length = sizeof(buffer) - 1;
+      // A cyclic file keeps one record free
+      uint32_t expected = (fileType(f) == DESFire::MDFT_CYCLIC_RECORD_FILE_WITH_BACKUP) ? fileSize - 1 : fileSize;
+      int32_t value;
+
+      buffer[expected] = CANARY;
+      switch (fileType(f)) {
+        case DESFire::MDFT_STANDARD_DATA_FILE:
+        case DESFire::MDFT_BACKUP_DATA_FILE:
+          if (!checkStatus(reader.MIFARE_DESFIRE_ReadData(&tag, f, 0, 0, buffer, &length), F("ReadData"), a, f))
+            return false;
+          break;
+        case DESFire::MDFT_VALUE_FILE_WITH_BACKUP:
+          if (!checkStatus(reader.MIFARE_DESFIRE_GetValue(&tag, f, &value), F("GetValue"), a, f))
+            return false;
+          if (value != a * 100 + f)
+            return fail(F("GetValue value"), a, f);
+          continue;
+        default:
+          if (!checkStatus(reader.MIFARE_DESFIRE_ReadRecords(&tag, f, 0, 0, buffer, &length), F("ReadRecords"), a, f))
+            return false;
+          break;
+      }
+
+      if (length != expected || buffer[expected] != CANARY)
+        return fail(F("Read length"), a, f);
+      // Data files hold the pattern, record files the records still kept, oldest first
+      for (uint32_t i = 0; i < expected; i++) {
+        uint32_t index = (fileType(f) >= DESFire::MDFT_LINEAR_RECORD_FILE_WITH_BACKUP) ? fileSize - expected + i : i;
+        if (buffer[i] != pattern(a, f, index))
+          return fail(F("Read content"), a, f);
+      }
+    }
+  }
+  return true;
+}
+
+bool stepCensus() {
+  census.applications = censusApplications;
+  census.capacity = APPLICATION_COUNT;
+  if (!checkStatus(reader.PICC_MifareDesfireCensus(&tag, &census, DESFire::MDCF_FILE_SETTINGS | DESFire::MDCF_KEY_VERSIONS | DESFire::MDCF_DF_NAMES), F("Census")))
+    return false;
+  if (census.application_count != APPLICATION_COUNT)
+    return fail(F("Census application count"));
+  for (byte a = 0; a < APPLICATION_COUNT; a++) {
+    if (census.applications[a].file_count != FILE_COUNT)
+      return fail(F("Census file count"), a);
+    for (byte f = 0; f < FILE_COUNT; f++) {
+      if (census.applications[a].file_settings[f].file_type != fileType(f))
+        return fail(F("Census file settings"), a, f);
+    }
+  }
+  return true;
+}
+
+bool stepSync() {
+  for (byte a = 0; a < APPLICATION_COUNT; a++) {
+    if (!checkStatus(reader.PICC_MifareDesfireSync(&tag, &applications[a].aid, &fingerprints[a], &diff, buffer, sizeof(buffer)), F("Sync"), a))
+      return false;
+    if (diff.change_count != FILE_COUNT)
+      return fail(F("Sync changes"), a);
+  }
+  return true;
+}
+
+bool stepResync() {
+  for (byte a = 0; a < APPLICATION_COUNT; a++) {
+    if (!checkStatus(reader.PICC_MifareDesfireSync(&tag, &applications[a].aid, &fingerprints[a], &diff, buffer, sizeof(buffer)), F("Sync"), a))
+      return false;
+    if (diff.change_count != 0)
+      return fail(F("Resync changes"), a);
+  }
+  return true;
+}
+
+void run(const __FlashStringHelper *name, bool (*step)()) {
+  uint32_t exchanges = reader.GetExchangeCount();
+  volatile byte top = 0;
+
+  paintStack(&top);
+  unsigned long started = micros();
+  bool passed = step();
+  unsigned long elapsed = micros() - started;
+  size_t stack = measureStack();
+
+  if (!passed)
+    failures++;
+  Serial.print(passed ? F("  ok   ") : F("  FAIL "));
+  Serial.print(name);
+  Serial.print(F(": "));
+  Serial.print(reader.GetExchangeCount() - exchanges);
+  Serial.print(F(" frames, "));
+  Serial.print(elapsed);
+  Serial.print(F(" us, "));
+  Serial.print(stack);
+  Serial.println(F(" bytes of stack"));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+// Card
+/////////////////////////////////////////////////////////////////////////////////////
+bool personalize() {
+  byte ats[16];
+  byte atsLength = sizeof(ats);
+  uint16_t failedStep = 0;
+  uint16_t memoryFiles = 0;
+
+  for (byte f = 0; f < FILE_COUNT; f++) {
+    if (fileType(f) != DESFire::MDFT_VALUE_FILE_WITH_BACKUP)
+      memoryFiles++;
+  }
+  // The whole memory goes to the data and record files, one byte records
+  fileSize = DESFIRE_SIM_MEMORY / (APPLICATION_COUNT * memoryFiles);
+
+  for (byte a = 0; a < APPLICATION_COUNT; a++) {
+    DESFire::mifare_desfire_application_layout_t *application = &applications[a];
+    application->aid.data[0] = 0xF0;
+    application->aid.data[1] = 0x00;
+    application->aid.data[2] = a + 1;
+    application->key_settings = 0x0F;
+    application->key_count = KEY_COUNT;
+
+    for (byte f = 0; f < FILE_COUNT; f++) {
+      DESFire::mifare_desfire_file_layout_t *file = &files[a * FILE_COUNT + f];
+      memset(file, 0, sizeof(DESFire::mifare_desfire_file_layout_t));
+      file->aid = application->aid;
+      file->file_no = f;
+      file->settings.file_type = fileType(f);
+      file->settings.communication_settings = DESFire::MDCM_PLAIN;
+      file->settings.access_rights = 0xEEEE;
+      switch (fileType(f)) {
+        case DESFire::MDFT_STANDARD_DATA_FILE:
+        case DESFire::MDFT_BACKUP_DATA_FILE:
+          file->settings.settings.standard_file.file_size = fileSize;
+          break;
+        case DESFire::MDFT_VALUE_FILE_WITH_BACKUP:
+          file->settings.settings.value_file.lower_limit = 0;
+          file->settings.settings.value_file.upper_limit = 100000;
+          file->settings.settings.value_file.limited_credit_value = a * 100 + f;
+          break;
+        default:
+          file->settings.settings.record_file.record_size = 1;
+          file->settings.settings.record_file.max_number_of_records = fileSize;
+          break;
+      }
+    }
+  }
+
+  layout.frames = frames;
+  layout.capacity = sizeof(frames);
+  if (reader.PICC_MifareDesfireCompileLayout(applications, APPLICATION_COUNT, files, APPLICATION_COUNT * FILE_COUNT, &layout) != MFRC522::STATUS_OK)
+    return fail(F("CompileLayout"));
+
+  DESFire::StatusCode response;
+  response.desfire = DESFire::MF_OPERATION_OK;
+  response.mfrc522 = reader.PICC_RequestATS(&tag, ats, &atsLength);
+  if (!checkStatus(response, F("RequestATS")))
+    return false;
+  response = reader.PICC_MifareDesfirePersonalize(&tag, &layout, &failedStep);
+  if (!checkStatus(response, F("Personalize"))) {
+    Serial.print(F("        at step "));
+    Serial.println(failedStep);
+    return false;
+  }
+
+  // Content, written behind the reader's back
+  for (byte a = 0; a < APPLICATION_COUNT; a++) {
+    for (byte f = 0; f < FILE_COUNT; f++) {
+      switch (fileType(f)) {
+        case DESFire::MDFT_STANDARD_DATA_FILE:
+        case DESFire::MDFT_BACKUP_DATA_FILE:
+          for (uint32_t i = 0; i < fileSize; i++)
+            buffer[i] = pattern(a, f, i);
+          card.WriteData(applications[a].aid.data, f, 0, buffer, fileSize);
+          break;
+        case DESFire::MDFT_VALUE_FILE_WITH_BACKUP:
+          break;
+        default:
+          for (uint32_t i = 0; i < fileSize; i++) {
+            byte record = pattern(a, f, i);
+            card.AppendRecord(applications[a].aid.data, f, &record);
+          }
+          break;
+      }
+    }
+  }
+
+  Serial.print(F("Card: "));
+  Serial.print(APPLICATION_COUNT);
+  Serial.print(F(" applications of "));
+  Serial.print(FILE_COUNT);
+  Serial.print(F(" files, "));
+  Serial.print(fileSize);
+  Serial.print(F(" bytes or records per file, "));
+  Serial.print(card.GetFreeMemory());
+  Serial.print(F(" bytes free, "));
+  Serial.print(layout.steps);
+  Serial.println(F(" personalization steps"));
+  return true;
+}
+
+void setup() {
+  Serial.begin(9600);   // Initialize serial communications with the PC
+  while (!Serial);    // Do nothing if no serial port is opened (added for Arduinos based on ATMEGA32U4)
+
+  // There is no anticollision, the UID is the one the card was built with
+  static const byte uid[MIFARE_UID_BYTES] = { 0x04, 0x53, 0x49, 0x4D, 0x00, 0x00, 0x01 };
+  reader.uid.size = MIFARE_UID_BYTES;
+  memcpy(reader.uid.uidByte, uid, MIFARE_UID_BYTES);
+  reader.PCD_SetTransport(&card);
+
+  if (!personalize())
+    failures++;
+
+  for (byte wrapped = 0; wrapped < 2 && failures == 0; wrapped++) {
+    reader.MIFARE_DESFIRE_SetWrappedMode(wrapped);
+    memset(fingerprints, 0, sizeof(fingerprints));
+    Serial.println(wrapped ? F("Wrapped commands:") : F("Native commands:"));
+
+    run(F("GetVersion, GetFreeMemory"), stepVersion);
+    run(F("GetApplicationIds"), stepApplicationIds);
+    run(F("GetDFNames"), stepDFNames);
+    run(F("Key and file settings"), stepApplications);
+    run(F("ReadData, GetValue, ReadRecords"), stepReads);
+    run(F("Census"), stepCensus);
+    run(F("Sync"), stepSync);
+    run(F("Sync, unchanged"), stepResync);
+  }
+
+  Serial.print(F("Sizes: census "));
+  Serial.print(sizeof(census) + sizeof(censusApplications));
+  Serial.print(F(" bytes, fingerprint "));
+  Serial.print(sizeof(DESFire::mifare_desfire_fingerprint_t));
+  Serial.print(F(" bytes, sync diff "));
+  Serial.print(sizeof(diff));
+  Serial.println(F(" bytes"));
+
+  Serial.println(failures == 0 ? F("PASSED") : F("FAILED"));
+}
+
+void loop() {
+}
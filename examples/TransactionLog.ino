@@ -0,0 +1,209 @@
+/*
+ * --------------------------------------------------------------------------------------------------------------------
+ * Example sketch/program logging DESFire value transactions offline and uploading them later.
+ * --------------------------------------------------------------------------------------------------------------------
+ * This is a MFRC522 library example; for further details and other examples see: https://github.com/miguelbalboa/rfid
+ *
+ * Debits a value file of a DesfireSimulatedCard once per tap and appends each transaction to a DesfireLog, which only
+ * touches RAM. Idle time between taps flushes the pending records to storage, and every UPLOAD_EVERY taps the records
+ * not uploaded yet are read back, printed as the back-office would receive them and acknowledged so their slots can be
+ * reused. The storage is small on purpose, the log soon wraps around over the acknowledged records.
+ *
+ * By default the storage is a RAM "flash" of 64 byte sectors defined below, which runs on every board and goes
+ * through sector erases. Define LOG_IN_EEPROM to log to the Arduino EEPROM instead, which keeps the log across resets
+ * on boards that have one.
+ *
+ * @license Released into the public domain.
+ */
+
+#include <MFRC522.h>
+#include <Desfire.h>
+#include <DesfireLog.h>
+#include <DesfireSimulatedCard.h>
+
+//#define LOG_IN_EEPROM
+
+#define LOG_SIZE        512        // Bytes of storage for the log
+#define SECTOR_SIZE     64         // Erase unit of the RAM storage
+#define UPLOAD_EVERY    10         // Taps between two uploads
+
+#ifdef LOG_IN_EEPROM
+#include <DesfireLogEEPROM.h>
+
+DesfireEEPROMLogStorage storage(0, LOG_SIZE);
+#else
+/**
+ * Storage in RAM behaving like flash: sectors must be erased (0xFF) before they are written.
+ */
+class RamFlashStorage : public DesfireLogStorage {
+public:
+  virtual uint32_t GetSize() { return LOG_SIZE; };
+  virtual uint16_t GetSectorSize() { return SECTOR_SIZE; };
+  virtual void Read(uint32_t address, byte *data, uint16_t length) { memcpy(data, _memory + address, length); };
+  virtual void Write(uint32_t address, const byte *data, uint16_t length) {
+    for (uint16_t i = 0; i < length; i++)
+      _memory[address + i] &= data[i];
+  };
+  virtual void EraseSector(uint32_t address) {
+    memset(_memory + address - (address % SECTOR_SIZE), 0xFF, SECTOR_SIZE);
+    erases++;
+  };
+
+  uint16_t erases = 0;
+
+protected:
+  byte _memory[LOG_SIZE];
+};
+
+RamFlashStorage storage;
+#endif
+
+const byte uid[MIFARE_UID_BYTES] = { 0x04, 0x4C, 0x4F, 0x47, 0x00, 0x00, 0x01 };
+
+DESFire reader;
+DesfireSimulatedCard card(uid);
+DESFire::DesfireSession tag;
+DesfireLog transactions(&storage);
+
+DESFire::mifare_desfire_aid_t purse = { { 0x01, 0x02, 0x03 } };
+
+DESFire::mifare_desfire_application_layout_t applications[] = {
+  { { { 0x01, 0x02, 0x03 } }, 0x0F, 1 },
+};
+
+DESFire::mifare_desfire_file_layout_t files[] = {
+  { { { 0x01, 0x02, 0x03 } }, 0x01, { DESFire::MDFT_VALUE_FILE_WITH_BACKUP, DESFire::MDCM_PLAIN, 0xEEEE, { { 0 } } } },
+};
+
+byte frames[32];
+DESFire::mifare_desfire_compiled_layout_t layout;
+uint32_t uploaded;                 // First sequence not uploaded yet
+uint16_t taps = 0;
+
+/**
+ * One tap: reads the purse, debits one unit and logs the transaction.
+ */
+void tap() {
+  DesfireLog::record_t record;
+  DESFire::StatusCode response;
+
+  memset(&record, 0, sizeof(record));
+  record.timestamp = millis();
+  memcpy(record.uid, reader.uid.uidByte, MIFARE_UID_BYTES);
+  memcpy(record.aid, purse.data, MIFARE_AID_SIZE);
+
+  response = reader.MIFARE_DESFIRE_GetValue(&tag, 0x01, &record.value_before);
+  if (reader.IsStatusCodeOK(response)) {
+    // Debit, the simulated card has no Debit command: another terminal sets the value
+    card.SetValue(purse.data, 0x01, record.value_before - 1);
+    response = reader.MIFARE_DESFIRE_GetValue(&tag, 0x01, &record.value_after);
+  }
+  record.mfrc522_status = response.mfrc522;
+  record.desfire_status = response.desfire;
+
+  if ( ! transactions.Append(&record)) {
+    Serial.println(F("Log full, transaction refused"));
+    return;
+  }
+
+  Serial.print(F("Tap "));
+  Serial.print(record.sequence);
+  Serial.print(F(": "));
+  Serial.print(record.value_before);
+  Serial.print(F(" -> "));
+  Serial.println(record.value_after);
+}
+
+/**
+ * Sends every record not uploaded yet to the "back-office" (Serial) and acknowledges them.
+ */
+void upload() {
+  DesfireLog::record_t record;
+
+  if (uploaded < transactions.GetFirstSequence()) {
+    Serial.print(F("Lost records "));
+    Serial.print(uploaded);
+    Serial.print(F(" to "));
+    Serial.println(transactions.GetFirstSequence() - 1);
+    uploaded = transactions.GetFirstSequence();
+  }
+
+  while (uploaded < transactions.GetNextSequence() && transactions.Read(uploaded, &record)) {
+    Serial.print(F("  upload #"));
+    Serial.print(record.sequence);
+    Serial.print(F(" at "));
+    Serial.print(record.timestamp);
+    Serial.print(F(" ms: "));
+    Serial.print(record.value_before - record.value_after);
+    Serial.println(F(" unit"));
+    uploaded++;
+  }
+
+  transactions.Acknowledge(uploaded);
+}
+
+void setup() {
+  Serial.begin(9600);   // Initialize serial communications with the PC
+  while (!Serial);    // Do nothing if no serial port is opened (added for Arduinos based on ATMEGA32U4)
+
+#if defined(LOG_IN_EEPROM) && (defined(ESP8266) || defined(ESP32))
+  EEPROM.begin(LOG_SIZE);
+#endif
+  if ( ! transactions.Begin()) {
+    Serial.println(F("The storage is too small for the log!"));
+    while (true);
+  }
+  uploaded = transactions.GetFirstSequence();
+  Serial.print(F("Log recovered, records "));
+  Serial.print(transactions.GetFirstSequence());
+  Serial.print(F(" to "));
+  Serial.println(transactions.GetNextSequence());
+
+  // Purse between 0 and 10000, full
+  files[0].settings.settings.value_file.upper_limit = 10000;
+  layout.frames = frames;
+  layout.capacity = sizeof(frames);
+  reader.PICC_MifareDesfireCompileLayout(applications, 1, files, 1, &layout);
+
+  byte ats[16];
+  byte atsLength = sizeof(ats);
+  uint16_t failedStep = 0;
+  DESFire::StatusCode response;
+
+  reader.PCD_SetTransport(&card);
+  reader.uid.size = MIFARE_UID_BYTES;
+  memcpy(reader.uid.uidByte, uid, MIFARE_UID_BYTES);
+  response.desfire = DESFire::MF_OPERATION_OK;
+  response.mfrc522 = reader.PICC_RequestATS(&tag, ats, &atsLength);
+  if (reader.IsStatusCodeOK(response))
+    response = reader.PICC_MifareDesfirePersonalize(&tag, &layout, &failedStep);
+  if (reader.IsStatusCodeOK(response))
+    response = reader.MIFARE_DESFIRE_SelectApplication(&tag, &purse);
+  if ( ! reader.IsStatusCodeOK(response)) {
+    Serial.print(F("Failed to personalize the card: "));
+    Serial.println(reader.GetStatusCodeName(response));
+    while (true);
+  }
+  card.SetValue(purse.data, 0x01, 10000);
+}
+
+void loop() {
+  tap();
+  taps++;
+
+  // Idle time until the next tap
+  transactions.Flush();
+
+  if (taps % UPLOAD_EVERY == 0) {
+    Serial.print(F("Uploading, "));
+    Serial.print(transactions.GetNextSequence() - uploaded);
+    Serial.println(F(" records"));
+    upload();
+#ifndef LOG_IN_EEPROM
+    Serial.print(F("Sector erases so far: "));
+    Serial.println(storage.erases);
+#endif
+  }
+
+  delay(500);
+}
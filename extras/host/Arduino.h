@@ -0,0 +1,117 @@
+#ifndef DESFIRE_HOST_ARDUINO_h
+#define DESFIRE_HOST_ARDUINO_h
+
+/* --------------------------------------
+* Host Core
+* --------------------------------------
+* The part of the Arduino core the DESFire and MFRC522 libraries use, on a POSIX host (Linux,
+* or any POSIX system without spidev for simulated cards only). Put this directory first on
+* the include path so <Arduino.h> and <SPI.h> resolve here, see extras/host/README.md.
+*
+* Time comes from CLOCK_MONOTONIC, Serial writes to stdout and random() keeps its state per
+* thread, so readers on threads of their own share nothing through the core. Pins are not
+* GPIOs: a chip select pin attached to a spidev device with SPI.Attach() selects it, every
+* other pin reads HIGH and ignores writes.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define LOW             0
+#define HIGH            1
+#define INPUT           0x0
+#define OUTPUT          0x1
+#define INPUT_PULLUP    0x2
+
+#define DEC             10
+#define HEX             16
+#define OCT             8
+#define BIN             2
+
+static const uint8_t SS = 0;              // Default chip select of MFRC522()
+
+// No separate program memory, PROGMEM data is read in place
+#define PROGMEM
+#define PSTR(s)                 (s)
+#define pgm_read_byte(addr)     (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)     (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr)    (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr)      (*(void * const *)(addr))
+#define memcpy_P                memcpy
+#define strlen_P                strlen
+typedef const char *PGM_P;
+
+class __FlashStringHelper;
+#define F(string_literal)       (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+class Print {
+public:
+	virtual ~Print() {};
+
+	virtual size_t write(uint8_t c);
+	virtual size_t write(const uint8_t *buffer, size_t size);
+
+	size_t print(const __FlashStringHelper *s);
+	size_t print(const char s[]);
+	size_t print(char c);
+	size_t print(unsigned char n, int base = DEC);
+	size_t print(int n, int base = DEC);
+	size_t print(unsigned int n, int base = DEC);
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t print(long long n, int base = DEC);
+	size_t print(unsigned long long n, int base = DEC);
+	size_t print(double n, int digits = 2);
+
+	size_t println(const __FlashStringHelper *s);
+	size_t println(const char s[]);
+	size_t println(char c);
+	size_t println(unsigned char n, int base = DEC);
+	size_t println(int n, int base = DEC);
+	size_t println(unsigned int n, int base = DEC);
+	size_t println(long n, int base = DEC);
+	size_t println(unsigned long n, int base = DEC);
+	size_t println(long long n, int base = DEC);
+	size_t println(unsigned long long n, int base = DEC);
+	size_t println(double n, int digits = 2);
+	size_t println(void);
+
+protected:
+	size_t printNumber(unsigned long long n, int base, bool negative);
+};
+
+// stdout, one write() per call so lines of concurrent readers do not mix within a print
+class HardwareSerial : public Print {
+public:
+	void begin(unsigned long baud) {};
+	void end() {};
+	void flush();
+	operator bool() { return true; };
+
+	virtual size_t write(uint8_t c);
+	virtual size_t write(const uint8_t *buffer, size_t size);
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,45 @@
+#include <DesfireReaderPool.h>
+
+/**
+ * Starts one thread per reader, each running task with its reader index 0 to readerCount-1.
+ *
+ * @return false if the pool is already running, too small, or a thread could not be created
+ *         (the threads already started still run, Join() them).
+ */
+bool DesfireReaderPool::Start(byte readerCount, task_t task, void *context)
+{
+	if (_readerCount != 0 || readerCount > DESFIRE_POOL_MAX_READERS)
+		return false;
+
+	_task = task;
+	_context = context;
+
+	for (byte i = 0; i < readerCount; i++) {
+		_workers[i].pool = this;
+		_workers[i].reader = i;
+		if (pthread_create(&_threads[i], NULL, Work, &_workers[i]) != 0)
+			return false;
+		_readerCount++;
+	}
+
+	return true;
+} // End Start()
+
+/**
+ * Waits for every reader's task to return, the pool can then be started again.
+ */
+void DesfireReaderPool::Join()
+{
+	for (byte i = 0; i < _readerCount; i++)
+		pthread_join(_threads[i], NULL);
+
+	_readerCount = 0;
+} // End Join()
+
+void *DesfireReaderPool::Work(void *worker)
+{
+	worker_t *self = (worker_t *)worker;
+
+	self->pool->_task(self->reader, self->pool->_context);
+	return NULL;
+} // End Work()
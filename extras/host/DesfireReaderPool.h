@@ -0,0 +1,53 @@
+#ifndef DESFIRE_READER_POOL_h
+#define DESFIRE_READER_POOL_h
+
+#include <Arduino.h>
+#include <pthread.h>
+
+/* --------------------------------------
+* Reader Pool (host only)
+* --------------------------------------
+* Runs each reader on a POSIX thread of its own. A DESFire instance keeps its whole state in
+* itself and its sessions, so a reader needs no lock as long as one thread drives it:
+*
+*   void serve(byte reader, void *context) {
+*     // Owns readers[reader], its transport and sessions until it returns
+*   }
+*
+*   DesfireReaderPool pool;
+*   pool.Start(4, serve, NULL);
+*   pool.Join();
+*
+* Readers sharing an SPI bus take turns on it in SPI.beginTransaction(), readers on simulated
+* cards or buses of their own run fully in parallel.
+*/
+#ifndef DESFIRE_POOL_MAX_READERS
+#define DESFIRE_POOL_MAX_READERS    64  /* threads in a pool */
+#endif
+
+class DesfireReaderPool {
+public:
+	// Serves one reader until it returns, on the reader's thread
+	typedef void (*task_t)(byte reader, void *context);
+
+	bool Start(byte readerCount, task_t task, void *context);
+	void Join();
+
+	byte GetReaderCount() { return _readerCount; };
+
+protected:
+	typedef struct {
+		DesfireReaderPool *pool;
+		byte reader;
+	} worker_t;
+
+	pthread_t _threads[DESFIRE_POOL_MAX_READERS];
+	worker_t _workers[DESFIRE_POOL_MAX_READERS];
+	byte _readerCount = 0;
+	task_t _task = NULL;
+	void *_context = NULL;
+
+	static void *Work(void *worker);
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <stdio.h>
+#include <time.h>
+
+HardwareSerial Serial;
+
+static uint64_t MonotonicMicros()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+} // End MonotonicMicros()
+
+/**
+ * Time since the first call, wrapping like on a board.
+ */
+static uint64_t ElapsedMicros()
+{
+	static const uint64_t started = MonotonicMicros();   // Initialized once, whichever thread comes first
+
+	return MonotonicMicros() - started;
+} // End ElapsedMicros()
+
+unsigned long millis()
+{
+	return (unsigned long)(uint32_t)(ElapsedMicros() / 1000);
+} // End millis()
+
+unsigned long micros()
+{
+	return (unsigned long)(uint32_t)ElapsedMicros();
+} // End micros()
+
+void delay(unsigned long ms)
+{
+	struct timespec wait = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000 };
+	while (nanosleep(&wait, &wait) != 0);
+} // End delay()
+
+void delayMicroseconds(unsigned int us)
+{
+	struct timespec wait = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+	while (nanosleep(&wait, &wait) != 0);
+} // End delayMicroseconds()
+
+void yield(void)
+{
+} // End yield()
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+} // End pinMode()
+
+/**
+ * Chip select pins attached to spidev devices open and close their transfers, other pins are
+ * not wired to anything.
+ */
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+	SPI.Select(pin, value == LOW);
+} // End digitalWrite()
+
+/**
+ * No GPIOs: reads HIGH, so MFRC522::PCD_Init() soft resets instead of pulsing RST.
+ */
+int digitalRead(uint8_t pin)
+{
+	return HIGH;
+} // End digitalRead()
+
+/**
+ * Noise from the clock, enough to pass to randomSeed().
+ */
+int analogRead(uint8_t pin)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_nsec & 0x3FF;
+} // End analogRead()
+
+// Per thread, like a board running one sketch: concurrent readers neither lock nor share it
+static thread_local uint32_t randomState = 1;
+
+void randomSeed(unsigned long seed)
+{
+	if (seed != 0)
+		randomState = (uint32_t)seed;
+} // End randomSeed()
+
+/**
+ * xorshift32, not suited to key material: see DESFire::PCD_DesfireRandom().
+ */
+long random(long howbig)
+{
+	if (howbig <= 0)
+		return 0;
+
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return randomState % howbig;
+} // End random()
+
+long random(long howsmall, long howbig)
+{
+	if (howsmall >= howbig)
+		return howsmall;
+
+	return random(howbig - howsmall) + howsmall;
+} // End random()
+
+/* --------------------------------------
+* Print
+* --------------------------------------
+*/
+size_t Print::write(uint8_t c)
+{
+	return 0;
+} // End write()
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+	size_t written = 0;
+
+	while (size--)
+		written += write(*buffer++);
+
+	return written;
+} // End write()
+
+size_t Print::printNumber(unsigned long long n, int base, bool negative)
+{
+	char buffer[8 * sizeof(n) + 2];
+	char *digit = &buffer[sizeof(buffer) - 1];
+
+	if (base < 2)
+		base = 10;
+
+	*digit = '\0';
+	do {
+		byte remainder = n % base;
+		n /= base;
+		*--digit = (remainder < 10) ? '0' + remainder : 'A' + remainder - 10;
+	} while (n != 0);
+
+	if (negative)
+		*--digit = '-';
+
+	return write((const uint8_t *)digit, strlen(digit));
+} // End printNumber()
+
+size_t Print::print(const __FlashStringHelper *s) { return print(reinterpret_cast<const char *>(s)); }
+size_t Print::print(const char s[]) { return write((const uint8_t *)s, strlen(s)); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(unsigned char n, int base) { return printNumber(n, base, false); }
+size_t Print::print(int n, int base) { return print((long long)n, base); }
+size_t Print::print(unsigned int n, int base) { return printNumber(n, base, false); }
+size_t Print::print(long n, int base) { return print((long long)n, base); }
+size_t Print::print(unsigned long n, int base) { return printNumber(n, base, false); }
+size_t Print::print(unsigned long long n, int base) { return printNumber(n, base, false); }
+
+/**
+ * Negative numbers in base 10 only, other bases print the two's complement like Arduino.
+ */
+size_t Print::print(long long n, int base)
+{
+	if (base == 10 && n < 0)
+		return printNumber(-(unsigned long long)n, base, true);
+
+	if (base != 10 && n < 0 && n >= INT32_MIN)
+		return printNumber((uint32_t)n, base, false);
+
+	return printNumber((unsigned long long)n, base, false);
+} // End print()
+
+size_t Print::print(double n, int digits)
+{
+	char buffer[48];
+
+	snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+	return print(buffer);
+} // End print()
+
+size_t Print::println(void) { return write((const uint8_t *)"\r\n", 2); }
+size_t Print::println(const __FlashStringHelper *s) { size_t n = print(s); return n + println(); }
+size_t Print::println(const char s[]) { size_t n = print(s); return n + println(); }
+size_t Print::println(char c) { size_t n = print(c); return n + println(); }
+size_t Print::println(unsigned char n, int base) { size_t w = print(n, base); return w + println(); }
+size_t Print::println(int n, int base) { size_t w = print(n, base); return w + println(); }
+size_t Print::println(unsigned int n, int base) { size_t w = print(n, base); return w + println(); }
+size_t Print::println(long n, int base) { size_t w = print(n, base); return w + println(); }
+size_t Print::println(unsigned long n, int base) { size_t w = print(n, base); return w + println(); }
+size_t Print::println(long long n, int base) { size_t w = print(n, base); return w + println(); }
+size_t Print::println(unsigned long long n, int base) { size_t w = print(n, base); return w + println(); }
+size_t Print::println(double n, int digits) { size_t w = print(n, digits); return w + println(); }
+
+/* --------------------------------------
+* Serial
+* --------------------------------------
+*/
+size_t HardwareSerial::write(uint8_t c)
+{
+	return fwrite(&c, 1, 1, stdout);
+} // End write()
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+	return fwrite(buffer, 1, size, stdout);
+} // End write()
+
+void HardwareSerial::flush()
+{
+	fflush(stdout);
+} // End flush()
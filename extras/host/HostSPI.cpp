@@ -0,0 +1,150 @@
+#include <SPI.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#endif
+
+SPIClass SPI;
+
+/**
+ * Makes chipSelectPin the chip select of a spidev device, such as "/dev/spidev0.0". Call before
+ * PCD_Init() of the MFRC522 created with that pin.
+ *
+ * @return true if the device could be opened.
+ */
+bool SPIClass::Attach(uint8_t chipSelectPin, const char *device)
+{
+#ifdef __linux__
+	if (_deviceCount >= SPI_HOST_MAX_DEVICES || FindDevice(chipSelectPin) != NULL)
+		return false;
+
+	int fd = open(device, O_RDWR);
+	if (fd < 0)
+		return false;
+
+	_devices[_deviceCount].pin = chipSelectPin;
+	_devices[_deviceCount].fd = fd;
+	_deviceCount++;
+	return true;
+#else
+	return false;
+#endif
+} // End Attach()
+
+void SPIClass::end()
+{
+#ifdef __linux__
+	for (uint8_t i = 0; i < _deviceCount; i++)
+		close(_devices[i].fd);
+#endif
+	_deviceCount = 0;
+	_selected = NULL;
+} // End end()
+
+SPIClass::device_t *SPIClass::FindDevice(uint8_t pin)
+{
+	for (uint8_t i = 0; i < _deviceCount; i++) {
+		if (_devices[i].pin == pin)
+			return &_devices[i];
+	}
+
+	return NULL;
+} // End FindDevice()
+
+/**
+ * Takes the bus for the transfers up to endTransaction(), other threads wait their turn.
+ */
+void SPIClass::beginTransaction(SPISettings settings)
+{
+	pthread_mutex_lock(&_bus);
+	_settings = settings;
+} // End beginTransaction()
+
+void SPIClass::endTransaction()
+{
+	// A chip select left low would hold the bus on the next message
+	if (_selected != NULL)
+		Select(_selected->pin, false);
+
+	pthread_mutex_unlock(&_bus);
+} // End endTransaction()
+
+/**
+ * Called by digitalWrite(): opens a transfer on the device of pin, or closes it by releasing
+ * its chip select. Pins without a device are ignored.
+ *
+ * @return true if pin belongs to a device.
+ */
+bool SPIClass::Select(uint8_t chipSelectPin, bool selected)
+{
+	device_t *device = FindDevice(chipSelectPin);
+
+	if (device == NULL)
+		return false;
+
+	if (selected) {
+		_selected = Configure(device) ? device : NULL;
+	}
+	else if (_selected == device) {
+		Message(device, NULL, 0, false);
+		_selected = NULL;
+	}
+
+	return true;
+} // End Select()
+
+/**
+ * Applies the mode and bit order of the transaction to device.
+ */
+bool SPIClass::Configure(device_t *device)
+{
+#ifdef __linux__
+	uint8_t mode = _settings.dataMode;
+	uint8_t lsbFirst = (_settings.bitOrder == LSBFIRST) ? 1 : 0;
+	uint8_t bits = 8;
+
+	return ioctl(device->fd, SPI_IOC_WR_MODE, &mode) >= 0
+		&& ioctl(device->fd, SPI_IOC_WR_LSB_FIRST, &lsbFirst) >= 0
+		&& ioctl(device->fd, SPI_IOC_WR_BITS_PER_WORD, &bits) >= 0;
+#else
+	return false;
+#endif
+} // End Configure()
+
+/**
+ * Sends length bytes of data and replaces them with the bytes received, in one message. With
+ * keepSelected the chip select stays low after it for the next byte of the same transfer, an
+ * empty message without it only releases the chip select.
+ */
+bool SPIClass::Message(device_t *device, uint8_t *data, uint32_t length, bool keepSelected)
+{
+#ifdef __linux__
+	struct spi_ioc_transfer transfer;
+
+	memset(&transfer, 0, sizeof(transfer));
+	transfer.tx_buf = (unsigned long)data;
+	transfer.rx_buf = (unsigned long)data;
+	transfer.len = length;
+	transfer.speed_hz = _settings.clock;
+	transfer.bits_per_word = 8;
+	transfer.cs_change = keepSelected ? 1 : 0;
+
+	return ioctl(device->fd, SPI_IOC_MESSAGE(1), &transfer) >= 0;
+#else
+	return false;
+#endif
+} // End Message()
+
+/**
+ * Exchanges one byte with the selected device, 0xFF with none (MISO pulled up).
+ */
+uint8_t SPIClass::transfer(uint8_t data)
+{
+	if (_selected == NULL || !Message(_selected, &data, 1, true))
+		return 0xFF;
+
+	return data;
+} // End transfer()
@@ -0,0 +1,233 @@
+/*
+ * --------------------------------------------------------------------------------------------------------------------
+ * Host program measuring how DESFire session throughput scales with the number of readers.
+ * --------------------------------------------------------------------------------------------------------------------
+ * Runs 1, 2, 4... readers on a DesfireReaderPool, each with its own DESFire instance, session and DesfireSimulatedCard
+ * personalized on its own thread. A session is what a gate does on every tap: RATS, select the application,
+ * authenticate with AES, read a 32 byte ticket and the purse, their CMAC verified. Every reader runs the same number
+ * of sessions after a common start, so the wall time stays flat while readers get cores of their own.
+ *
+ * Usage: ReaderPoolBenchmark [max readers] [sessions per reader], defaults twice the online CPUs and 2000. See
+ * extras/host/README.md to build it.
+ *
+ * @license Released into the public domain.
+ */
+
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <Desfire.h>
+#include <DesfireSimulatedCard.h>
+#include <DesfireReaderPool.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TICKET_SIZE     32
+
+const byte key[16] = { 0 };
+DESFire::mifare_desfire_aid_t ticketing = { { 0x01, 0x02, 0x03 } };
+
+DESFire::mifare_desfire_application_layout_t applications[] = {
+  { { { 0x01, 0x02, 0x03 } }, 0x0F, 0x81 },
+};
+
+DESFire::mifare_desfire_file_layout_t files[] = {
+  { { { 0x01, 0x02, 0x03 } }, 0x01, { DESFire::MDFT_STANDARD_DATA_FILE, DESFire::MDCM_PLAIN, 0xEEEE, { { TICKET_SIZE } } } },
+  { { { 0x01, 0x02, 0x03 } }, 0x02, { DESFire::MDFT_VALUE_FILE_WITH_BACKUP, DESFire::MDCM_PLAIN, 0xEEEE, { { 0 } } } },
+};
+
+// What one reader thread reports, a cache line each so the counters do not bounce between cores
+typedef struct alignas(64) {
+  uint64_t started;
+  uint64_t finished;
+  uint32_t sessions;
+  uint32_t failures;
+} result_t;
+
+typedef struct {
+  uint32_t sessions;               // Per reader
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  byte ready;                      // Readers personalized
+  bool go;                         // Every reader started and personalized
+  bool cancelled;                  // Some reader could not be started
+  result_t results[DESFIRE_POOL_MAX_READERS];
+} benchmark_t;
+
+static uint64_t now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/**
+ * One tap at a gate.
+ */
+static DESFire::StatusCode session(DESFire *reader, DESFire::DesfireSession *tag, byte *ticket) {
+  DESFire::StatusCode response;
+  byte ats[16];
+  byte atsLength = sizeof(ats);
+  size_t length = TICKET_SIZE;
+  int32_t value;
+
+  response.desfire = DESFire::MF_OPERATION_OK;
+  response.mfrc522 = reader->PICC_RequestATS(tag, ats, &atsLength);
+  if (reader->IsStatusCodeOK(response))
+    response = reader->MIFARE_DESFIRE_SelectApplication(tag, &ticketing);
+  if (reader->IsStatusCodeOK(response))
+    response = reader->MIFARE_DESFIRE_AuthenticateAES(tag, 0x00, key);
+  if (reader->IsStatusCodeOK(response))
+    response = reader->MIFARE_DESFIRE_ReadData(tag, 0x01, 0, TICKET_SIZE, ticket, &length);
+  if (reader->IsStatusCodeOK(response) && length != TICKET_SIZE)
+    response.mfrc522 = MFRC522::STATUS_ERROR;
+  if (reader->IsStatusCodeOK(response))
+    response = reader->MIFARE_DESFIRE_GetValue(tag, 0x02, &value);
+
+  return response;
+}
+
+/**
+ * A reader's thread: everything it touches is its own, from the layout to the card.
+ */
+static void serve(byte index, void *context) {
+  benchmark_t *benchmark = (benchmark_t *)context;
+  result_t *result = &benchmark->results[index];
+  byte uid[MIFARE_UID_BYTES] = { 0x04, 0x50, 0x4F, 0x4F, 0x4C, 0x00, index };
+  byte frames[64];
+  byte ticket[TICKET_SIZE];
+  byte expected[TICKET_SIZE];
+  DESFire::mifare_desfire_compiled_layout_t layout;
+  DESFire::DesfireSession tag;
+  DESFire reader;
+  DesfireSimulatedCard card(uid);
+  uint16_t failedStep = 0;
+  byte ats[16];
+  byte atsLength = sizeof(ats);
+
+  randomSeed(analogRead(0) + index + 1);
+  reader.PCD_SetTransport(&card);
+  reader.uid.size = MIFARE_UID_BYTES;
+  memcpy(reader.uid.uidByte, uid, MIFARE_UID_BYTES);
+
+  layout.frames = frames;
+  layout.capacity = sizeof(frames);
+  reader.PICC_MifareDesfireCompileLayout(applications, 1, files, 2, &layout);
+  reader.PICC_RequestATS(&tag, ats, &atsLength);
+  reader.PICC_MifareDesfirePersonalize(&tag, &layout, &failedStep);
+  for (byte i = 0; i < TICKET_SIZE; i++)
+    expected[i] = index + i;
+  card.WriteData(ticketing.data, 0x01, 0, expected, TICKET_SIZE);
+  card.SetValue(ticketing.data, 0x02, 100);
+
+  // A common start, or none at all when the pool could not start every reader
+  pthread_mutex_lock(&benchmark->lock);
+  benchmark->ready++;
+  pthread_cond_broadcast(&benchmark->changed);
+  while ( ! benchmark->go && ! benchmark->cancelled)
+    pthread_cond_wait(&benchmark->changed, &benchmark->lock);
+  bool cancelled = benchmark->cancelled;
+  pthread_mutex_unlock(&benchmark->lock);
+  if (cancelled)
+    return;
+
+  result->started = now();
+  for (uint32_t i = 0; i < benchmark->sessions; i++) {
+    if (reader.IsStatusCodeOK(session(&reader, &tag, ticket)) && memcmp(ticket, expected, TICKET_SIZE) == 0)
+      result->sessions++;
+    else
+      result->failures++;
+  }
+  result->finished = now();
+}
+
+/**
+ * @return Sessions per second of readerCount readers, 0 if one failed.
+ */
+static double benchmark(byte readerCount, uint32_t sessions) {
+  static benchmark_t benchmark;
+  DesfireReaderPool pool;
+  bool poolStarted;
+
+  memset(benchmark.results, 0, sizeof(benchmark.results));
+  benchmark.sessions = sessions;
+  benchmark.ready = 0;
+  benchmark.go = false;
+  benchmark.cancelled = false;
+  pthread_mutex_init(&benchmark.lock, NULL);
+  pthread_cond_init(&benchmark.changed, NULL);
+
+  // The readers already started wait for the others, release them whether or not they all came
+  poolStarted = pool.Start(readerCount, serve, &benchmark);
+  pthread_mutex_lock(&benchmark.lock);
+  if (poolStarted) {
+    while (benchmark.ready < readerCount)
+      pthread_cond_wait(&benchmark.changed, &benchmark.lock);
+    benchmark.go = true;
+  }
+  else {
+    benchmark.cancelled = true;
+  }
+  pthread_cond_broadcast(&benchmark.changed);
+  pthread_mutex_unlock(&benchmark.lock);
+
+  pool.Join();
+  pthread_cond_destroy(&benchmark.changed);
+  pthread_mutex_destroy(&benchmark.lock);
+
+  if ( ! poolStarted) {
+    printf("Could not start %u readers\n", readerCount);
+    return 0;
+  }
+
+  uint64_t started = benchmark.results[0].started;
+  uint64_t finished = benchmark.results[0].finished;
+  uint32_t done = 0;
+  uint32_t failures = 0;
+  for (byte r = 0; r < readerCount; r++) {
+    if (benchmark.results[r].started < started)
+      started = benchmark.results[r].started;
+    if (benchmark.results[r].finished > finished)
+      finished = benchmark.results[r].finished;
+    done += benchmark.results[r].sessions;
+    failures += benchmark.results[r].failures;
+  }
+
+  if (failures != 0) {
+    printf("%u readers: %u sessions failed\n", readerCount, failures);
+    return 0;
+  }
+
+  return done * 1e9 / (finished - started);
+}
+
+int main(int argc, char **argv) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  long maxReaders = (argc > 1) ? atol(argv[1]) : 2 * cpus;
+  long sessions = (argc > 2) ? atol(argv[2]) : 2000;
+
+  if (maxReaders < 1 || maxReaders > DESFIRE_POOL_MAX_READERS || sessions < 1) {
+    printf("Usage: %s [max readers, 1 to %d] [sessions per reader]\n", argv[0], DESFIRE_POOL_MAX_READERS);
+    return 1;
+  }
+
+  printf("%ld CPUs online, %ld sessions per reader\n", cpus, sessions);
+  printf("readers  sessions/s  speedup\n");
+
+  double single = 0;
+  for (long readers = 1; ; readers *= 2) {
+    if (readers > maxReaders)
+      readers = maxReaders;
+
+    double throughput = benchmark(readers, sessions);
+    if (throughput == 0)
+      return 1;
+    if (readers == 1)
+      single = throughput;
+    printf("%7ld  %10.0f  %6.2fx\n", readers, throughput, throughput / single);
+
+    if (readers == maxReaders)
+      break;
+  }
+
+  return 0;
+}
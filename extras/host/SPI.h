@@ -0,0 +1,75 @@
+#ifndef DESFIRE_HOST_SPI_h
+#define DESFIRE_HOST_SPI_h
+
+#include <Arduino.h>
+#include <pthread.h>
+
+/* --------------------------------------
+* Host SPI
+* --------------------------------------
+* Arduino SPI on Linux spidev. Each MFRC522 is a spidev device whose chip select is driven by
+* the kernel, attached to the chip select pin its MFRC522 instance was created with:
+*
+*   DESFire mfrc522(0, MFRC522::UNUSED_PIN);
+*   SPI.Attach(0, "/dev/spidev0.0");
+*   SPI.begin();
+*   mfrc522.PCD_Init();
+*
+* digitalWrite() LOW on that pin opens a transfer on the device and HIGH closes it, the bytes
+* in between go out in one chip select cycle. A transaction holds the bus, readers on threads
+* of their own take turns on it between register accesses. Without spidev (not Linux) Attach()
+* fails and only transports other than the MFRC522, such as DesfireSimulatedCard, work.
+*/
+#ifndef SPI_HOST_MAX_DEVICES
+#define SPI_HOST_MAX_DEVICES    8   /* MFRC522s on the bus */
+#endif
+
+#define SPI_MODE0       0x00
+#define SPI_MODE1       0x01
+#define SPI_MODE2       0x02
+#define SPI_MODE3       0x03
+
+#define LSBFIRST        0
+#define MSBFIRST        1
+
+class SPISettings {
+public:
+	SPISettings() : clock(4000000), bitOrder(MSBFIRST), dataMode(SPI_MODE0) {};
+	SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) : clock(clock), bitOrder(bitOrder), dataMode(dataMode) {};
+
+	uint32_t clock;
+	uint8_t bitOrder;
+	uint8_t dataMode;
+};
+
+class SPIClass {
+public:
+	bool Attach(uint8_t chipSelectPin, const char *device);
+	bool Select(uint8_t chipSelectPin, bool selected);
+
+	void begin() {};
+	void end();
+	void beginTransaction(SPISettings settings);
+	void endTransaction();
+	uint8_t transfer(uint8_t data);
+
+protected:
+	typedef struct {
+		uint8_t pin;
+		int fd;
+	} device_t;
+
+	device_t _devices[SPI_HOST_MAX_DEVICES];
+	uint8_t _deviceCount = 0;
+	device_t *_selected = NULL;           // Device between digitalWrite() LOW and HIGH
+	SPISettings _settings;
+	pthread_mutex_t _bus = PTHREAD_MUTEX_INITIALIZER;
+
+	device_t *FindDevice(uint8_t pin);
+	bool Configure(device_t *device);
+	bool Message(device_t *device, uint8_t *data, uint32_t length, bool keepSelected);
+};
+
+extern SPIClass SPI;
+
+#endif
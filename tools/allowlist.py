@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""
+Generates a flash resident UID allow-list for DesfireAllowList.
+
+Reads UIDs or credential IDs (hex, one per line, separators and '#' comments allowed), pads
+them to 7 bytes, removes duplicates, sorts them and writes a header to include in a sketch:
+
+    tools/allowlist.py doors uids.txt > doors.h
+
+With --bench it instead reports how many entries a lookup reads for lists of several sizes,
+using the same search as DesfireAllowList::Contains(), against plain binary search. The time
+per lookup on a board is printed by examples/AllowListBenchmark.ino.
+"""
+
+import argparse
+import random
+import re
+import sys
+
+UID_BYTES = 7
+SLACK = 1
+AVR_MAX_COUNT = 32767 // UID_BYTES
+
+
+def parse(lines):
+    uids = set()
+    for number, line in enumerate(lines, 1):
+        line = line.split('#', 1)[0]
+        digits = re.sub(r'[\s:\-]', '', line)
+        if not digits:
+            continue
+        if not re.fullmatch(r'[0-9a-fA-F]+', digits) or len(digits) % 2 or len(digits) > 2 * UID_BYTES:
+            raise ValueError('line %d: invalid UID %r' % (number, line.strip()))
+        uids.add(bytes.fromhex(digits).ljust(UID_BYTES, b'\x00'))
+    return sorted(uids)
+
+
+def header(name, uids):
+    if len(uids) > 0xFFFF:
+        raise ValueError('at most 65535 entries are supported')
+    out = ['// Generated by tools/allowlist.py, do not edit.',
+           '#include <DesfireAllowList.h>',
+           '',
+           'const byte %s_entries[] PROGMEM = {' % name]
+    for uid in uids:
+        out.append('\t' + ', '.join('0x%02X' % b for b in uid) + ',')
+    out.append('};')
+    out.append('const uint16_t %s_count = %d;' % (name, len(uids)))
+    out.append('static_assert(%s_count <= DESFIRE_ALLOWLIST_MAX_COUNT, "%s: too many UIDs for one list on this board");'
+               % (name, name))
+    return '\n'.join(out) + '\n'
+
+
+def lookup(uids, uid):
+    """Mirror of DesfireAllowList::Contains(), returns (found, entries read)."""
+    def key_of(entry):
+        return int.from_bytes(entry[:4], 'big')
+
+    key = key_of(uid)
+    if not uids:
+        return False, 0
+    low, high = 0, len(uids) - 1
+    low_index, high_index = low, high
+    # Read once by the constructor
+    low_key, high_key = key_of(uids[low]), key_of(uids[high])
+    budget, interpolate, reads = len(uids) << SLACK, True, 0
+    if key < low_key or key > high_key:
+        return False, reads
+    while low <= high:
+        if interpolate and high_key > low_key:
+            middle = low_index + (key - low_key) * (high_index - low_index) // (high_key - low_key)
+            middle = min(max(middle, low), high)
+        else:
+            middle = low + (high - low) // 2
+        reads += 1
+        if uids[middle] == uid:
+            return True, reads
+        if uids[middle] < uid:
+            low, low_index, low_key = middle + 1, middle, key_of(uids[middle])
+        else:
+            high, high_index, high_key = middle - 1, middle, key_of(uids[middle])
+        budget >>= 1
+        if high - low + 1 > budget:
+            interpolate = False
+    return False, reads
+
+
+def bisect(uids, uid):
+    """Plain binary search, returns (found, entries read)."""
+    low, high, reads = 0, len(uids) - 1, 0
+    while low <= high:
+        middle = low + (high - low) // 2
+        reads += 1
+        if uids[middle] == uid:
+            return True, reads
+        if uids[middle] < uid:
+            low = middle + 1
+        else:
+            high = middle - 1
+    return False, reads
+
+
+def bench(sizes, lookups):
+    print('%8s %10s %10s %12s %12s %10s' % ('entries', 'avg reads', 'max reads', 'bisect avg', 'bisect max', 'flash'))
+    for size in sizes:
+        uids = sorted({bytes([0x04]) + random.randbytes(UID_BYTES - 1) for _ in range(size)})
+        reads, bisections = [], []
+        for _ in range(lookups):
+            uid = random.choice(uids) if random.random() < 0.5 else bytes([0x04]) + random.randbytes(UID_BYTES - 1)
+            reads.append(lookup(uids, uid)[1])
+            bisections.append(bisect(uids, uid)[1])
+        print('%8d %10.1f %10d %12.1f %12d %9dB' % (len(uids), sum(reads) / len(reads), max(reads),
+                                                   sum(bisections) / len(bisections), max(bisections),
+                                                   len(uids) * UID_BYTES))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('name', nargs='?', help='C identifier prefix of the generated arrays')
+    parser.add_argument('input', nargs='?', type=argparse.FileType('r'), default=sys.stdin)
+    parser.add_argument('--bench', action='store_true', help='report entry reads per lookup against list size')
+    args = parser.parse_args()
+
+    if args.bench:
+        bench([100, 1000, AVR_MAX_COUNT, 10000, 30000, 65535], 2000)
+        return
+    if not args.name:
+        parser.error('name is required')
+
+    sys.stdout.write(header(args.name, parse(args.input)))
+
+
+if __name__ == '__main__':
+    main()